@@ -0,0 +1,833 @@
+#include <stdbool.h>
+#include <float.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "geometry.h"
+#include "timer.h"
+
+#define MAX(a, b) ((a < b) ? b : a)
+#define MIN(a, b) ((a < b) ? a : b)
+#define swap(a, b) do {typeof(a) TEMP = a; a = b; b = TEMP;} while (0)
+
+#include "prof.c"
+#include "cpu.c"
+#include "jobs.c"
+#include "imageops.c"
+#include "tga_img.c"
+#include "texcomp.c"
+#include "texcache.c"
+#include "model.c"
+#include "bvh.c"
+#include "raster.c"
+#include "msaa.c"
+#include "img_write.c"
+#include "stream.c"
+#include "wireframe.c"
+#include "render.c"
+
+static
+long
+fileSize(const char *filename)
+{
+    struct stat st;
+    if (stat(filename, &st) == -1)
+        return -1;
+    return st.st_size;
+}
+
+static
+bool
+writeTGARaw(TGA_Image *image, const char *filename)
+{
+    return TGA_ImageWriteFile(image, filename, false);
+}
+
+static
+void
+benchEncodeOne(TGA_Image *image, const char *name, const char *filename, IMG_WriteFn write, int iterations)
+{
+    double best = DBL_MAX;
+    for (int i = 0; i < iterations; i++) {
+        double start = T_Now();
+        if (!write(image, filename)) {
+            fprintf(stderr, "%s: encode failed\n", name);
+            return;
+        }
+        best = MIN(best, T_Now() - start);
+    }
+
+    long size = fileSize(filename);
+    long raw = (long)image->width * image->height * image->bytespp;
+    printf("%-8s %10.3f ms %10.1f MB/s %10ld bytes %6.1f%%\n",
+            name, best * 1e3, raw / best / 1e6, size, 100.0 * size / raw);
+    unlink(filename);
+}
+
+/**
+ * benchEncode - compare encode time and size of every image writer
+ *
+ * Uses the best of @iterations runs, throughput is measured against the
+ * uncompressed pixel data.
+ */
+static
+int
+benchEncode(int argc, char **argv)
+{
+    if (argc < 1) {
+        fprintf(stderr, "usage: bench encode image.tga [iterations]\n");
+        return -1;
+    }
+    int iterations = (argc > 1) ? atoi(argv[1]) : 10;
+    if (iterations < 1)
+        iterations = 1;
+
+    TGA_Image image = {0};
+    if (!TGA_ImageReadFile(&image, argv[0]))
+        return -1;
+
+    printf("%dx%d/%d, best of %d\n", image.width, image.height, image.bytespp * 8, iterations);
+    benchEncodeOne(&image, "tga", "bench_out.tga", writeTGARaw, iterations);
+    for (unsigned long i = 0; i < sizeof(IMG_Writers) / sizeof(IMG_Writers[0]); i++) {
+        char filename[32];
+        snprintf(filename, sizeof(filename), "bench_out.%s", IMG_Writers[i].extension);
+        const char *name = IMG_Writers[i].write == IMG_WriteTGA ? "tga-rle" : IMG_Writers[i].extension;
+        benchEncodeOne(&image, name, filename, IMG_Writers[i].write, iterations);
+    }
+
+    TGA_ImageDelete(&image);
+    return 0;
+}
+
+static unsigned int benchSeed = 1;
+
+static inline
+float
+benchRandom(void)
+{
+    benchSeed = benchSeed * 1664525u + 1013904223u;
+    return (benchSeed >> 8) / (float)(1 << 24);
+}
+
+static
+double
+benchRasterOne(const struct raster_target *target, struct raster_tri *tris, int ntris, int flags, bool generic)
+{
+    double best = DBL_MAX;
+    for (int r = 0; r < 5; r++) {
+        RK_ClearDepth(target->zbuffer, (long)target->width * target->height);
+
+        double start = T_Now();
+        for (int i = 0; i < ntris; i++) {
+            int f = flags;
+            RK_Kernel kernel = RK_Select(target, &tris[i], &f);
+            if (generic)
+                RK_Tables[CPU_Isa][1]->generic(target, &tris[i], f);
+            else
+                kernel(target, &tris[i], f);
+        }
+        best = MIN(best, T_Now() - start);
+    }
+    return best;
+}
+
+/**
+ * benchRaster - time every specialized kernel against the generic one
+ *
+ * Draws random triangles of up to @size pixels into an 800x800 target,
+ * best of 5 runs each.
+ */
+static
+int
+benchRaster(int argc, char **argv)
+{
+    const int ntris = (argc > 0) ? atoi(argv[0]) : 20000;
+    const float size = (argc > 1) ? atof(argv[1]) : 32.0f;
+    const int width = 800, height = 800;
+    if (ntris < 1 || size <= 0.0f) {
+        fprintf(stderr, "usage: bench raster [triangles] [size]\n");
+        return -1;
+    }
+
+    TGA_Image texture = TGA_ImageInit(256, 256, RGB);
+    for (int i = 256 * 256 * RGB; i--; texture.data[i] = i * 7);
+
+    struct raster_tri *tris = (struct raster_tri *)calloc(ntris, sizeof(struct raster_tri));
+    for (int i = 0; i < ntris; i++) {
+        float cx = benchRandom() * width, cy = benchRandom() * height;
+        for (int j = 0; j < 3; j++) {
+            tris[i].s[j] = V3_float(
+                    (int)(cx + (benchRandom() - 0.5f) * size),
+                    (int)(cy + (benchRandom() - 0.5f) * size),
+                    benchRandom() * 2.0f - 1.0f);
+            tris[i].t[j] = V2_float(benchRandom() * texture.width, benchRandom() * texture.height);
+        }
+        tris[i].color = TGA_ColorInit(200, 100, 50, 255);
+        tris[i].intensity = 0.25f + benchRandom() * 0.75f;
+        tris[i].light = V3_float(0.0f, 0.0f, 0.95f);
+        for (int j = 0; j < 3; j++) {
+            tris[i].n[j] = NormV3_float(V3_float(benchRandom() - 0.5f, benchRandom() - 0.5f, 1.0f));
+            tris[i].vi[j] = DotV3_float(tris[i].n[j], tris[i].light);
+        }
+        tris[i].texture = &texture;
+    }
+
+    static const struct {
+        const char *name;
+        int flags;
+    } variants[] = {
+        { "flat",               0 },
+        { "flat+lit",           RASTER_LIT },
+        { "flat+depth",         RASTER_DEPTH },
+        { "flat+lit+depth",     RASTER_LIT | RASTER_DEPTH },
+        { "flat+gouraud+depth", RASTER_LIT | RASTER_GOURAUD | RASTER_DEPTH },
+        { "flat+phong+depth",   RASTER_LIT | RASTER_PHONG | RASTER_DEPTH },
+        { "tex",                RASTER_TEXTURED },
+        { "tex+lit",            RASTER_TEXTURED | RASTER_LIT },
+        { "tex+depth",          RASTER_TEXTURED | RASTER_DEPTH },
+        { "tex+lit+depth",      RASTER_TEXTURED | RASTER_LIT | RASTER_DEPTH },
+        { "tex+gouraud+depth",  RASTER_TEXTURED | RASTER_LIT | RASTER_GOURAUD | RASTER_DEPTH },
+        { "tex+phong+depth",    RASTER_TEXTURED | RASTER_LIT | RASTER_PHONG | RASTER_DEPTH },
+    };
+    printf("%d triangles up to %.0f px, %dx%d target\n", ntris, size, width, height);
+    printf("%-20s %-5s %12s %12s %8s\n", "variant", "bpp", "generic", "specialized", "speedup");
+    for (int bpp = RGB; bpp <= RGBA; bpp++) {
+        TGA_Image image = TGA_ImageInit(width, height, bpp);
+        float *zbuffer = (float *)malloc(sizeof(float) * width * height);
+        struct raster_target target = {
+            .data = image.data, .zbuffer = zbuffer,
+            .width = width, .height = height, .bytespp = bpp
+        };
+
+        for (unsigned long v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+            double generic = benchRasterOne(&target, tris, ntris, variants[v].flags, true);
+            double special = benchRasterOne(&target, tris, ntris, variants[v].flags, false);
+            printf("%-20s %-5s %9.2f Mt/s %9.2f Mt/s %7.2fx\n", variants[v].name, bpp == RGBA ? "rgba" : "rgb",
+                    ntris / generic / 1e6, ntris / special / 1e6, generic / special);
+        }
+
+        free(zbuffer);
+        TGA_ImageDelete(&image);
+    }
+
+    free(tris);
+    TGA_ImageDelete(&texture);
+    return 0;
+}
+
+/* The flips as they were before imageops.c, kept as the baseline. */
+static
+void
+benchFlipHorizontallyOld(TGA_Image *image)
+{
+    int half = image->width >> 1;
+    for (int i = 0; i < half; i++) {
+        for (int j = 0; j < image->height; j++) {
+            TGA_Color c1 = TGA_ImageGet(image, i, j);
+            TGA_Color c2 = TGA_ImageGet(image, image->width - 1 - i, j);
+            TGA_ImageSet(image, i, j, c2);
+            TGA_ImageSet(image, image->width - 1 - i, j, c1);
+        }
+    }
+}
+
+static
+void
+benchFlipVerticallyOld(TGA_Image *image)
+{
+    unsigned long bytesPerLine = image->width * image->bytespp;
+    unsigned char *line = calloc(sizeof(char), bytesPerLine);
+    int half = image->height >> 1;
+    for (int j = 0; j < half; j++) {
+        unsigned long l1 = j * bytesPerLine;
+        unsigned long l2 = (image->height - 1 - j) * bytesPerLine;
+
+        memmove((void *)line, (void *)(image->data + l1), bytesPerLine);
+        memmove((void *)(image->data + l1), (void *)(image->data + l2), bytesPerLine);
+        memmove((void *)(image->data + l2), (void *)line, bytesPerLine);
+    }
+    free(line);
+}
+
+/* Box downsample through the pixel accessors, the straightforward way. */
+static
+void
+benchBoxOld(TGA_Image *src, TGA_Image *dst)
+{
+    int fx = src->width / dst->width, fy = src->height / dst->height;
+    for (int y = 0; y < dst->height; y++) {
+        for (int x = 0; x < dst->width; x++) {
+            unsigned int sum[4] = {0};
+            for (int j = 0; j < fy; j++) {
+                for (int i = 0; i < fx; i++) {
+                    TGA_Color c = TGA_ImageGet(src, x * fx + i, y * fy + j);
+                    for (int k = 0; k < 4; k++)
+                        sum[k] += c.raw[k];
+                }
+            }
+            TGA_Color c = { .bytespp = dst->bytespp };
+            for (int k = 0; k < 4; k++)
+                c.raw[k] = (sum[k] + fx * fy / 2) / (fx * fy);
+            TGA_ImageSet(dst, x, y, c);
+        }
+    }
+}
+
+enum bench_image_op {
+    BENCH_FLIP_H,
+    BENCH_FLIP_V,
+    BENCH_BOX,
+    BENCH_BILINEAR,
+};
+
+static
+double
+benchImageOpOne(enum bench_image_op op, TGA_Image *image, TGA_Image *small, bool old)
+{
+    double best = DBL_MAX;
+    for (int r = 0; r < 5; r++) {
+        double start = T_Now();
+        switch (op) {
+        case BENCH_FLIP_H:
+            if (old)
+                benchFlipHorizontallyOld(image);
+            else
+                IOP_FlipHorizontally(image);
+            break;
+        case BENCH_FLIP_V:
+            if (old)
+                benchFlipVerticallyOld(image);
+            else
+                IOP_FlipVertically(image);
+            break;
+        case BENCH_BOX:
+            if (old)
+                benchBoxOld(image, small);
+            else
+                IOP_Resize(image, small, IOP_BOX);
+            break;
+        case BENCH_BILINEAR:
+            IOP_Resize(image, small, IOP_BILINEAR);
+            break;
+        }
+        best = MIN(best, T_Now() - start);
+    }
+    return best;
+}
+
+/**
+ * benchImageOps - time the image operations against the code they replace
+ *
+ * Works on a @size x @size image, downsampling by 4 in each direction,
+ * best of 5 runs. The new code runs on one thread and on @threads.
+ */
+static
+int
+benchImageOps(int argc, char **argv)
+{
+    const int size = (argc > 0) ? atoi(argv[0]) : 3200;
+    const int threads = (argc > 1) ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (size < 4 || threads < 1) {
+        fprintf(stderr, "usage: bench imageops [size] [threads]\n");
+        return -1;
+    }
+
+    JS_SetThreads(threads);
+    static const char *names[4] = { "flip-h", "flip-v", "box/4", "bilinear/4" };
+    printf("%dx%d, best of 5, %d threads\n", size, size, threads);
+    printf("%-12s %-5s %10s %10s %10s %8s\n", "op", "bpp", "old", "1 thread", "threads", "speedup");
+    for (int bpp = GRAYSCALE; bpp <= RGBA; bpp++) {
+        if (bpp == 2)
+            continue;
+        TGA_Image image = TGA_ImageInit(size, size, bpp);
+        TGA_Image small = TGA_ImageInit(size / 4, size / 4, bpp);
+        for (long i = (long)size * size * bpp; i--; image.data[i] = benchRandom() * 256.0f);
+
+        for (int op = BENCH_FLIP_H; op <= BENCH_BILINEAR; op++) {
+            double old = (op == BENCH_BILINEAR) ? 0.0 : benchImageOpOne(op, &image, &small, true);
+            IOP_SetThreads(1);
+            double one = benchImageOpOne(op, &image, &small, false);
+            IOP_SetThreads(threads);
+            double many = benchImageOpOne(op, &image, &small, false);
+            if (op == BENCH_BILINEAR)
+                printf("%-12s %-5d %10s %7.2f ms %7.2f ms %8s\n", names[op], bpp * 8,
+                        "-", one * 1e3, many * 1e3, "-");
+            else
+                printf("%-12s %-5d %7.2f ms %7.2f ms %7.2f ms %7.1fx\n", names[op], bpp * 8,
+                        old * 1e3, one * 1e3, many * 1e3, old / many);
+        }
+
+        TGA_ImageDelete(&small);
+        TGA_ImageDelete(&image);
+    }
+
+    IOP_SetThreads(0);
+    return 0;
+}
+
+/**
+ * benchTexture - block compressed against raw texture sampling
+ *
+ * Encodes a @size x @size RGB texture, reports the memory saved and the
+ * error, then draws random triangles of up to 32 pixels that map the
+ * whole texture over an 800x800 target, as a large texture seen at a
+ * normal distance, through both paths. Best of 5 runs each.
+ */
+static
+int
+benchTexture(int argc, char **argv)
+{
+    const int size = (argc > 0) ? atoi(argv[0]) : 4096;
+    const int ntris = (argc > 1) ? atoi(argv[1]) : 20000;
+    const int width = 800, height = 800;
+    const float tsize = 32.0f;
+    if (size < 4 || ntris < 1) {
+        fprintf(stderr, "usage: bench texture [size] [triangles]\n");
+        return -1;
+    }
+
+    // smooth gradients with some noise, closer to a diffuse map than noise
+    TGA_Image texture = TGA_ImageInit(size, size, RGB);
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            unsigned char *p = texture.data + ((long)y * size + x) * RGB;
+            p[0] = MIN(255, x * 200 / size + benchRandom() * 32.0f);
+            p[1] = MIN(255, y * 200 / size + benchRandom() * 32.0f);
+            p[2] = MIN(255, (x + y) * 100 / size + benchRandom() * 32.0f);
+        }
+    }
+
+    struct bc_texture compressed;
+    double start = T_Now();
+    if (!BC_Encode(&compressed, &texture)) {
+        fprintf(stderr, "Can't compress the texture\n");
+        TGA_ImageDelete(&texture);
+        return -1;
+    }
+    double encode = T_Now() - start;
+
+    TGA_Image decoded;
+    double error = 0.0;
+    if (BC_Decode(&compressed, &decoded)) {
+        for (long i = (long)size * size * RGB; i--; ) {
+            double d = (double)texture.data[i] - decoded.data[i];
+            error += d * d;
+        }
+        TGA_ImageDelete(&decoded);
+    }
+    error /= (double)size * size * RGB;
+    const unsigned long raw = (unsigned long)size * size * RGB;
+    printf("%dx%d rgb: %.1f MB raw, %.1f MB compressed (%.1f MB saved), encode %.1f ms, psnr %.1f dB\n",
+            size, size, raw / 1048576.0, BC_Bytes(&compressed) / 1048576.0,
+            (raw - BC_Bytes(&compressed)) / 1048576.0, encode * 1e3, 10.0 * log10(255.0 * 255.0 / MAX(error, 1e-9)));
+
+    const float scale = (float)size / width;
+    struct raster_tri *tris = (struct raster_tri *)calloc(ntris, sizeof(struct raster_tri));
+    for (int i = 0; i < ntris; i++) {
+        float cx = benchRandom() * width, cy = benchRandom() * height;
+        for (int j = 0; j < 3; j++) {
+            tris[i].s[j] = V3_float(
+                    (int)(cx + (benchRandom() - 0.5f) * tsize),
+                    (int)(cy + (benchRandom() - 0.5f) * tsize),
+                    benchRandom() * 2.0f - 1.0f);
+            // rotated, texture rows rarely line up with screen rows
+            tris[i].t[j] = V2_float(
+                    (0.6f * tris[i].s[j].x + 0.8f * tris[i].s[j].y) * scale * 0.7f,
+                    (0.8f * tris[i].s[j].x - 0.6f * tris[i].s[j].y + width) * scale * 0.5f);
+        }
+        tris[i].intensity = 0.25f + benchRandom() * 0.75f;
+        tris[i].light = V3_float(0.0f, 0.0f, 0.95f);
+        for (int j = 0; j < 3; j++) {
+            tris[i].n[j] = NormV3_float(V3_float(benchRandom() - 0.5f, benchRandom() - 0.5f, 1.0f));
+            tris[i].vi[j] = DotV3_float(tris[i].n[j], tris[i].light);
+        }
+        tris[i].texture = &texture;
+        tris[i].compressed = &compressed;
+    }
+
+    static const struct {
+        const char *name;
+        int flags;
+    } variants[] = {
+        { "tex+depth",          RASTER_TEXTURED | RASTER_DEPTH },
+        { "tex+lit+depth",      RASTER_TEXTURED | RASTER_LIT | RASTER_DEPTH },
+        { "tex+gouraud+depth",  RASTER_TEXTURED | RASTER_LIT | RASTER_GOURAUD | RASTER_DEPTH },
+        { "tex+phong+depth",    RASTER_TEXTURED | RASTER_LIT | RASTER_PHONG | RASTER_DEPTH },
+    };
+    TGA_Image image = TGA_ImageInit(width, height, RGB);
+    float *zbuffer = (float *)malloc(sizeof(float) * width * height);
+    struct raster_target target = {
+        .data = image.data, .zbuffer = zbuffer,
+        .width = width, .height = height, .bytespp = RGB
+    };
+    printf("%d triangles up to %.0f px, %dx%d target\n", ntris, tsize, width, height);
+    printf("%-20s %12s %12s %8s\n", "variant", "raw", "compressed", "speedup");
+    for (unsigned long v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        double plain = benchRasterOne(&target, tris, ntris, variants[v].flags, false);
+        double packed = benchRasterOne(&target, tris, ntris, variants[v].flags | RASTER_COMPRESSED, false);
+        printf("%-20s %7.2f Mt/s %7.2f Mt/s %7.2fx\n", variants[v].name,
+                ntris / plain / 1e6, ntris / packed / 1e6, plain / packed);
+    }
+
+    free(zbuffer);
+    TGA_ImageDelete(&image);
+    free(tris);
+    BC_Delete(&compressed);
+    TGA_ImageDelete(&texture);
+    return 0;
+}
+
+/**
+ * benchIsa - time the dispatched kernels on every instruction set the CPU has
+ *
+ * Clears an 800x800 z-buffer, draws random triangles of up to @size
+ * pixels into it and RLE encodes the result, best of 5 runs each.
+ */
+static
+int
+benchIsa(int argc, char **argv)
+{
+    const int ntris = (argc > 0) ? atoi(argv[0]) : 20000;
+    const float size = (argc > 1) ? atof(argv[1]) : 32.0f;
+    const int width = 800, height = 800;
+    if (ntris < 1 || size <= 0.0f) {
+        fprintf(stderr, "usage: bench isa [triangles] [size]\n");
+        return -1;
+    }
+
+    TGA_Image texture = TGA_ImageInit(256, 256, RGB);
+    for (int i = 256 * 256 * RGB; i--; texture.data[i] = i * 7);
+    struct raster_tri *tris = (struct raster_tri *)calloc(ntris, sizeof(struct raster_tri));
+    for (int i = 0; i < ntris; i++) {
+        float cx = benchRandom() * width, cy = benchRandom() * height;
+        for (int j = 0; j < 3; j++) {
+            tris[i].s[j] = V3_float(
+                    (int)(cx + (benchRandom() - 0.5f) * size),
+                    (int)(cy + (benchRandom() - 0.5f) * size),
+                    benchRandom() * 2.0f - 1.0f);
+            tris[i].t[j] = V2_float(benchRandom() * texture.width, benchRandom() * texture.height);
+            tris[i].n[j] = NormV3_float(V3_float(benchRandom() - 0.5f, benchRandom() - 0.5f, 1.0f));
+        }
+        tris[i].color = TGA_ColorInit(200, 100, 50, 255);
+        tris[i].intensity = 0.25f + benchRandom() * 0.75f;
+        tris[i].light = V3_float(0.0f, 0.0f, 0.95f);
+        tris[i].texture = &texture;
+    }
+
+    TGA_Image image = TGA_ImageInit(width, height, RGB);
+    float *zbuffer = (float *)malloc(sizeof(float) * width * height);
+    struct raster_target target = {
+        .data = image.data, .zbuffer = zbuffer,
+        .width = width, .height = height, .bytespp = RGB
+    };
+    const enum cpu_isa best = CPU_Detect();
+    printf("%d triangles up to %.0f px, %dx%d target\n", ntris, size, width, height);
+    printf("%-8s %10s %12s %12s %12s %12s\n", "isa", "clear", "flat+depth", "tex+lit", "tex+phong", "rle encode");
+    for (int isa = CPU_SSE2; isa <= (int)best; isa++) {
+        CPU_Isa = (enum cpu_isa)isa;
+        double clear = DBL_MAX;
+        for (int r = 0; r < 5; r++) {
+            double start = T_Now();
+            RK_ClearDepth(zbuffer, (long)width * height);
+            clear = MIN(clear, T_Now() - start);
+        }
+        double flat = benchRasterOne(&target, tris, ntris, RASTER_DEPTH, false);
+        double lit = benchRasterOne(&target, tris, ntris, RASTER_TEXTURED | RASTER_LIT | RASTER_DEPTH, false);
+        double phong = benchRasterOne(&target, tris, ntris, RASTER_TEXTURED | RASTER_LIT | RASTER_PHONG | RASTER_DEPTH, false);
+        double encode = DBL_MAX;
+        for (int r = 0; r < 5; r++) {
+            double start = T_Now();
+            TGA_ImageWriteFile(&image, "bench_out.tga", true);
+            encode = MIN(encode, T_Now() - start);
+        }
+        printf("%-8s %7.3f ms %7.2f Mt/s %7.2f Mt/s %7.2f Mt/s %9.3f ms\n", CPU_IsaNames[isa], clear * 1e3,
+                ntris / flat / 1e6, ntris / lit / 1e6, ntris / phong / 1e6, encode * 1e3);
+    }
+    CPU_Isa = best;
+    unlink("bench_out.tga");
+
+    free(zbuffer);
+    TGA_ImageDelete(&image);
+    free(tris);
+    TGA_ImageDelete(&texture);
+    return 0;
+}
+
+static
+void
+benchJobsItems(void *arg, long i0, long i1)
+{
+    float *items = (float *)arg;
+    for (long i = i0; i < i1; i++) {
+        float x = items[i];
+        for (int k = 0; k < 256; k++)
+            x = x * 0.999f + 0.5f;
+        items[i] = x;
+    }
+}
+
+/**
+ * benchJobs - scaling of JS_ParallelFor over @items, against one thread
+ *
+ * Each item is a few hundred dependent multiply-adds, split in ranges of
+ * @grain items, best of 5 runs. Prints the work of each thread after.
+ */
+static
+int
+benchJobs(int argc, char **argv)
+{
+    const int threads = (argc > 0) ? atoi(argv[0]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const long nitems = (argc > 1) ? atol(argv[1]) : 1L << 18;
+    const long grain = (argc > 2) ? atol(argv[2]) : 256;
+    if (threads < 1 || nitems < 1 || grain < 1) {
+        fprintf(stderr, "usage: bench jobs [threads] [items] [grain]\n");
+        return -1;
+    }
+    JS_SetThreads(threads);
+
+    float *items = (float *)malloc(sizeof(float) * nitems);
+    for (long i = 0; i < nitems; i++)
+        items[i] = benchRandom();
+    double one = DBL_MAX, many = DBL_MAX;
+    for (int r = 0; r < 5; r++) {
+        double start = T_Now();
+        benchJobsItems(items, 0, nitems);
+        one = MIN(one, T_Now() - start);
+        start = T_Now();
+        JS_ParallelFor(benchJobsItems, items, nitems, grain);
+        many = MIN(many, T_Now() - start);
+    }
+    printf("%ld items, grain %ld, %d threads, best of 5\n", nitems, grain, JS_Threads());
+    printf("1 thread %.2f ms, %d threads %.2f ms, %.2fx\n", one * 1e3, JS_Threads(), many * 1e3, one / many);
+    JS_Report(stdout);
+    free(items);
+    return 0;
+}
+
+/**
+ * benchBvhScan - BV_Intersect by testing @ray against every face
+ *
+ * Same arithmetic and tie break as the traversal, so the hits must agree.
+ */
+static
+struct bvh_hit
+benchBvhScan(const struct bvh *bvh, const struct bvh_ray *ray)
+{
+    struct bvh_hit hit = { .face = -1, .t = ray->tmax };
+    const v3f d = ray->dir;
+    for (int k = 0; k < bvh->nfaces; k++) {
+        const struct bvh_tri *tri = bvh->tris + k;
+        const v3f p = V3_float(d.y * tri->e2.z - d.z * tri->e2.y, d.z * tri->e2.x - d.x * tri->e2.z,
+                               d.x * tri->e2.y - d.y * tri->e2.x);
+        const float det = tri->e1.x * p.x + tri->e1.y * p.y + tri->e1.z * p.z;
+        const float inv = 1.0f / det;
+        const v3f s = SubV3_float(ray->origin, tri->a);
+        const float u = (s.x * p.x + s.y * p.y + s.z * p.z) * inv;
+        const v3f q = V3_float(s.y * tri->e1.z - s.z * tri->e1.y, s.z * tri->e1.x - s.x * tri->e1.z,
+                               s.x * tri->e1.y - s.y * tri->e1.x);
+        const float v = (d.x * q.x + d.y * q.y + d.z * q.z) * inv;
+        const float t = (tri->e2.x * q.x + tri->e2.y * q.y + tri->e2.z * q.z) * inv;
+        const int f = bvh->faces[k];
+        if (det != 0.0f && u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t >= ray->tmin
+                && (t < hit.t || (t == hit.t && hit.face > f)))
+            hit = (struct bvh_hit){ .face = f, .t = t, .u = u, .v = v };
+    }
+    return hit;
+}
+
+/**
+ * benchBvh - build, load and trace rates of the BVH of a model
+ *
+ * Builds best of 3 with the job system threads, then traces @rays rays
+ * on every instruction set: a grid looking down z like picks do, and
+ * rays between random points around and inside the model. The nearest
+ * hits of a sample are checked against a scan of every face.
+ */
+static
+int
+benchBvh(int argc, char **argv)
+{
+    const long nrays = (argc > 1) ? atol(argv[1]) : 1L << 18;
+    struct model model;
+    if (argc < 1 || nrays < 1) {
+        fprintf(stderr, "usage: bench bvh model.obj [rays]\n");
+        return -1;
+    }
+    if (ModelInit(&model, argv[0]) != MODEL_OK)
+        return -1;
+
+    struct bvh bvh = {0};
+    double build = DBL_MAX;
+    for (int r = 0; r < 3; r++) {
+        BV_Delete(&bvh);
+        double start = T_Now();
+        if (!BV_Build(&bvh, &model)) {
+            fprintf(stderr, "Can't build the BVH\n");
+            ModelDelete(&model);
+            return -1;
+        }
+        build = MIN(build, T_Now() - start);
+    }
+    struct stat st;
+    stat(argv[0], &st);
+    double write = T_Now();
+    bool saved = BV_WriteFile(&bvh, &model, "bench_out.bvh", &st);
+    write = T_Now() - write;
+    struct bvh loaded;
+    double read = T_Now();
+    bool restored = saved && BV_ReadFile(&loaded, &model, "bench_out.bvh", &st);
+    read = T_Now() - read;
+    unlink("bench_out.bvh");
+    if (restored) {
+        restored = loaded.nnodes == bvh.nnodes
+                && !memcmp(loaded.nodes, bvh.nodes, sizeof(struct bvh_node) * bvh.nnodes)
+                && !memcmp(loaded.faces, bvh.faces, sizeof(int) * bvh.nfaces);
+        BV_Delete(&loaded);
+    }
+    long leaves = 0;
+    for (int i = 0; i < bvh.nnodes; i++)
+        leaves += bvh.nodes[i].count != 0;
+    printf("%d faces, %d threads: build %.3f ms, %d nodes, %.1f faces per leaf, %.1f MB\n",
+           bvh.nfaces, JS_Threads(), build * 1e3, bvh.nnodes, (double)bvh.nfaces / MAX(leaves, 1),
+           (sizeof(struct bvh_node) * bvh.nnodes + (sizeof(int) + sizeof(struct bvh_tri)) * bvh.nfaces) / 1e6);
+    printf("file: write %.3f ms, read %.3f ms, %s\n", write * 1e3, read * 1e3, restored ? "same" : "FAILED");
+
+    // a square grid over the model's box, then random chords through it
+    const struct bvh_node *root = bvh.nodes;
+    const v3f lo = bvh.nnodes ? V3_float(root->lo[0], root->lo[1], root->lo[2]) : V3_float(-1.0f, -1.0f, -1.0f);
+    const v3f hi = bvh.nnodes ? V3_float(root->hi[0], root->hi[1], root->hi[2]) : V3_float(1.0f, 1.0f, 1.0f);
+    const v3f size = SubV3_float(hi, lo);
+    struct bvh_ray *rays = (struct bvh_ray *)malloc(sizeof(struct bvh_ray) * nrays * 2);
+    struct bvh_hit *hits = (struct bvh_hit *)malloc(sizeof(struct bvh_hit) * nrays);
+    const int side = MAX((int)sqrtf(nrays), 1);
+    for (long i = 0; i < nrays; i++) {
+        const float x = lo.x + size.x * ((i % side) + 0.5f) / side;
+        const float y = lo.y + size.y * ((i / side % side) + 0.5f) / side;
+        rays[i] = (struct bvh_ray){ V3_float(x, y, hi.z + 1.0f), 0.0f, V3_float(0.0f, 0.0f, -1.0f), FLT_MAX };
+    }
+    for (long i = nrays; i < 2 * nrays; i++) {
+        const v3f from = V3_float(lo.x + size.x * (2.0f * benchRandom() - 0.5f), lo.y + size.y * (2.0f * benchRandom() - 0.5f),
+                                  lo.z + size.z * (2.0f * benchRandom() - 0.5f));
+        const v3f to = V3_float(lo.x + size.x * benchRandom(), lo.y + size.y * benchRandom(), lo.z + size.z * benchRandom());
+        rays[i] = (struct bvh_ray){ from, 0.0f, SubV3_float(to, from), 1.0f };
+    }
+
+    const enum cpu_isa best = CPU_Detect();
+    printf("%ld rays, Mrays/s best of 3\n", nrays);
+    printf("%-8s %12s %12s %12s %12s %10s\n", "isa", "grid", "grid any", "random", "random any", "checked");
+    for (int isa = CPU_SSE2; isa <= (int)best; isa++) {
+        CPU_Isa = (enum cpu_isa)isa;
+        double rates[4];
+        for (int k = 0; k < 4; k++) {
+            double fastest = DBL_MAX;
+            for (int r = 0; r < 3; r++) {
+                double start = T_Now();
+                if (k & 1)
+                    BV_Occluded(&bvh, rays + (k / 2) * nrays, hits, nrays);
+                else
+                    BV_Intersect(&bvh, rays + (k / 2) * nrays, hits, nrays);
+                fastest = MIN(fastest, T_Now() - start);
+            }
+            rates[k] = nrays / fastest / 1e6;
+        }
+        // the random rays are left in hits, every 64th of them checked
+        BV_Intersect(&bvh, rays + nrays, hits, nrays);
+        long checked = 0, wrong = 0;
+        for (long i = 0; i < nrays; i += 64, checked++) {
+            const struct bvh_hit scan = benchBvhScan(&bvh, rays + nrays + i);
+            wrong += scan.face != hits[i].face || (scan.face >= 0 && scan.t != hits[i].t);
+        }
+        printf("%-8s %12.2f %12.2f %12.2f %12.2f %6ld %s\n", CPU_IsaNames[isa], rates[0], rates[1], rates[2], rates[3],
+               checked, wrong ? "WRONG" : "ok");
+    }
+    CPU_Isa = best;
+
+    // what the hierarchy saves over testing every face
+    const long sample = MIN(nrays, 256);
+    long found = 0;
+    double scan = T_Now();
+    for (long i = 0; i < sample; i++)
+        found += benchBvhScan(&bvh, rays + nrays + i).face >= 0;
+    scan = T_Now() - scan;
+    printf("scan of every face %.4f Mrays/s, %ld of %ld hit\n", sample / scan / 1e6, found, sample);
+
+    free(rays);
+    free(hits);
+    BV_Delete(&bvh);
+    ModelDelete(&model);
+    return 0;
+}
+
+/**
+ * benchProgressive - faces the coarse pass of renderProgressive draws
+ *
+ * Runs the first pass, at 1/8 of @size, against a deadline of 3/4 of
+ * @ms from a few angles, as renderProgressive does. Fails when any run
+ * draws no face at all, the pass then shows nothing of the model.
+ */
+static
+int
+benchProgressive(int argc, char **argv)
+{
+    const double budget = ((argc > 1) ? atof(argv[1]) : 1.0) * 1e-3;
+    const int size = (argc > 2) ? atoi(argv[2]) : 800;
+    struct model model;
+    if (argc < 1 || budget <= 0.0 || size < 8) {
+        fprintf(stderr, "usage: bench progressive model.obj [ms] [size]\n");
+        return -1;
+    }
+    if (ModelInit(&model, argv[0]) != MODEL_OK)
+        return -1;
+
+    TGA_Image coarse = TGA_ImageInit(size / 8, size / 8, RGB);
+    struct render_options opts = { .samples = 1, .wireframe = WIREFRAME_OFF, .shading = SHADE_AUTO };
+    const int runs = 8;
+    int fewest = model.nfaces, most = 0;
+    double slowest = 0.0;
+    for (int r = 0; r < runs; r++) {
+        opts.yaw = 2.0f * (float)M_PI * r / runs;
+        TGA_ImageClear(&coarse);
+        double start = T_Now();
+        int drawn = renderFaces(&model, &coarse, &opts, start + budget * 0.75, NULL);
+        slowest = MAX(slowest, T_Now() - start);
+        fewest = MIN(fewest, drawn);
+        most = MAX(most, drawn);
+    }
+    printf("%d faces, %s shading, %.3f ms budget: coarse pass drew %d to %d faces, slowest %.3f ms, %s\n",
+           model.nfaces, shadeRateNames[shadeRate(&opts, &model, coarse.width, coarse.height)], budget * 1e3,
+           fewest, most, slowest * 1e3, fewest > 0 ? "ok" : "FAILED");
+
+    TGA_ImageDelete(&coarse);
+    ModelDelete(&model);
+    return fewest > 0 ? 0 : -1;
+}
+
+static const struct {
+    const char *name;
+    int (*run)(int argc, char **argv);
+} benchmarks[] = {
+    { "encode", benchEncode },
+    { "raster", benchRaster },
+    { "imageops", benchImageOps },
+    { "texture", benchTexture },
+    { "isa", benchIsa },
+    { "jobs", benchJobs },
+    { "bvh", benchBvh },
+    { "progressive", benchProgressive },
+};
+
+int
+main(int argc, char **argv)
+{
+    CPU_Init(NULL);
+    if (argc >= 2) {
+        for (unsigned long i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+            if (!strcmp(argv[1], benchmarks[i].name))
+                return benchmarks[i].run(argc - 2, argv + 2);
+        }
+    }
+
+    fprintf(stderr, "usage: %s <benchmark> [args]\n", argv[0]);
+    for (unsigned long i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++)
+        fprintf(stderr, "  %s\n", benchmarks[i].name);
+    return -1;
+}
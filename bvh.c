@@ -0,0 +1,532 @@
+#include "bvh.h"
+
+/**
+ * BV_Inverse - 1 / @d, with directions along a plane kept finite
+ *
+ * Infinite slopes would give 0 * inf in the box tests of rays starting on
+ * a slab; a huge one puts the other side of the slab out of reach just as
+ * well.
+ */
+static inline
+float
+BV_Inverse(float d)
+{
+    return fabsf(d) > 1e-20f ? 1.0f / d : copysignf(1e20f, d);
+}
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#define BV_ISA(name) name##_SSE2
+#define BV_LANES 4
+#include "bvh_isa.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define BV_ISA(name) name##_AVX2
+#define BV_LANES 8
+#include "bvh_isa.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+#define BV_ISA(name) name##_AVX512
+#define BV_LANES 16
+#include "bvh_isa.h"
+#pragma GCC pop_options
+
+/* Indexed by cpu_isa. */
+static void (*const BV_TraceIsa[CPU_NISAS])(const struct bvh *, const struct bvh_ray *, struct bvh_hit *, int, bool) = {
+    [CPU_SSE2] = BV_Trace_SSE2, [CPU_AVX2] = BV_Trace_AVX2, [CPU_AVX512] = BV_Trace_AVX512
+};
+static const int BV_Lanes[CPU_NISAS] = { [CPU_SSE2] = 4, [CPU_AVX2] = 8, [CPU_AVX512] = 16 };
+
+/* Shared by the tasks of one build. */
+struct bv_build {
+    const v3f *lo, *hi;         // bounds of each face
+    const v3f *centroid;
+    int *order;                 // faces, partitioned as the nodes are split
+    struct bvh_node *nodes;     // 2 * nfaces - 1, a subtree of n faces takes 2n - 1
+    int *slot;                  // per node, set when used, the rest are gaps left by leaves
+    float pad;                  // added around every box
+};
+
+struct bv_subtree {
+    struct bv_build *build;
+    int node;
+    int begin, end;             // of order
+    int depth;
+};
+
+static inline
+float
+BV_HalfArea(v3f lo, v3f hi)
+{
+    const float x = hi.x - lo.x, y = hi.y - lo.y, z = hi.z - lo.z;
+    return x * y + y * z + z * x;
+}
+
+static inline
+void
+BV_Grow(v3f *lo, v3f *hi, v3f blo, v3f bhi)
+{
+    *lo = V3_float(MIN(lo->x, blo.x), MIN(lo->y, blo.y), MIN(lo->z, blo.z));
+    *hi = V3_float(MAX(hi->x, bhi.x), MAX(hi->y, bhi.y), MAX(hi->z, bhi.z));
+}
+
+static inline
+int
+BV_Bin(float c, float origin, float scale)
+{
+    return MIN(MAX((int)((c - origin) * scale), 0), BV_BINS - 1);
+}
+
+static void BV_BuildNode(struct bv_subtree *sub);
+
+static
+void
+BV_BuildTask(void *arg, long i0, long i1)
+{
+    (void)i0;
+    (void)i1;
+    BV_BuildNode((struct bv_subtree *)arg);
+}
+
+/**
+ * BV_BuildNode - make @sub->node a leaf, or split its faces in two
+ *
+ * The left subtree goes right after the node, the right one after the
+ * 2n - 1 nodes the left one may take, so both can be built at once.
+ */
+static
+void
+BV_BuildNode(struct bv_subtree *sub)
+{
+    struct bv_build *b = sub->build;
+    const int n = sub->end - sub->begin;
+    int *order = b->order + sub->begin;
+    v3f lo = V3_float(FLT_MAX, FLT_MAX, FLT_MAX), hi = V3_float(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    v3f clo = lo, chi = hi;
+    for (int i = 0; i < n; i++) {
+        BV_Grow(&lo, &hi, b->lo[order[i]], b->hi[order[i]]);
+        BV_Grow(&clo, &chi, b->centroid[order[i]], b->centroid[order[i]]);
+    }
+    struct bvh_node *node = b->nodes + sub->node;
+    for (int k = 0; k < 3; k++) {
+        node->lo[k] = lo.raw[k] - b->pad;
+        node->hi[k] = hi.raw[k] + b->pad;
+    }
+    b->slot[sub->node] = 1;
+
+    // bin the centroids along each axis and sweep for the cheapest split
+    int best_axis = -1, best_bin = 0;
+    float best_cost = n <= BV_LEAF_FACES ? n : FLT_MAX;
+    float scale[3] = {0};
+    if (n > 1 && sub->depth < BV_MAX_DEPTH - 32) {
+        int count[3][BV_BINS] = {{0}};
+        v3f blo[3][BV_BINS], bhi[3][BV_BINS];
+        for (int k = 0; k < 3; k++) {
+            const float extent = chi.raw[k] - clo.raw[k];
+            scale[k] = extent > 0.0f ? BV_BINS / extent : 0.0f;
+            for (int j = 0; j < BV_BINS; j++) {
+                blo[k][j] = V3_float(FLT_MAX, FLT_MAX, FLT_MAX);
+                bhi[k][j] = V3_float(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            const int f = order[i];
+            for (int k = 0; k < 3; k++) {
+                const int j = BV_Bin(b->centroid[f].raw[k], clo.raw[k], scale[k]);
+                count[k][j]++;
+                BV_Grow(&blo[k][j], &bhi[k][j], b->lo[f], b->hi[f]);
+            }
+        }
+
+        // in triangle tests, the box test of the split counted as one
+        const float area = MAX(BV_HalfArea(lo, hi), FLT_MIN);
+        for (int k = 0; k < 3; k++) {
+            if (scale[k] == 0.0f)
+                continue;
+            float right_area[BV_BINS];
+            int right_count[BV_BINS];
+            v3f rlo = V3_float(FLT_MAX, FLT_MAX, FLT_MAX), rhi = V3_float(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+            for (int j = BV_BINS - 1, c = 0; j > 0; j--) {
+                BV_Grow(&rlo, &rhi, blo[k][j], bhi[k][j]);
+                c += count[k][j];
+                right_area[j] = c ? BV_HalfArea(rlo, rhi) : 0.0f;
+                right_count[j] = c;
+            }
+            v3f llo = V3_float(FLT_MAX, FLT_MAX, FLT_MAX), lhi = V3_float(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+            for (int j = 0, c = 0; j < BV_BINS - 1; j++) {
+                BV_Grow(&llo, &lhi, blo[k][j], bhi[k][j]);
+                c += count[k][j];
+                if (!c || !right_count[j + 1])
+                    continue;
+                const float cost = 1.0f + (BV_HalfArea(llo, lhi) * c + right_area[j + 1] * right_count[j + 1]) / area;
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = k;
+                    best_bin = j;
+                }
+            }
+        }
+    }
+
+    if (n <= BV_LEAF_FACES && best_axis < 0) {
+        node->index = sub->begin;
+        node->count = n;
+        node->axis = 0;
+        return;
+    }
+
+    // faces whose centroids all coincide, or too deep for the tree to be
+    // balanced by the heuristic, are halved as they are
+    int mid = n / 2;
+    node->axis = 0;
+    if (best_axis >= 0) {
+        const float origin = clo.raw[best_axis], s = scale[best_axis];
+        int i = 0, j = n - 1;
+        for (;;) {
+            while (i <= j && BV_Bin(b->centroid[order[i]].raw[best_axis], origin, s) <= best_bin)
+                i++;
+            while (i <= j && BV_Bin(b->centroid[order[j]].raw[best_axis], origin, s) > best_bin)
+                j--;
+            if (i >= j)
+                break;
+            swap(order[i], order[j]);
+        }
+        mid = i;
+        node->axis = best_axis;
+    }
+    node->count = 0;
+    node->index = sub->node + 2 * mid;
+
+    struct bv_subtree left = { b, sub->node + 1, sub->begin, sub->begin + mid, sub->depth + 1 };
+    struct bv_subtree right = { b, node->index, sub->begin + mid, sub->end, sub->depth + 1 };
+    if (mid >= BV_TASK_FACES && JS_Threads() > 1) {
+        struct js_job job = {0};
+        JS_Spawn(&job, BV_BuildTask, &left);
+        BV_BuildNode(&right);
+        JS_Wait(&job);
+    } else {
+        BV_BuildNode(&left);
+        BV_BuildNode(&right);
+    }
+}
+
+static
+void
+BV_Delete(struct bvh *bvh)
+{
+    free(bvh->nodes);
+    free(bvh->faces);
+    free(bvh->tris);
+    memset(bvh, 0, sizeof(struct bvh));
+}
+
+/**
+ * BV_Triangles - copy the faces of @model into @bvh in leaf order
+ */
+static
+bool
+BV_Triangles(struct bvh *bvh, const struct model *model)
+{
+    bvh->tris = (struct bvh_tri *)malloc(sizeof(struct bvh_tri) * MAX(bvh->nfaces, 1));
+    if (!bvh->tris)
+        return false;
+    for (int k = 0; k < bvh->nfaces; k++) {
+        const v3i *face = model->faces + 3 * bvh->faces[k];
+        const v3f a = ModelVertex(model, face[0].ivert - 1);
+        bvh->tris[k].a = a;
+        bvh->tris[k].e1 = SubV3_float(ModelVertex(model, face[1].ivert - 1), a);
+        bvh->tris[k].e2 = SubV3_float(ModelVertex(model, face[2].ivert - 1), a);
+    }
+    return true;
+}
+
+/**
+ * BV_Build - build the hierarchy over the faces of @model
+ *
+ * The model must not change afterwards, build after ModelCompact if the
+ * mesh is to be packed. Returns false when out of memory.
+ */
+static
+bool
+BV_Build(struct bvh *bvh, const struct model *model)
+{
+    struct pf_span span = PF_Begin("bvh build");
+    memset(bvh, 0, sizeof(struct bvh));
+    const int n = model->nfaces;
+    const long nslots = MAX(2L * n - 1, 1);
+    struct bv_build b = {
+        .lo = (v3f *)malloc(sizeof(v3f) * MAX(n, 1)),
+        .hi = (v3f *)malloc(sizeof(v3f) * MAX(n, 1)),
+        .centroid = (v3f *)malloc(sizeof(v3f) * MAX(n, 1)),
+        .order = (int *)malloc(sizeof(int) * MAX(n, 1)),
+        .nodes = (struct bvh_node *)malloc(sizeof(struct bvh_node) * nslots),
+        .slot = (int *)calloc(nslots, sizeof(int)),
+    };
+    bool result = b.lo && b.hi && b.centroid && b.order && b.nodes && b.slot;
+    if (result && n) {
+        v3f *lo = (v3f *)b.lo, *hi = (v3f *)b.hi, *centroid = (v3f *)b.centroid;
+        v3f mlo = V3_float(FLT_MAX, FLT_MAX, FLT_MAX), mhi = V3_float(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        for (int i = 0; i < n; i++) {
+            const v3i *face = model->faces + 3 * i;
+            const v3f A = ModelVertex(model, face[0].ivert - 1);
+            const v3f B = ModelVertex(model, face[1].ivert - 1);
+            const v3f C = ModelVertex(model, face[2].ivert - 1);
+            lo[i] = V3_float(MIN(MIN(A.x, B.x), C.x), MIN(MIN(A.y, B.y), C.y), MIN(MIN(A.z, B.z), C.z));
+            hi[i] = V3_float(MAX(MAX(A.x, B.x), C.x), MAX(MAX(A.y, B.y), C.y), MAX(MAX(A.z, B.z), C.z));
+            centroid[i] = MulV3_float(0.5f, AddV3_float(lo[i], hi[i]));
+            b.order[i] = i;
+            BV_Grow(&mlo, &mhi, lo[i], hi[i]);
+        }
+        // so that rounding in the box tests never loses a face at the edge
+        const float size = MAX(MAX(mhi.x - mlo.x, mhi.y - mlo.y), mhi.z - mlo.z);
+        b.pad = 1e-5f * size + FLT_MIN;
+
+        struct bv_subtree root = { &b, 0, 0, n, 0 };
+        BV_BuildNode(&root);
+
+        // close the gaps, the nodes keep their depth first order
+        int nnodes = 0;
+        for (long i = 0; i < nslots; i++) {
+            if (!b.slot[i])
+                continue;
+            b.slot[i] = nnodes;
+            b.nodes[nnodes++] = b.nodes[i];
+        }
+        for (int i = 0; i < nnodes; i++) {
+            if (!b.nodes[i].count)
+                b.nodes[i].index = b.slot[b.nodes[i].index];
+        }
+        bvh->nodes = (struct bvh_node *)realloc(b.nodes, sizeof(struct bvh_node) * nnodes);
+        if (!bvh->nodes)
+            bvh->nodes = b.nodes;
+        b.nodes = NULL;
+        bvh->nnodes = nnodes;
+        bvh->nfaces = n;
+        bvh->faces = b.order;
+        b.order = NULL;
+        result = BV_Triangles(bvh, model);
+    }
+    free((void *)b.lo);
+    free((void *)b.hi);
+    free((void *)b.centroid);
+    free(b.order);
+    free(b.nodes);
+    free(b.slot);
+    if (!result)
+        BV_Delete(bvh);
+    PF_End(&span);
+    return result;
+}
+
+/**
+ * BV_WriteFile - save @bvh, built for @model from the OBJ described by
+ * @source
+ *
+ * Written to a temporary name then renamed, so readers never see a
+ * partial file.
+ */
+static
+bool
+BV_WriteFile(const struct bvh *bvh, const struct model *model, const char *filename, const struct stat *source)
+{
+    char temp[1024 + 16];
+    snprintf(temp, sizeof(temp), "%s.%d", filename, (int)getpid());
+    FILE *file = fopen(temp, "wb");
+    if (file == NULL)
+        return false;
+
+    struct bvh_file_header header = {
+        .magic = BV_MAGIC,
+        .nnodes = bvh->nnodes,
+        .nfaces = bvh->nfaces,
+        .nverts = model->nverts,
+        .packed = model->packed.verts != NULL,
+        .node_size = sizeof(struct bvh_node),
+        .source_size = source->st_size,
+        .source_sec = source->st_mtim.tv_sec,
+        .source_nsec = source->st_mtim.tv_nsec,
+    };
+    bool result = fwrite(&header, sizeof(header), 1, file) == 1
+               && fwrite(bvh->nodes, sizeof(struct bvh_node), bvh->nnodes, file) == (unsigned long)bvh->nnodes
+               && fwrite(bvh->faces, sizeof(int), bvh->nfaces, file) == (unsigned long)bvh->nfaces;
+    result = !fclose(file) && result;
+    if (result)
+        result = !rename(temp, filename);
+    if (!result)
+        unlink(temp);
+    return result;
+}
+
+/**
+ * BV_Valid - whether the nodes and faces read from a file can be traced
+ *
+ * Children must come after their parent and leaves stay within the faces,
+ * which bounds the traversal stack by the depth.
+ */
+static
+bool
+BV_Valid(const struct bvh *bvh, int nfaces)
+{
+    unsigned char *depth = (unsigned char *)calloc(MAX(bvh->nnodes, 1), 1);
+    bool result = depth != NULL;
+    for (int i = 0; result && i < bvh->nnodes; i++) {
+        const struct bvh_node *node = bvh->nodes + i;
+        if (node->count) {
+            result = node->index >= 0 && node->index <= bvh->nfaces - node->count;
+            continue;
+        }
+        result = node->axis < 3 && i + 1 < bvh->nnodes && node->index > i + 1 && node->index < bvh->nnodes
+              && depth[i] < BV_MAX_DEPTH - 2;
+        if (result) {
+            depth[i + 1] = MAX(depth[i + 1], depth[i] + 1);
+            depth[node->index] = MAX(depth[node->index], depth[i] + 1);
+        }
+    }
+    for (int k = 0; result && k < bvh->nfaces; k++)
+        result = bvh->faces[k] >= 0 && bvh->faces[k] < nfaces;
+    free(depth);
+    return result;
+}
+
+/**
+ * BV_ReadFile - load the hierarchy of @model saved by BV_WriteFile
+ *
+ * Fails when the file wasn't built from the current version of the
+ * @source OBJ, or from the mesh as it is now packed or not.
+ */
+static
+bool
+BV_ReadFile(struct bvh *bvh, const struct model *model, const char *filename, const struct stat *source)
+{
+    memset(bvh, 0, sizeof(struct bvh));
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return false;
+
+    struct bvh_file_header header;
+    bool result = fread(&header, sizeof(header), 1, file) == 1
+               && !memcmp(header.magic, BV_MAGIC, sizeof(header.magic))
+               && header.source_size == source->st_size
+               && header.source_sec == source->st_mtim.tv_sec
+               && header.source_nsec == source->st_mtim.tv_nsec
+               && header.nfaces == model->nfaces
+               && header.nverts == model->nverts
+               && header.packed == (model->packed.verts != NULL)
+               && header.node_size == sizeof(struct bvh_node)
+               && header.nnodes >= 0 && header.nnodes <= MAX(2L * header.nfaces - 1, 0);
+    if (result) {
+        bvh->nnodes = header.nnodes;
+        bvh->nfaces = header.nfaces;
+        bvh->nodes = (struct bvh_node *)malloc(sizeof(struct bvh_node) * MAX(bvh->nnodes, 1));
+        bvh->faces = (int *)malloc(sizeof(int) * MAX(bvh->nfaces, 1));
+        result = bvh->nodes && bvh->faces
+              && fread(bvh->nodes, sizeof(struct bvh_node), bvh->nnodes, file) == (unsigned long)bvh->nnodes
+              && fread(bvh->faces, sizeof(int), bvh->nfaces, file) == (unsigned long)bvh->nfaces
+              && BV_Valid(bvh, model->nfaces)
+              && BV_Triangles(bvh, model);
+    }
+    fclose(file);
+    if (!result)
+        BV_Delete(bvh);
+    return result;
+}
+
+/**
+ * BV_Open - the hierarchy of @model, loaded from @filename
+ *
+ * Read from <filename>.bvh when it was saved for this version of the OBJ,
+ * otherwise built and saved there when the directory is writable. Returns
+ * false when out of memory.
+ */
+static
+bool
+BV_Open(struct bvh *bvh, const struct model *model, const char *filename)
+{
+    char cached[1024];
+    struct stat st;
+    // a truncated name could be another file's
+    const bool source = snprintf(cached, sizeof(cached), "%s" BV_SUFFIX, filename) < (int)sizeof(cached)
+                     && stat(filename, &st) != -1;
+    if (source && BV_ReadFile(bvh, model, cached, &st))
+        return true;
+    if (!BV_Build(bvh, model))
+        return false;
+    if (source)
+        BV_WriteFile(bvh, model, cached, &st);
+    return true;
+}
+
+/* A batch of rays split into packets between the threads. */
+struct bv_batch {
+    const struct bvh *bvh;
+    const struct bvh_ray *rays;
+    struct bvh_hit *hits;
+    long n;
+    int lanes;
+    bool any;
+};
+
+static
+void
+BV_TracePackets(void *arg, long p0, long p1)
+{
+    const struct bv_batch *batch = (const struct bv_batch *)arg;
+    for (long p = p0; p < p1; p++) {
+        const long first = p * batch->lanes;
+        BV_TraceIsa[CPU_Isa](batch->bvh, batch->rays + first, batch->hits + first,
+                             (int)MIN(batch->lanes, batch->n - first), batch->any);
+    }
+}
+
+static
+void
+BV_TraceBatch(const struct bvh *bvh, const struct bvh_ray *rays, struct bvh_hit *hits, long n, bool any)
+{
+    struct bv_batch batch = { bvh, rays, hits, n, BV_Lanes[CPU_Isa], any };
+    JS_ParallelFor(BV_TracePackets, &batch, (n + batch.lanes - 1) / batch.lanes, BV_PACKET_GRAIN);
+}
+
+/**
+ * BV_Intersect - the nearest face along each of @n @rays
+ *
+ * The rays are traced in packets of consecutive ones, rays that go the
+ * same way next to each other visit the same nodes and run faster.
+ */
+static
+void
+BV_Intersect(const struct bvh *bvh, const struct bvh_ray *rays, struct bvh_hit *hits, long n)
+{
+    BV_TraceBatch(bvh, rays, hits, n, false);
+}
+
+/**
+ * BV_Occluded - whether each of @n @rays hits any face
+ *
+ * Each ray stops at its first hit, found in no particular order: the face
+ * and t of @hits are of some face in the interval, -1 if none.
+ */
+static
+void
+BV_Occluded(const struct bvh *bvh, const struct bvh_ray *rays, struct bvh_hit *hits, long n)
+{
+    BV_TraceBatch(bvh, rays, hits, n, true);
+}
+
+/**
+ * BV_HitUV - texture coordinate of @model at @hit, which hit a face
+ */
+static
+v2f
+BV_HitUV(const struct model *model, const struct bvh_hit *hit)
+{
+    const v3i *face = model->faces + 3 * hit->face;
+    const v2f a = ModelUV(model, face[0].iuv - 1);
+    const v2f b = ModelUV(model, face[1].iuv - 1);
+    const v2f c = ModelUV(model, face[2].iuv - 1);
+    const float w = 1.0f - hit->u - hit->v;
+    return V2_float(w * a.x + hit->u * b.x + hit->v * c.x, w * a.y + hit->u * b.y + hit->v * c.y);
+}
@@ -0,0 +1,83 @@
+/**
+ * Bounding volume hierarchy over the faces of a model.
+ *
+ * Finds the first face along a ray, or whether there is any, without
+ * visiting every face: picking what is under a pixel and occlusion checks
+ * cost a few dozen box tests instead of a scan of the mesh.
+ *
+ * Built top down, each node split where the surface area heuristic over
+ * BV_BINS bins of the face centroids is cheapest, subtrees of at least
+ * BV_TASK_FACES faces built by tasks of the job system. The nodes are then
+ * flattened depth first into 32 bytes each, the left child right after its
+ * parent, and the faces copied in leaf order as an origin and two edges.
+ * Rays are traced in packets as wide as the vectors of the cpu_isa, each
+ * box tested against the whole packet at once.
+ *
+ * A hierarchy can be saved next to its model as <model.obj>.bvh, the file
+ * records the size and modification time of the OBJ it was built from and
+ * whether the mesh was packed, so later loads skip the build.
+ */
+#ifndef _BVH_h_
+#include <stdint.h>
+#include <sys/stat.h>
+
+#define BV_MAGIC "BVH1"
+#define BV_SUFFIX ".bvh"
+
+#define BV_BINS 16              // candidate splits per axis
+#define BV_LEAF_FACES 8         // most faces of a leaf
+#define BV_TASK_FACES 4096      // least faces of a subtree built by its own task
+#define BV_MAX_DEPTH 64         // of a node, and the traversal stack
+#define BV_PACKET_GRAIN 16      // least packets traced by one task
+
+struct bvh_node {
+    float lo[3];
+    float hi[3];
+    int32_t index;              // leaf: first triangle, inner: right child
+    uint16_t count;             // triangles of a leaf, 0 for inner nodes
+    uint16_t axis;              // of the split, the near child is traced first
+};
+
+/* A face as the Möller-Trumbore test takes it. */
+struct bvh_tri {
+    v3f a;
+    v3f e1;                     // b - a
+    v3f e2;                     // c - a
+};
+
+struct bvh {
+    struct bvh_node *nodes;
+    int nnodes;
+    int nfaces;
+    int *faces;                 // 0-based model face of each triangle
+    struct bvh_tri *tris;       // in leaf order
+};
+
+/* Hits are at tmin <= t < tmax, t in units of dir. */
+struct bvh_ray {
+    v3f origin;
+    float tmin;
+    v3f dir;
+    float tmax;
+};
+
+struct bvh_hit {
+    int face;                   // 0-based, -1 when nothing was hit
+    float t;
+    float u, v;                 // barycentric weights of the second and third vertex
+};
+
+struct bvh_file_header {
+    char magic[4];
+    int32_t nnodes;
+    int32_t nfaces;
+    int32_t nverts;             // of the model
+    int32_t packed;             // built from the quantized mesh
+    int32_t node_size;          // sizeof(struct bvh_node)
+    int64_t source_size;
+    int64_t source_sec;         // OBJ modification time
+    int64_t source_nsec;
+};
+
+#define _BVH_h_
+#endif
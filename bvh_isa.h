@@ -0,0 +1,143 @@
+/**
+ * The ray traversal of one instruction set, included once per cpu_isa by
+ * bvh.c (so there is no include guard) between the target pragmas of that
+ * set. Expects:
+ *
+ *      BV_ISA(name)    name suffixed with the instruction set
+ *      BV_LANES        rays traced at once, floats in one vector
+ *
+ * and defines BV_ISA(BV_Trace).
+ */
+typedef float BV_ISA(bv_floats) __attribute__((vector_size(4 * BV_LANES)));
+typedef int BV_ISA(bv_ints) __attribute__((vector_size(4 * BV_LANES)));
+#define BV_FLOATS BV_ISA(bv_floats)
+#define BV_INTS BV_ISA(bv_ints)
+
+/* Lanes of @a where @mask is set, of @b elsewhere. */
+static inline
+BV_FLOATS
+BV_ISA(BV_Select)(BV_INTS mask, BV_FLOATS a, BV_FLOATS b)
+{
+    return (BV_FLOATS)(((BV_INTS)a & mask) | ((BV_INTS)b & ~mask));
+}
+
+static inline
+BV_FLOATS
+BV_ISA(BV_Min)(BV_FLOATS a, BV_FLOATS b)
+{
+    return BV_ISA(BV_Select)(a < b, a, b);
+}
+
+static inline
+BV_FLOATS
+BV_ISA(BV_Max)(BV_FLOATS a, BV_FLOATS b)
+{
+    return BV_ISA(BV_Select)(a > b, a, b);
+}
+
+static inline
+int
+BV_ISA(BV_First)(BV_INTS mask)
+{
+    for (int i = 0; i < BV_LANES; i++) {
+        if (mask[i])
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * BV_Trace - trace @n rays, at most BV_LANES, through @bvh together
+ * @any: stop each ray at its first hit instead of the nearest one
+ *
+ * Of faces hit at the same t the lowest numbered wins, so the nearest hits
+ * don't depend on the rays traced alongside.
+ */
+static
+void
+BV_ISA(BV_Trace)(const struct bvh *bvh, const struct bvh_ray *rays, struct bvh_hit *hits, int n, bool any)
+{
+    BV_FLOATS ox, oy, oz, dx, dy, dz, ix, iy, iz, tmin, tmax;
+    BV_FLOATS hu = {0}, hv = {0};
+    BV_INTS face;
+    for (int l = 0; l < BV_LANES; l++) {
+        // lanes past n repeat the last ray with an empty interval
+        const struct bvh_ray *r = rays + MIN(l, n - 1);
+        ox[l] = r->origin.x;
+        oy[l] = r->origin.y;
+        oz[l] = r->origin.z;
+        dx[l] = r->dir.x;
+        dy[l] = r->dir.y;
+        dz[l] = r->dir.z;
+        ix[l] = BV_Inverse(r->dir.x);
+        iy[l] = BV_Inverse(r->dir.y);
+        iz[l] = BV_Inverse(r->dir.z);
+        tmin[l] = l < n ? r->tmin : FLT_MAX;
+        tmax[l] = l < n ? r->tmax : -FLT_MAX;
+        face[l] = -1;
+    }
+
+    int stack[BV_MAX_DEPTH];
+    int top = 0;
+    for (int node = 0; bvh->nnodes; node = stack[--top]) {
+        const struct bvh_node *box = bvh->nodes + node;
+        // the slabs of the box against every ray
+        const BV_FLOATS x0 = (box->lo[0] - ox) * ix, x1 = (box->hi[0] - ox) * ix;
+        const BV_FLOATS y0 = (box->lo[1] - oy) * iy, y1 = (box->hi[1] - oy) * iy;
+        const BV_FLOATS z0 = (box->lo[2] - oz) * iz, z1 = (box->hi[2] - oz) * iz;
+        BV_FLOATS near = BV_ISA(BV_Max)(BV_ISA(BV_Min)(x0, x1), BV_ISA(BV_Min)(y0, y1));
+        near = BV_ISA(BV_Max)(BV_ISA(BV_Max)(near, BV_ISA(BV_Min)(z0, z1)), tmin);
+        BV_FLOATS far = BV_ISA(BV_Min)(BV_ISA(BV_Max)(x0, x1), BV_ISA(BV_Max)(y0, y1));
+        far = BV_ISA(BV_Min)(BV_ISA(BV_Min)(far, BV_ISA(BV_Max)(z0, z1)), tmax);
+        const int first = BV_ISA(BV_First)(near <= far);
+
+        if (first >= 0 && !box->count) {
+            // the near child first, as the first ray to enter sees it
+            const float d = box->axis == 0 ? dx[first] : box->axis == 1 ? dy[first] : dz[first];
+            stack[top++] = d < 0.0f ? node + 1 : box->index;
+            stack[top++] = d < 0.0f ? box->index : node + 1;
+        } else if (first >= 0) {
+            for (int k = box->index; k < box->index + box->count; k++) {
+                const struct bvh_tri *tri = bvh->tris + k;
+                const BV_FLOATS px = dy * tri->e2.z - dz * tri->e2.y;
+                const BV_FLOATS py = dz * tri->e2.x - dx * tri->e2.z;
+                const BV_FLOATS pz = dx * tri->e2.y - dy * tri->e2.x;
+                const BV_FLOATS det = tri->e1.x * px + tri->e1.y * py + tri->e1.z * pz;
+                const BV_FLOATS inv = 1.0f / det;
+                const BV_FLOATS sx = ox - tri->a.x, sy = oy - tri->a.y, sz = oz - tri->a.z;
+                const BV_FLOATS u = (sx * px + sy * py + sz * pz) * inv;
+                const BV_FLOATS qx = sy * tri->e1.z - sz * tri->e1.y;
+                const BV_FLOATS qy = sz * tri->e1.x - sx * tri->e1.z;
+                const BV_FLOATS qz = sx * tri->e1.y - sy * tri->e1.x;
+                const BV_FLOATS v = (dx * qx + dy * qy + dz * qz) * inv;
+                const BV_FLOATS t = (tri->e2.x * qx + tri->e2.y * qy + tri->e2.z * qz) * inv;
+                const int f = bvh->faces[k];
+                const BV_INTS closer = (t < tmax) | ((t == tmax) & (face > f));
+                const BV_INTS hit = (det != 0.0f) & (u >= 0.0f) & (v >= 0.0f) & (u + v <= 1.0f)
+                                  & (t >= tmin) & closer;
+                if (BV_ISA(BV_First)(hit) < 0)
+                    continue;
+                tmax = BV_ISA(BV_Select)(hit, t, tmax);
+                hu = BV_ISA(BV_Select)(hit, u, hu);
+                hv = BV_ISA(BV_Select)(hit, v, hv);
+                face = (face & ~hit) | (f & hit);
+            }
+            if (any) {
+                // rays that hit no longer pass any test
+                tmin = BV_ISA(BV_Select)(face >= 0, (BV_FLOATS){0} + FLT_MAX, tmin);
+                if (BV_ISA(BV_First)((face < 0) & (tmin <= tmax)) < 0)
+                    break;
+            }
+        }
+        if (!top)
+            break;
+    }
+
+    for (int l = 0; l < n; l++)
+        hits[l] = (struct bvh_hit){ .face = face[l], .t = tmax[l], .u = hu[l], .v = hv[l] };
+}
+
+#undef BV_FLOATS
+#undef BV_INTS
+#undef BV_LANES
+#undef BV_ISA
@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <cpuid.h>
+#include "cpu.h"
+
+static const char *CPU_IsaNames[CPU_NISAS] = {
+    [CPU_SSE2] = "sse2", [CPU_AVX2] = "avx2", [CPU_AVX512] = "avx512"
+};
+
+/* The path every dispatched kernel takes, set by CPU_Init. */
+static enum cpu_isa CPU_Isa = CPU_SSE2;
+static bool CPU_Forced = false;
+
+static inline
+uint64_t
+CPU_XCR0(void)
+{
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+/**
+ * CPU_Detect - widest cpu_isa this CPU runs
+ *
+ * The CPUID feature bits aren't enough, the OS must also save the vector
+ * registers on context switches, which XCR0 tells.
+ */
+static
+enum cpu_isa
+CPU_Detect(void)
+{
+    unsigned int a, b, c, d;
+    if (!__get_cpuid(1, &a, &b, &c, &d) || !(c & bit_OSXSAVE) || !(c & bit_AVX))
+        return CPU_SSE2;
+    const uint64_t xcr0 = CPU_XCR0();
+    // XMM and YMM state
+    if ((xcr0 & 0x06) != 0x06 || !__get_cpuid_count(7, 0, &a, &b, &c, &d) || !(b & bit_AVX2))
+        return CPU_SSE2;
+    // opmask and the upper halves of ZMM0-15 and ZMM16-31 as well
+    if ((b & bit_AVX512F) && (b & bit_AVX512BW) && (xcr0 & 0xe6) == 0xe6)
+        return CPU_AVX512;
+    return CPU_AVX2;
+}
+
+/**
+ * CPU_Init - select the kernels
+ * @force: cpu_isa name to use instead of the detected one, or NULL
+ *
+ * Fails on unknown names and on instruction sets the machine lacks.
+ */
+static
+bool
+CPU_Init(const char *force)
+{
+    const enum cpu_isa best = CPU_Detect();
+    CPU_Isa = best;
+    CPU_Forced = false;
+    if (!force)
+        return true;
+
+    for (int i = 0; i < CPU_NISAS; i++) {
+        if (strcmp(force, CPU_IsaNames[i]))
+            continue;
+        if (i > (int)best) {
+            fprintf(stderr, "This CPU doesn't support %s, %s is the widest\n", force, CPU_IsaNames[best]);
+            return false;
+        }
+        CPU_Isa = (enum cpu_isa)i;
+        CPU_Forced = true;
+        return true;
+    }
+    fprintf(stderr, "Unknown instruction set %s, expected sse2, avx2 or avx512\n", force);
+    return false;
+}
+
+/**
+ * CPU_Report - say on @file which path the kernels take
+ */
+static
+void
+CPU_Report(FILE *file)
+{
+    const enum cpu_isa best = CPU_Detect();
+    fprintf(file, "# isa %s", CPU_IsaNames[CPU_Isa]);
+    if (CPU_Forced && CPU_Isa != best)
+        fprintf(file, ", forced, the CPU has %s", CPU_IsaNames[best]);
+    fprintf(file, "\n");
+}
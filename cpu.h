@@ -0,0 +1,23 @@
+/**
+ * Runtime instruction set selection.
+ *
+ * The hot kernels are built once per cpu_isa, through GCC target pragmas
+ * or attributes, so one binary runs on any x86-64 machine and uses the
+ * widest vectors the CPU and the OS support. CPU_Init picks the path from
+ * CPUID at startup, or takes the one it is forced to for testing.
+ *
+ * Every variant does the same float operations in the same order and
+ * fused multiply-adds are never contracted (-ffp-contract=off), so the
+ * images don't depend on the path.
+ */
+#ifndef _CPU_h_
+
+enum cpu_isa {
+    CPU_SSE2,                   // the x86-64 baseline
+    CPU_AVX2,
+    CPU_AVX512,                 // AVX-512 F and BW
+    CPU_NISAS
+};
+
+#define _CPU_h_
+#endif
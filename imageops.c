@@ -0,0 +1,407 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <immintrin.h>
+#include "imageops.h"
+
+static int IOP_Threads = 0;     // 0 uses every thread of the job system
+
+/**
+ * IOP_SetThreads - limit the threads used by image operations
+ * @threads: upper bound, 0 for every thread of the job system
+ */
+static
+void
+IOP_SetThreads(int threads)
+{
+    IOP_Threads = MAX(threads, 0);
+}
+
+static
+void
+IOP_RunShares(void *arg, long i0, long i1)
+{
+    const struct iop_task *task = (const struct iop_task *)arg;
+    struct pf_span span = PF_Begin("imageops");
+    task->fn(task->ctx, (int)((long)task->rows * i0 / task->shares), (int)((long)task->rows * i1 / task->shares));
+    PF_End(&span);
+}
+
+/**
+ * IOP_Parallel - run @fn over @rows rows split between threads
+ * @bytes: total bytes touched, small jobs stay on the calling thread
+ *
+ * The rows are cut in one share per thread, run as a JS_ParallelFor.
+ */
+static
+void
+IOP_Parallel(IOP_RowFn fn, void *ctx, int rows, long bytes)
+{
+    int n = IOP_Threads ? MIN(IOP_Threads, JS_Threads()) : JS_Threads();
+    n = MIN(n, (int)MIN(bytes / IOP_MIN_THREAD_BYTES, (long)JS_MAX_THREADS));
+    n = MIN(n, rows);
+    struct iop_task task = { .fn = fn, .ctx = ctx, .rows = rows, .shares = MAX(n, 1) };
+    JS_ParallelFor(IOP_RunShares, &task, task.shares, 1);
+}
+
+static inline
+void
+IOP_SwapBytes(unsigned char *a, unsigned char *b, long n)
+{
+#ifdef __SSE2__
+    for (; n >= 16; n -= 16, a += 16, b += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i *)a);
+        __m128i vb = _mm_loadu_si128((const __m128i *)b);
+        _mm_storeu_si128((__m128i *)a, vb);
+        _mm_storeu_si128((__m128i *)b, va);
+    }
+#endif
+    for (; n >= 8; n -= 8, a += 8, b += 8) {
+        uint64_t va, vb;
+        memcpy(&va, a, 8);
+        memcpy(&vb, b, 8);
+        memcpy(a, &vb, 8);
+        memcpy(b, &va, 8);
+    }
+    for (; n > 0; n--, a++, b++) {
+        unsigned char t = *a;
+        *a = *b;
+        *b = t;
+    }
+}
+
+static
+void
+IOP_FlipRowsVertically(void *ctx, int y0, int y1)
+{
+    TGA_Image *image = (TGA_Image *)ctx;
+    const long linebytes = (long)image->width * image->bytespp;
+    for (int y = y0; y < y1; y++)
+        IOP_SwapBytes(image->data + y * linebytes,
+                image->data + (image->height - 1 - y) * linebytes, linebytes);
+}
+
+/**
+ * IOP_FlipVertically - mirror @image top to bottom, in place
+ */
+static
+bool
+IOP_FlipVertically(TGA_Image *image)
+{
+    if (!image->data)
+        return false;
+
+    long bytes = (long)image->width * image->height * image->bytespp;
+    IOP_Parallel(IOP_FlipRowsVertically, image, image->height >> 1, bytes);
+    return true;
+}
+
+static inline
+void
+IOP_ReversePixels(unsigned char *row, int lo, int hi, int bpp)
+{
+    for (; lo < hi; lo++, hi--) {
+        unsigned char *a = row + lo * bpp, *b = row + hi * bpp;
+        unsigned char ta[4], tb[4];
+        memcpy(ta, a, bpp);
+        memcpy(tb, b, bpp);
+        memcpy(a, tb, bpp);
+        memcpy(b, ta, bpp);
+    }
+}
+
+/**
+ * IOP_ReverseRGB - reverse the RGB pixels of @row, @w of them
+ *
+ * Byte shuffles need SSSE3, which the SSE2 baseline lacks, so only the
+ * AVX2 and AVX-512 variants swap 4 pixels from each end at a time.
+ */
+static
+void
+IOP_ReverseRGB_SSE2(unsigned char *row, int w)
+{
+    IOP_ReversePixels(row, 0, w - 1, RGB);
+}
+
+__attribute__((target("avx2")))
+static inline
+__m128i
+IOP_Load12(const unsigned char *p)
+{
+    int32_t hi;
+    memcpy(&hi, p + 8, 4);
+    return _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i *)p), _mm_cvtsi32_si128(hi));
+}
+
+__attribute__((target("avx2")))
+static inline
+void
+IOP_Store12(unsigned char *p, __m128i v)
+{
+    int32_t hi = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    _mm_storel_epi64((__m128i *)p, v);
+    memcpy(p + 8, &hi, 4);
+}
+
+__attribute__((target("avx2")))
+static
+void
+IOP_ReverseRGB_AVX2(unsigned char *row, int w)
+{
+    const __m128i reverse = _mm_setr_epi8(9, 10, 11, 6, 7, 8, 3, 4, 5, 0, 1, 2, -1, -1, -1, -1);
+    int l = 0, r = w - 4;
+    for (; l + 4 <= r; l += 4, r -= 4) {
+        __m128i a = IOP_Load12(row + l * RGB);
+        __m128i b = IOP_Load12(row + r * RGB);
+        IOP_Store12(row + l * RGB, _mm_shuffle_epi8(b, reverse));
+        IOP_Store12(row + r * RGB, _mm_shuffle_epi8(a, reverse));
+    }
+    IOP_ReversePixels(row, l, r + 3, RGB);
+}
+
+static void (*const IOP_ReverseRGB[CPU_NISAS])(unsigned char *, int) = {
+    [CPU_SSE2] = IOP_ReverseRGB_SSE2, [CPU_AVX2] = IOP_ReverseRGB_AVX2, [CPU_AVX512] = IOP_ReverseRGB_AVX2
+};
+
+static
+void
+IOP_FlipRowsHorizontally(void *ctx, int y0, int y1)
+{
+    TGA_Image *image = (TGA_Image *)ctx;
+    const int bpp = image->bytespp;
+    const int w = image->width;
+    for (int y = y0; y < y1; y++) {
+        unsigned char *row = image->data + (long)y * w * bpp;
+        // l and r are the first pixels of the blocks swapped from each end
+        int l = 0, r = w - 1;
+#ifdef __SSE2__
+        if (bpp == RGBA) {
+            for (r = w - 4; l + 4 <= r; l += 4, r -= 4) {
+                __m128i a = _mm_loadu_si128((const __m128i *)(row + l * 4));
+                __m128i b = _mm_loadu_si128((const __m128i *)(row + r * 4));
+                _mm_storeu_si128((__m128i *)(row + l * 4), _mm_shuffle_epi32(b, 0x1b));
+                _mm_storeu_si128((__m128i *)(row + r * 4), _mm_shuffle_epi32(a, 0x1b));
+            }
+            r += 3;
+        }
+#endif
+        if (bpp == GRAYSCALE) {
+            for (r = w - 8; l + 8 <= r; l += 8, r -= 8) {
+                uint64_t a, b;
+                memcpy(&a, row + l, 8);
+                memcpy(&b, row + r, 8);
+                a = __builtin_bswap64(a);
+                b = __builtin_bswap64(b);
+                memcpy(row + l, &b, 8);
+                memcpy(row + r, &a, 8);
+            }
+            r += 7;
+        }
+        // constant sizes let the byte loop unroll
+        if (bpp == RGB)
+            IOP_ReverseRGB[CPU_Isa](row, w);
+        else if (bpp == RGBA)
+            IOP_ReversePixels(row, l, r, RGBA);
+        else
+            IOP_ReversePixels(row, l, r, bpp);
+    }
+}
+
+/**
+ * IOP_FlipHorizontally - mirror @image left to right, in place
+ */
+static
+bool
+IOP_FlipHorizontally(TGA_Image *image)
+{
+    if (!image->data)
+        return false;
+
+    long bytes = (long)image->width * image->height * image->bytespp;
+    IOP_Parallel(IOP_FlipRowsHorizontally, image, image->height, bytes);
+    return true;
+}
+
+static
+void
+IOP_ResizeNearest(struct iop_resize *r, int y0, int y1)
+{
+    const TGA_Image *src = r->src;
+    TGA_Image *dst = r->dst;
+    const int bpp = dst->bytespp;
+    const long linebytes = (long)dst->width * bpp;
+    int last = -1;
+    for (int y = y0; y < y1; y++) {
+        unsigned char *drow = dst->data + y * linebytes;
+        int sy = (int)((long)y * src->height / dst->height);
+        // rows that come from the same source row are plain copies
+        if (sy == last) {
+            memcpy(drow, drow - linebytes, linebytes);
+            continue;
+        }
+        last = sy;
+
+        const unsigned char *srow = src->data + (long)sy * src->width * bpp;
+        if (bpp == RGBA) {
+            for (int x = 0; x < dst->width; x++)
+                memcpy(drow + x * 4, srow + r->xs[x] * 4, 4);
+        } else {
+            for (int x = 0; x < dst->width; x++)
+                memcpy(drow + x * bpp, srow + r->xs[x] * bpp, bpp);
+        }
+    }
+}
+
+static
+void
+IOP_ResizeBilinear(struct iop_resize *r, int y0, int y1)
+{
+    const TGA_Image *src = r->src;
+    TGA_Image *dst = r->dst;
+    const int bpp = dst->bytespp;
+    const long slinebytes = (long)src->width * bpp;
+    for (int y = y0; y < y1; y++) {
+        long pos = ((2L * y + 1) * src->height * 256) / (2L * dst->height) - 128;
+        pos = MAX(pos, 0);
+        int sy = MIN((int)(pos >> 8), src->height - 1);
+        int wy = (sy < src->height - 1) ? (int)(pos & 255) : 0;
+        const unsigned char *top = src->data + sy * slinebytes;
+        const unsigned char *bot = top + (wy ? slinebytes : 0);
+
+        unsigned char *drow = dst->data + (long)y * dst->width * bpp;
+        for (int x = 0; x < dst->width; x++) {
+            const int a = r->xs[x] * bpp;
+            const int b = a + (r->xw[x] ? bpp : 0);
+            const int wx = r->xw[x];
+            for (int k = 0; k < bpp; k++) {
+                int t = top[a + k] * (256 - wx) + top[b + k] * wx;
+                int u = bot[a + k] * (256 - wx) + bot[b + k] * wx;
+                drow[x * bpp + k] = (t * (256 - wy) + u * wy + 32768) >> 16;
+            }
+        }
+    }
+}
+
+static inline
+void
+IOP_BoxRow(const unsigned int *sum, unsigned char *drow, const int *xs, int width, int rows, int bpp)
+{
+    for (int x = 0; x < width; x++) {
+        int sx0 = xs[x];
+        int sx1 = MAX(xs[x + 1], sx0 + 1);
+        unsigned int n = (sx1 - sx0) * rows;
+        unsigned int acc[4] = {0};
+        for (int sx = sx0; sx < sx1; sx++) {
+            for (int k = 0; k < bpp; k++)
+                acc[k] += sum[sx * bpp + k];
+        }
+        for (int k = 0; k < bpp; k++)
+            drow[x * bpp + k] = (acc[k] + n / 2) / n;
+    }
+}
+
+static
+void
+IOP_ResizeBox(struct iop_resize *r, int y0, int y1)
+{
+    const TGA_Image *src = r->src;
+    TGA_Image *dst = r->dst;
+    const int bpp = dst->bytespp;
+    const long slinebytes = (long)src->width * bpp;
+    unsigned int *sum = (unsigned int *)malloc(sizeof(unsigned int) * slinebytes);
+    if (!sum) {
+        atomic_store(&r->failed, true);
+        return;
+    }
+
+    for (int y = y0; y < y1; y++) {
+        int sy0 = (int)((long)y * src->height / dst->height);
+        int sy1 = (int)((long)(y + 1) * src->height / dst->height);
+        sy1 = MAX(sy1, sy0 + 1);
+
+        // column sums of the source rows under this destination row
+        memset(sum, 0, sizeof(unsigned int) * slinebytes);
+        for (int sy = sy0; sy < sy1; sy++) {
+            const unsigned char *srow = src->data + sy * slinebytes;
+            for (long i = 0; i < slinebytes; i++)
+                sum[i] += srow[i];
+        }
+
+        unsigned char *drow = dst->data + (long)y * dst->width * bpp;
+        if (bpp == GRAYSCALE)
+            IOP_BoxRow(sum, drow, r->xs, dst->width, sy1 - sy0, GRAYSCALE);
+        else if (bpp == RGB)
+            IOP_BoxRow(sum, drow, r->xs, dst->width, sy1 - sy0, RGB);
+        else
+            IOP_BoxRow(sum, drow, r->xs, dst->width, sy1 - sy0, bpp);
+    }
+
+    free(sum);
+}
+
+static
+void
+IOP_ResizeRows(void *ctx, int y0, int y1)
+{
+    struct iop_resize *r = (struct iop_resize *)ctx;
+    switch (r->filter) {
+    case IOP_NEAREST:
+        IOP_ResizeNearest(r, y0, y1);
+        break;
+    case IOP_BILINEAR:
+        IOP_ResizeBilinear(r, y0, y1);
+        break;
+    case IOP_BOX:
+        IOP_ResizeBox(r, y0, y1);
+        break;
+    }
+}
+
+/**
+ * IOP_Resize - resample @src into @dst
+ * @dst: allocated destination, its size picks the scale
+ * @filter: IOP_BOX averages every source pixel a destination pixel covers
+ *          and is the one to use for supersampled renders, IOP_BILINEAR
+ *          only looks at 2x2 pixels and aliases below half size
+ *
+ * Both images must have the same bytes per pixel. Returns false when
+ * out of memory, rows of @dst may then be left unwritten.
+ */
+static
+bool
+IOP_Resize(const TGA_Image *src, TGA_Image *dst, enum iop_filter filter)
+{
+    if (!src->data || !dst->data || src->bytespp != dst->bytespp
+            || src->width <= 0 || src->height <= 0 || dst->width <= 0 || dst->height <= 0)
+        return false;
+
+    struct iop_resize r = {
+        .src = src, .dst = dst, .filter = filter,
+        .xs = (int *)malloc(sizeof(int) * (dst->width + 1)),
+        .xw = (int *)malloc(sizeof(int) * (dst->width + 1))
+    };
+    if (!r.xs || !r.xw) {
+        free(r.xs);
+        free(r.xw);
+        return false;
+    }
+
+    for (int x = 0; x <= dst->width; x++) {
+        if (filter == IOP_BILINEAR) {
+            long pos = ((2L * x + 1) * src->width * 256) / (2L * dst->width) - 128;
+            pos = MAX(pos, 0);
+            r.xs[x] = MIN((int)(pos >> 8), src->width - 1);
+            r.xw[x] = (r.xs[x] < src->width - 1) ? (int)(pos & 255) : 0;
+        } else {
+            r.xs[x] = (int)((long)x * src->width / dst->width);
+        }
+    }
+
+    long bytes = ((long)src->width * src->height + (long)dst->width * dst->height) * dst->bytespp;
+    IOP_Parallel(IOP_ResizeRows, &r, dst->height, bytes);
+
+    free(r.xs);
+    free(r.xw);
+    return !atomic_load(&r.failed);
+}
@@ -0,0 +1,41 @@
+/**
+ * Image operations.
+ *
+ * In place flips and resampling of GRAYSCALE, RGB and RGBA images. Rows
+ * are split between threads once an image is big enough to pay for them,
+ * and the inner loops move 16 bytes at a time with SSE2 when the compiler
+ * targets it. RGB rows are mirrored with byte shuffles on the cpu_isa
+ * that has them.
+ */
+#ifndef _IMAGEOPS_h_
+#include "tga_img.h"
+#include "jobs.h"
+
+#define IOP_MIN_THREAD_BYTES (512 * 1024)   // least work given to a thread
+
+enum iop_filter {
+    IOP_NEAREST,
+    IOP_BILINEAR,               // upscaling and mild downscaling
+    IOP_BOX,                    // area average, for supersampled output
+};
+
+typedef void (*IOP_RowFn)(void *ctx, int y0, int y1);
+
+struct iop_task {
+    IOP_RowFn fn;
+    void *ctx;
+    int rows;
+    int shares;                 // rows are split in as many equal parts
+};
+
+struct iop_resize {
+    const TGA_Image *src;
+    TGA_Image *dst;
+    enum iop_filter filter;
+    int *xs;                    // per destination column: first source column
+    int *xw;                    // bilinear: weight of the next column, 0..256
+    atomic_bool failed;         // a share couldn't allocate its rows
+};
+
+#define _IMAGEOPS_h_
+#endif
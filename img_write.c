@@ -0,0 +1,517 @@
+#include <strings.h>
+#include "img_write.h"
+
+#define QOI_OP_INDEX 0x00
+#define QOI_OP_DIFF  0x40
+#define QOI_OP_LUMA  0x80
+#define QOI_OP_RUN   0xc0
+#define QOI_OP_RGB   0xfe
+#define QOI_OP_RGBA  0xff
+
+static inline
+void
+IMG_PutU32BE(unsigned char *p, unsigned int v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static
+void
+IMG_QOIInit(struct qoi_state *state)
+{
+    memset(state, 0, sizeof(struct qoi_state));
+    state->prev[3] = 255;
+}
+
+/**
+ * IMG_EncodeQOIPixels - encode @npixels pixels of TGA data into @bytes
+ * @last: the image ends with these, a pending run is flushed
+ *
+ * @bytes needs room for npixels * (channels + 1). Returns the number of
+ * bytes used.
+ */
+static
+unsigned long
+IMG_EncodeQOIPixels(struct qoi_state *state, const unsigned char *src, int bpp, unsigned long npixels,
+                    bool last, unsigned char *bytes)
+{
+    unsigned long p = 0;
+
+    // pixels are kept as r, g, b, a regardless of the TGA byte order
+    unsigned char (*index)[4] = state->index;
+    unsigned char *prev = state->prev;
+    unsigned char px[4] = {0, 0, 0, 255};
+    int run = state->run;
+
+    for (unsigned long i = 0; i < npixels; i++, src += bpp) {
+        if (bpp == GRAYSCALE) {
+            px[0] = px[1] = px[2] = src[0];
+        } else {
+            px[0] = src[2];
+            px[1] = src[1];
+            px[2] = src[0];
+            if (bpp == RGBA)
+                px[3] = src[3];
+        }
+
+        if (!memcmp(px, prev, 4)) {
+            run++;
+            if (run == 62 || (last && i == npixels - 1)) {
+                bytes[p++] = QOI_OP_RUN | (run - 1);
+                run = 0;
+            }
+            continue;
+        }
+
+        if (run > 0) {
+            bytes[p++] = QOI_OP_RUN | (run - 1);
+            run = 0;
+        }
+
+        int hash = (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+        if (!memcmp(index[hash], px, 4)) {
+            bytes[p++] = QOI_OP_INDEX | hash;
+        } else {
+            memcpy(index[hash], px, 4);
+
+            if (px[3] == prev[3]) {
+                signed char vr = px[0] - prev[0];
+                signed char vg = px[1] - prev[1];
+                signed char vb = px[2] - prev[2];
+                signed char vg_r = vr - vg;
+                signed char vg_b = vb - vg;
+
+                if (vr > -3 && vr < 2 && vg > -3 && vg < 2 && vb > -3 && vb < 2) {
+                    bytes[p++] = QOI_OP_DIFF | (vr + 2) << 4 | (vg + 2) << 2 | (vb + 2);
+                } else if (vg_r > -9 && vg_r < 8 && vg > -33 && vg < 32 && vg_b > -9 && vg_b < 8) {
+                    bytes[p++] = QOI_OP_LUMA | (vg + 32);
+                    bytes[p++] = (vg_r + 8) << 4 | (vg_b + 8);
+                } else {
+                    bytes[p++] = QOI_OP_RGB;
+                    bytes[p++] = px[0];
+                    bytes[p++] = px[1];
+                    bytes[p++] = px[2];
+                }
+            } else {
+                bytes[p++] = QOI_OP_RGBA;
+                memcpy(bytes + p, px, 4);
+                p += 4;
+            }
+        }
+        memcpy(prev, px, 4);
+    }
+
+    state->run = run;
+    return p;
+}
+
+static
+void
+IMG_PutQOIHeader(unsigned char *bytes, int width, int height, int channels)
+{
+    memcpy(bytes, "qoif", 4);
+    IMG_PutU32BE(bytes + 4, width);
+    IMG_PutU32BE(bytes + 8, height);
+    bytes[12] = channels;
+    bytes[13] = 0;
+}
+
+static const unsigned char IMG_QOIPadding[8] = {0, 0, 0, 0, 0, 0, 0, 1};
+
+/**
+ * IMG_EncodeQOI - encode an image to QOI in memory
+ * @image: grayscale images are expanded to RGB, QOI has no gray mode
+ * @size: set to the number of bytes used
+ *
+ * Returns a malloc'd buffer the caller has to free, or NULL.
+ */
+static
+unsigned char *
+IMG_EncodeQOI(TGA_Image *image, unsigned long *size)
+{
+    const int channels = (image->bytespp == RGBA) ? 4 : 3;
+    unsigned long npixels = (unsigned long)image->width * image->height;
+
+    unsigned char *bytes = (unsigned char *)malloc(14 + npixels * (channels + 1) + sizeof(IMG_QOIPadding));
+    if (!bytes)
+        return NULL;
+
+    IMG_PutQOIHeader(bytes, image->width, image->height, channels);
+    unsigned long p = 14;
+
+    struct qoi_state state;
+    IMG_QOIInit(&state);
+    p += IMG_EncodeQOIPixels(&state, image->data, image->bytespp, npixels, true, bytes + p);
+
+    memcpy(bytes + p, IMG_QOIPadding, sizeof(IMG_QOIPadding));
+    p += sizeof(IMG_QOIPadding);
+
+    *size = p;
+    return bytes;
+}
+
+static
+bool
+IMG_WriteQOI(TGA_Image *image, const char *filename)
+{
+    if (!image->data)
+        return false;
+
+    unsigned long size;
+    unsigned char *bytes = IMG_EncodeQOI(image, &size);
+    if (!bytes) {
+        fprintf(stderr, "Can't allocate the QOI buffer\n");
+        return false;
+    }
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Can't open file %s\n", filename);
+        free(bytes);
+        return false;
+    }
+
+    bool result = fwrite(bytes, size, 1, file) == 1;
+    if (!result)
+        fprintf(stderr, "%d: Can't dump the QOI data\n", ferror(file));
+
+    fclose(file);
+    free(bytes);
+    return result;
+}
+
+/**
+ * IMG_PNMHeader - PNM or PAM header, returns the channels per pixel
+ */
+static
+int
+IMG_PNMHeader(FILE *file, int width, int height, int bpp, bool pam)
+{
+    const int channels = (pam || bpp != RGBA) ? bpp : RGB;
+    if (pam) {
+        const char *tupltype = (bpp == RGBA) ? "RGB_ALPHA" : (bpp == RGB) ? "RGB" : "GRAYSCALE";
+        fprintf(file, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH %d\nMAXVAL 255\nTUPLTYPE %s\nENDHDR\n",
+                width, height, channels, tupltype);
+    } else {
+        fprintf(file, "P%d\n%d %d\n255\n", bpp == GRAYSCALE ? 5 : 6, width, height);
+    }
+    return channels;
+}
+
+/**
+ * IMG_PNMLine - swizzle a row of BGR(A) pixels to RGB(A)
+ */
+static inline
+void
+IMG_PNMLine(unsigned char *dst, const unsigned char *src, int width, int bpp, int channels)
+{
+    for (int i = 0; i < width; i++, src += bpp, dst += channels) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        if (channels == RGBA)
+            dst[3] = src[3];
+    }
+}
+
+/**
+ * IMG_WritePNM - write a binary PPM/PGM, or a PAM when @pam is set
+ *
+ * Grayscale data goes out as is; color rows are swizzled from the TGA
+ * BGR(A) order into one line buffer. Without PAM the alpha is dropped.
+ */
+static
+bool
+IMG_WritePNM(TGA_Image *image, const char *filename, bool pam)
+{
+    if (!image->data)
+        return false;
+
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Can't open file %s\n", filename);
+        return false;
+    }
+
+    const int bpp = image->bytespp;
+    const int channels = IMG_PNMHeader(file, image->width, image->height, bpp, pam);
+
+    bool result = true;
+    if (bpp == GRAYSCALE) {
+        unsigned long nbytes = (unsigned long)image->width * image->height;
+        result = fwrite(image->data, 1, nbytes, file) == nbytes;
+    } else {
+        unsigned long linebytes = (unsigned long)image->width * channels;
+        unsigned char *line = (unsigned char *)malloc(linebytes);
+        for (int j = 0; result && line && j < image->height; j++) {
+            IMG_PNMLine(line, image->data + (unsigned long)j * image->width * bpp, image->width, bpp, channels);
+            result = fwrite(line, 1, linebytes, file) == linebytes;
+        }
+        if (!line)
+            result = false;
+        free(line);
+    }
+
+    if (!result)
+        fprintf(stderr, "%d: Can't dump the PNM data\n", ferror(file));
+
+    fclose(file);
+    return result;
+}
+
+static
+bool
+IMG_WritePPM(TGA_Image *image, const char *filename)
+{
+    return IMG_WritePNM(image, filename, false);
+}
+
+static
+bool
+IMG_WritePAM(TGA_Image *image, const char *filename)
+{
+    return IMG_WritePNM(image, filename, true);
+}
+
+static
+bool
+IMG_WriteTGA(TGA_Image *image, const char *filename)
+{
+    return TGA_ImageWriteFile(image, filename, true);
+}
+
+static
+bool
+IMG_BeginTGA(struct img_stream *stream, TGA_Image *rows)
+{
+    (void)rows;
+    // the header keeps the size in 16 bits
+    if (stream->width > 65535 || stream->height > 65535) {
+        fprintf(stderr, "TGA images are at most 65535 pixels wide and high\n");
+        return false;
+    }
+    return TGA_WriteHeader(stream->file, stream->width, stream->height, stream->bytespp, true);
+}
+
+static
+bool
+IMG_RowsTGA(struct img_stream *stream, TGA_Image *rows)
+{
+    return TGA_WritePixels(rows, stream->file, true);
+}
+
+static
+bool
+IMG_EndTGA(struct img_stream *stream, TGA_Image *rows)
+{
+    (void)rows;
+    return TGA_WriteFooter(stream->file);
+}
+
+static
+bool
+IMG_BeginQOI(struct img_stream *stream, TGA_Image *rows)
+{
+    (void)rows;
+    unsigned char header[14];
+    stream->channels = (stream->bytespp == RGBA) ? 4 : 3;
+    IMG_PutQOIHeader(header, stream->width, stream->height, stream->channels);
+    IMG_QOIInit(&stream->qoi);
+    return fwrite(header, sizeof(header), 1, stream->file) == 1;
+}
+
+/**
+ * IMG_RowsQOI - encode one row at a time into the line buffer
+ */
+static
+bool
+IMG_RowsQOI(struct img_stream *stream, TGA_Image *rows)
+{
+    const unsigned long linebytes = (unsigned long)rows->width * rows->bytespp;
+    for (int j = 0; j < rows->height; j++) {
+        const bool last = stream->rows + j + 1 == stream->height;
+        unsigned long size = IMG_EncodeQOIPixels(&stream->qoi, rows->data + j * linebytes, rows->bytespp,
+                                                 rows->width, last, stream->line);
+        if (fwrite(stream->line, 1, size, stream->file) != size) {
+            fprintf(stderr, "%d: Can't dump the QOI data\n", ferror(stream->file));
+            return false;
+        }
+    }
+    return true;
+}
+
+static
+bool
+IMG_EndQOI(struct img_stream *stream, TGA_Image *rows)
+{
+    (void)rows;
+    return fwrite(IMG_QOIPadding, sizeof(IMG_QOIPadding), 1, stream->file) == 1;
+}
+
+static
+bool
+IMG_BeginPPM(struct img_stream *stream, TGA_Image *rows)
+{
+    (void)rows;
+    stream->channels = IMG_PNMHeader(stream->file, stream->width, stream->height, stream->bytespp, false);
+    return true;
+}
+
+static
+bool
+IMG_BeginPAM(struct img_stream *stream, TGA_Image *rows)
+{
+    (void)rows;
+    stream->channels = IMG_PNMHeader(stream->file, stream->width, stream->height, stream->bytespp, true);
+    return true;
+}
+
+static
+bool
+IMG_RowsPNM(struct img_stream *stream, TGA_Image *rows)
+{
+    const int bpp = rows->bytespp;
+    bool result = true;
+    if (bpp == GRAYSCALE) {
+        unsigned long nbytes = (unsigned long)rows->width * rows->height;
+        result = fwrite(rows->data, 1, nbytes, stream->file) == nbytes;
+    } else {
+        unsigned long linebytes = (unsigned long)rows->width * stream->channels;
+        for (int j = 0; result && j < rows->height; j++) {
+            IMG_PNMLine(stream->line, rows->data + (unsigned long)j * rows->width * bpp, rows->width, bpp, stream->channels);
+            result = fwrite(stream->line, 1, linebytes, stream->file) == linebytes;
+        }
+    }
+    if (!result)
+        fprintf(stderr, "%d: Can't dump the PNM data\n", ferror(stream->file));
+    return result;
+}
+
+static const struct img_writer IMG_Writers[] = {
+    { "tga", IMG_WriteTGA, IMG_BeginTGA, IMG_RowsTGA, IMG_EndTGA },
+    { "qoi", IMG_WriteQOI, IMG_BeginQOI, IMG_RowsQOI, IMG_EndQOI },
+    { "ppm", IMG_WritePPM, IMG_BeginPPM, IMG_RowsPNM, NULL },
+    { "pam", IMG_WritePAM, IMG_BeginPAM, IMG_RowsPNM, NULL },
+};
+
+/**
+ * IMG_FindWriter - look up the writer for a filename's extension
+ *
+ * Returns NULL when the extension isn't known.
+ */
+static
+const struct img_writer *
+IMG_FindWriter(const char *filename)
+{
+    const char *ext = strrchr(filename, '.');
+    if (!ext || strchr(ext, '/'))
+        return NULL;
+    ext++;
+
+    for (unsigned long i = 0; i < sizeof(IMG_Writers) / sizeof(IMG_Writers[0]); i++) {
+        if (!strcasecmp(ext, IMG_Writers[i].extension))
+            return &IMG_Writers[i];
+    }
+    return NULL;
+}
+
+static
+bool
+IMG_WriteFile(TGA_Image *image, const char *filename)
+{
+    const struct img_writer *writer = IMG_FindWriter(filename);
+    if (!writer) {
+        fprintf(stderr, "Unknown output format: %s\n", filename);
+        return false;
+    }
+    struct pf_span span = PF_Begin("encode");
+    bool result = writer->write(image, filename);
+    PF_End(&span);
+    return result;
+}
+
+/**
+ * IMG_StreamOpen - create @filename and write the header of a @w x @h image
+ *
+ * The format is picked by the extension like IMG_WriteFile. The rows are
+ * then written with IMG_StreamWrite and the file finished by
+ * IMG_StreamClose.
+ */
+static
+bool
+IMG_StreamOpen(struct img_stream *stream, const char *filename, int w, int h, int bpp)
+{
+    memset(stream, 0, sizeof(struct img_stream));
+    stream->writer = IMG_FindWriter(filename);
+    if (!stream->writer) {
+        fprintf(stderr, "Unknown output format: %s\n", filename);
+        return false;
+    }
+    stream->width = w;
+    stream->height = h;
+    stream->bytespp = bpp;
+    stream->channels = bpp;
+
+    // a QOI row can take a tag byte more per pixel than RGBA
+    stream->line = (unsigned char *)malloc((unsigned long)w * 5);
+    if (!stream->line) {
+        fprintf(stderr, "Can't allocate the line buffer\n");
+        return false;
+    }
+    stream->file = fopen(filename, "wb");
+    if (stream->file == NULL) {
+        fprintf(stderr, "Can't open file %s\n", filename);
+        free(stream->line);
+        return false;
+    }
+    if (!stream->writer->begin(stream, NULL)) {
+        fclose(stream->file);
+        free(stream->line);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * IMG_StreamWrite - append the next rows of the image
+ * @rows: as wide and with the same format as the stream
+ */
+static
+bool
+IMG_StreamWrite(struct img_stream *stream, TGA_Image *rows)
+{
+    if (stream->failed)
+        return false;
+    if (!rows->data || rows->width != stream->width || rows->bytespp != stream->bytespp
+            || rows->height > stream->height - stream->rows) {
+        stream->failed = true;
+        return false;
+    }
+
+    struct pf_span span = PF_Begin("encode");
+    stream->failed = !stream->writer->rows(stream, rows);
+    stream->rows += rows->height;
+    PF_End(&span);
+    return !stream->failed;
+}
+
+/**
+ * IMG_StreamClose - finish the file and release the stream
+ *
+ * Returns false when a write failed or not every row was written.
+ */
+static
+bool
+IMG_StreamClose(struct img_stream *stream)
+{
+    bool result = !stream->failed && stream->rows == stream->height;
+    if (result && stream->writer->end)
+        result = stream->writer->end(stream, NULL);
+    result = !fclose(stream->file) && result;
+    free(stream->line);
+    memset(stream, 0, sizeof(struct img_stream));
+    return result;
+}
@@ -0,0 +1,50 @@
+/**
+ * Image writers, picked by the extension of the output filename.
+ *
+ *      .tga        TGA, RLE compressed
+ *      .qoi        QOI (lossless, fast, much smaller than TGA RLE on
+ *                  textured renders)
+ *      .ppm        binary PNM, P6 for color and P5 for grayscale
+ *      .pam        PAM, keeps the alpha channel of RGBA images
+ *
+ * Every format can also be streamed: the header goes out first, then the
+ * rows top to bottom as they become available, so a large image never has
+ * to be held in memory at once.
+ */
+#ifndef _IMG_WRITE_h_
+
+struct img_stream;
+
+typedef bool (*IMG_WriteFn)(TGA_Image *image, const char *filename);
+typedef bool (*IMG_StreamFn)(struct img_stream *stream, TGA_Image *rows);
+
+struct img_writer {
+    const char *extension;
+    IMG_WriteFn write;
+    IMG_StreamFn begin;         // header, called with NULL rows
+    IMG_StreamFn rows;          // the next rows, top to bottom
+    IMG_StreamFn end;           // anything after the pixels, or NULL
+};
+
+/* QOI encoder state, carried from one row to the next. */
+struct qoi_state {
+    unsigned char index[64][4];
+    unsigned char prev[4];
+    int run;
+};
+
+struct img_stream {
+    const struct img_writer *writer;
+    FILE *file;
+    int width;
+    int height;
+    int bytespp;
+    int channels;               // written per pixel
+    int rows;                   // written so far
+    bool failed;
+    unsigned char *line;        // one row in the output format
+    struct qoi_state qoi;
+};
+
+#define _IMG_WRITE_h_
+#endif
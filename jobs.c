@@ -0,0 +1,406 @@
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "jobs.h"
+
+static struct js_scheduler JS_Scheduler = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .wake = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_once_t JS_StartOnce = PTHREAD_ONCE_INIT;
+
+static __thread int JS_Self = -1;       // worker index, -1 outside the pool
+static __thread int JS_Depth = 0;       // tasks running on this thread, nested by waits
+
+#define JS_SPINS 16                     // yields before an idle worker sleeps
+
+static void JS_Run(struct js_task *task);
+
+/**
+ * JS_SetThreads - size of the pool, counting the calling thread
+ * @threads: 0 for one per online CPU
+ *
+ * Only has an effect before the first job is submitted.
+ */
+static
+void
+JS_SetThreads(int threads)
+{
+    JS_Scheduler.threads = MAX(threads, 0);
+}
+
+static
+bool
+JS_DequePush(struct js_deque *deque, struct js_task *task)
+{
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom - deque->top == deque->capacity) {
+        long capacity = MAX(64, deque->capacity * 2);
+        struct js_task **tasks = (struct js_task **)malloc(sizeof(struct js_task *) * capacity);
+        if (!tasks) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        for (long i = deque->top; i < deque->bottom; i++)
+            tasks[i - deque->top] = deque->tasks[i % deque->capacity];
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->bottom -= deque->top;
+        deque->top = 0;
+    }
+    deque->tasks[deque->bottom++ % deque->capacity] = task;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+/**
+ * JS_DequePop - the newest task for the owner, the oldest for a thief
+ */
+static
+struct js_task *
+JS_DequePop(struct js_deque *deque, bool oldest)
+{
+    struct js_task *task = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->bottom > deque->top)
+        task = oldest ? deque->tasks[deque->top++ % deque->capacity] : deque->tasks[--deque->bottom % deque->capacity];
+    pthread_mutex_unlock(&deque->lock);
+    return task;
+}
+
+static inline
+struct js_stats *
+JS_Stats(void)
+{
+    return (JS_Self >= 0) ? &JS_Scheduler.workers[JS_Self].stats : &JS_Scheduler.outside;
+}
+
+/**
+ * JS_Push - queue @task, on the calling worker's deque or the next one
+ *
+ * Returns false when there are no workers or no memory, the caller runs
+ * the task itself then.
+ */
+static
+bool
+JS_Push(struct js_task *task)
+{
+    struct js_scheduler *s = &JS_Scheduler;
+    if (!s->nworkers)
+        return false;
+    const int w = (JS_Self >= 0) ? JS_Self : (int)(atomic_fetch_add(&s->next, 1) % s->nworkers);
+
+    // counted first, a sleeper that sees it looks again until it's there
+    atomic_fetch_add(&s->queued, 1);
+    if (!JS_DequePush(&s->workers[w].deque, task)) {
+        atomic_fetch_sub(&s->queued, 1);
+        return false;
+    }
+    if (atomic_load(&s->sleeping) > 0) {
+        pthread_mutex_lock(&s->lock);
+        pthread_cond_signal(&s->wake);
+        pthread_mutex_unlock(&s->lock);
+    }
+    return true;
+}
+
+/**
+ * JS_Take - a queued task, the calling worker's own newest first, else
+ * one stolen from the other workers
+ */
+static
+struct js_task *
+JS_Take(void)
+{
+    struct js_scheduler *s = &JS_Scheduler;
+    if (atomic_load(&s->queued) <= 0)
+        return NULL;
+
+    struct js_task *task = NULL;
+    if (JS_Self >= 0)
+        task = JS_DequePop(&s->workers[JS_Self].deque, false);
+    const int from = (JS_Self >= 0) ? JS_Self : (int)(atomic_load(&s->next) % s->nworkers);
+    for (int k = 1; !task && k <= s->nworkers; k++) {
+        const int victim = (from + k) % s->nworkers;
+        if (victim == JS_Self)
+            continue;
+        task = JS_DequePop(&s->workers[victim].deque, true);
+        if (task)
+            atomic_fetch_add_explicit(&JS_Stats()->steals, 1, memory_order_relaxed);
+    }
+    if (task)
+        atomic_fetch_sub(&s->queued, 1);
+    return task;
+}
+
+/**
+ * JS_Done - a task of @job returned
+ *
+ * The count only reaches zero under the scheduler lock, so a waiter that
+ * took the lock after seeing zero knows the job is no longer touched, and
+ * the tasks it held are released exactly once.
+ */
+static
+void
+JS_Done(struct js_job *job)
+{
+    struct js_scheduler *s = &JS_Scheduler;
+    long pending = atomic_load(&job->pending);
+    while (pending > 1) {
+        if (atomic_compare_exchange_weak(&job->pending, &pending, pending - 1))
+            return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    struct js_task *held = NULL;
+    if (atomic_fetch_sub(&job->pending, 1) == 1) {
+        held = job->held;
+        job->held = NULL;
+        if (atomic_load(&s->sleeping) > 0)
+            pthread_cond_broadcast(&s->wake);
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    while (held) {
+        struct js_task *next = held->next;
+        if (!JS_Push(held))
+            JS_Run(held);
+        held = next;
+    }
+}
+
+/**
+ * JS_Run - run @task, leaving the upper halves of its range to thieves
+ */
+static
+void
+JS_Run(struct js_task *task)
+{
+    struct js_stats *stats = JS_Stats();
+    const double start = JS_Depth++ ? 0.0 : T_Now();
+    while (task->grain && task->i1 - task->i0 > task->grain) {
+        struct js_task *upper = (struct js_task *)malloc(sizeof(struct js_task));
+        if (!upper)
+            break;
+        const long mid = task->i0 + (task->i1 - task->i0) / 2;
+        *upper = *task;
+        upper->i0 = mid;
+        atomic_fetch_add(&task->job->pending, 1);
+        if (!JS_Push(upper)) {
+            atomic_fetch_sub(&task->job->pending, 1);
+            free(upper);
+            break;
+        }
+        task->i1 = mid;
+    }
+    task->fn(task->arg, task->i0, task->i1);
+
+    if (!--JS_Depth)
+        atomic_fetch_add_explicit(&stats->busy, (long)((T_Now() - start) * 1e9), memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats->tasks, 1, memory_order_relaxed);
+    JS_Done(task->job);
+    free(task);
+}
+
+/**
+ * JS_Sleep - block until a task is queued, or @job is done when given
+ */
+static
+void
+JS_Sleep(struct js_job *job)
+{
+    struct js_scheduler *s = &JS_Scheduler;
+    pthread_mutex_lock(&s->lock);
+    atomic_fetch_add(&s->sleeping, 1);
+    while (atomic_load(&s->queued) <= 0 && (!job || atomic_load(&job->pending) > 0))
+        pthread_cond_wait(&s->wake, &s->lock);
+    atomic_fetch_sub(&s->sleeping, 1);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static
+void *
+JS_WorkerThread(void *arg)
+{
+    JS_Self = (int)(long)arg;
+    for (int idle = 0;; ) {
+        struct js_task *task = JS_Take();
+        if (task) {
+            JS_Run(task);
+            idle = 0;
+        } else if (++idle < JS_SPINS) {
+            sched_yield();
+        } else {
+            JS_Sleep(NULL);
+            idle = 0;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * JS_Start - start the workers, the calling threads make the last one
+ *
+ * Workers that can't be started leave their deque to be stolen from.
+ */
+static
+void
+JS_Start(void)
+{
+    struct js_scheduler *s = &JS_Scheduler;
+    int threads = s->threads ? s->threads : (int)sysconf(_SC_NPROCESSORS_ONLN);
+    threads = MIN(MAX(threads, 1), JS_MAX_THREADS);
+    s->start = T_Now();
+    if (threads == 1)
+        return;
+
+    s->workers = (struct js_worker *)aligned_alloc(64, sizeof(struct js_worker) * (threads - 1));
+    if (!s->workers)
+        return;
+    memset(s->workers, 0, sizeof(struct js_worker) * (threads - 1));
+    for (int i = 0; i < threads - 1; i++)
+        pthread_mutex_init(&s->workers[i].deque.lock, NULL);
+    s->nworkers = threads - 1;
+    for (int i = 0; i < s->nworkers; i++) {
+        if (pthread_create(&s->workers[i].thread, NULL, JS_WorkerThread, (void *)(long)i) == 0)
+            pthread_detach(s->workers[i].thread);
+    }
+}
+
+/**
+ * JS_Threads - threads tasks can run on at once, the caller included
+ */
+static
+int
+JS_Threads(void)
+{
+    pthread_once(&JS_StartOnce, JS_Start);
+    return JS_Scheduler.nworkers + 1;
+}
+
+/**
+ * JS_Wait - return once every task of @job did, running queued ones
+ */
+static
+void
+JS_Wait(struct js_job *job)
+{
+    struct js_scheduler *s = &JS_Scheduler;
+    for (int idle = 0; atomic_load(&job->pending) > 0; ) {
+        struct js_task *task = JS_Take();
+        if (task) {
+            JS_Run(task);
+            idle = 0;
+        } else if (++idle < JS_SPINS) {
+            sched_yield();
+        } else {
+            JS_Sleep(job);
+            idle = 0;
+        }
+    }
+    // the last JS_Done may still hold the lock
+    pthread_mutex_lock(&s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+/**
+ * JS_SpawnAfter - run @fn(@arg, 0, 1) as a task of @job once @after is done
+ * @after: NULL to queue it right away
+ *
+ * Without the memory for the task it runs before this returns.
+ */
+static
+void
+JS_SpawnAfter(struct js_job *job, struct js_job *after, JS_TaskFn fn, void *arg)
+{
+    struct js_scheduler *s = &JS_Scheduler;
+    pthread_once(&JS_StartOnce, JS_Start);
+    struct js_task *task = (struct js_task *)malloc(sizeof(struct js_task));
+    if (!task) {
+        if (after)
+            JS_Wait(after);
+        fn(arg, 0, 1);
+        return;
+    }
+    *task = (struct js_task){ .fn = fn, .arg = arg, .i0 = 0, .i1 = 1, .job = job };
+    atomic_fetch_add(&job->pending, 1);
+
+    if (after) {
+        pthread_mutex_lock(&s->lock);
+        if (atomic_load(&after->pending) > 0) {
+            task->next = after->held;
+            after->held = task;
+            pthread_mutex_unlock(&s->lock);
+            return;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    if (!JS_Push(task))
+        JS_Run(task);
+}
+
+static
+void
+JS_Spawn(struct js_job *job, JS_TaskFn fn, void *arg)
+{
+    JS_SpawnAfter(job, NULL, fn, arg);
+}
+
+/**
+ * JS_ParallelFor - run @fn over [0, @n) split in ranges of at most @grain
+ *
+ * The calling thread takes the lower halves and returns when the whole
+ * range is done. Ranges may run in any order, on any thread.
+ */
+static
+void
+JS_ParallelFor(JS_TaskFn fn, void *arg, long n, long grain)
+{
+    if (n <= 0)
+        return;
+    grain = MAX(grain, 1);
+    struct js_task *task = NULL;
+    if (JS_Threads() > 1 && n > grain)
+        task = (struct js_task *)malloc(sizeof(struct js_task));
+    if (!task) {
+        fn(arg, 0, n);
+        return;
+    }
+
+    struct js_job job = {0};
+    *task = (struct js_task){ .fn = fn, .arg = arg, .i0 = 0, .i1 = n, .grain = grain, .job = &job };
+    atomic_store(&job.pending, 1);
+    JS_Run(task);
+    JS_Wait(&job);
+}
+
+static
+void
+JS_ReportStats(FILE *file, const char *name, const struct js_stats *stats, double elapsed)
+{
+    fprintf(file, "# jobs %-8s %10ld %10ld %7.1f%%\n", name, atomic_load(&stats->tasks),
+            atomic_load(&stats->steals), atomic_load(&stats->busy) * 1e-9 / elapsed * 100.0);
+}
+
+/**
+ * JS_Report - tasks run, steals and time busy per worker since the start
+ */
+static
+void
+JS_Report(FILE *file)
+{
+    struct js_scheduler *s = &JS_Scheduler;
+    pthread_once(&JS_StartOnce, JS_Start);
+    const double elapsed = MAX(T_Now() - s->start, 1e-9);
+    fprintf(file, "# jobs %-8s %10s %10s %8s\n", "worker", "tasks", "steals", "busy");
+    char name[16];
+    for (int i = 0; i < s->nworkers; i++) {
+        snprintf(name, sizeof(name), "%d", i);
+        JS_ReportStats(file, name, &s->workers[i].stats, elapsed);
+    }
+    JS_ReportStats(file, "callers", &s->outside, elapsed);
+}
@@ -0,0 +1,77 @@
+/**
+ * Job system.
+ *
+ * One pool of worker threads shared by every stage, so loading, the
+ * rasterizer and the image operations don't each start threads of their
+ * own and oversubscribe the cores. Each worker owns a deque of tasks: it
+ * pushes and pops its own at the bottom, newest first, and when it runs
+ * dry steals the oldest task at the top of another worker's deque.
+ * Threads outside the pool push to the workers in turn, and run queued
+ * tasks while they wait instead of blocking.
+ *
+ * A task belongs to a js_job that counts it until it returns, and can be
+ * held back until another job is done. JS_ParallelFor splits a range in
+ * halves down to a grain, leaving the upper halves to be stolen, and
+ * returns once all of it ran.
+ *
+ * The pool is started on first use with JS_SetThreads threads, the
+ * calling thread counting as one, or one per online CPU.
+ */
+#ifndef _JOBS_h_
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define JS_MAX_THREADS 256
+
+typedef void (*JS_TaskFn)(void *arg, long i0, long i1);
+
+struct js_task {
+    JS_TaskFn fn;
+    void *arg;
+    long i0, i1;                // range left to run, [0, 1) for a single task
+    long grain;                 // split while the range is longer, 0 never
+    struct js_job *job;
+    struct js_task *next;       // while held by the job it depends on
+};
+
+/* Zero initialized, must not be spawned into once something depends on it. */
+struct js_job {
+    atomic_long pending;        // tasks spawned that haven't returned
+    struct js_task *held;       // started when pending drops to zero
+};
+
+struct js_deque {
+    pthread_mutex_t lock;
+    struct js_task **tasks;     // ring of capacity entries
+    long capacity;
+    long top;                   // oldest, where thieves take
+    long bottom;                // past the newest, where the owner works
+};
+
+struct js_stats {
+    atomic_long tasks;          // run to completion
+    atomic_long steals;         // taken from another worker's deque
+    atomic_long busy;           // nanoseconds spent in tasks, nesting excluded
+};
+
+struct js_worker {
+    struct js_deque deque;
+    struct js_stats stats;
+    pthread_t thread;
+} __attribute__((aligned(64)));
+
+struct js_scheduler {
+    pthread_mutex_t lock;       // guards the sleep and the held tasks
+    pthread_cond_t wake;
+    atomic_long queued;         // tasks in the deques
+    atomic_int sleeping;        // workers and waiters in pthread_cond_wait
+    atomic_uint next;           // deque the next outside push goes to
+    int threads;                // requested, 0 for one per online CPU
+    int nworkers;               // started, the calling threads make one more
+    double start;
+    struct js_worker *workers;
+    struct js_stats outside;    // work done by threads outside the pool
+};
+
+#define _JOBS_h_
+#endif
@@ -0,0 +1,373 @@
+/**
+ * The library build, see librender.h. Pulls the same sources as main.c
+ * into one translation unit, so everything but the RD_ functions stays
+ * static and out of the exported symbols.
+ */
+#include <stdbool.h>
+#include <float.h>
+#include <unistd.h>
+#include "geometry.h"
+#include "timer.h"
+
+#define MAX(a, b) ((a < b) ? b : a)
+#define MIN(a, b) ((a < b) ? a : b)
+#define swap(a, b) do {typeof(a) TEMP = a; a = b; b = TEMP;} while (0)
+
+#include "prof.c"
+#include "cpu.c"
+#include "jobs.c"
+#include "imageops.c"
+#include "tga_img.c"
+#include "texcomp.c"
+#include "texcache.c"
+#include "model.c"
+#include "bvh.c"
+#include "raster.c"
+#include "msaa.c"
+#include "img_write.c"
+#include "stream.c"
+#include "wireframe.c"
+#include "render.c"
+#include "librender.h"
+
+struct rd_model {
+    struct model model;
+    char path[512];             // of the OBJ, where the BVH is cached
+    struct bvh bvh;             // built on the first query
+    bool indexed;
+    pthread_mutex_t bvh_lock;
+};
+
+struct rd_context {
+    struct rd_options options;
+    TGA_Image image;
+    float *zbuffer;
+    long zcapacity;
+    bool rendered;              // image holds a render of the current options
+};
+
+static pthread_once_t RD_InitOnce = PTHREAD_ONCE_INIT;
+
+static
+void
+RD_Init(void)
+{
+    CPU_Init(NULL);
+}
+
+static
+int
+RD_ModelError(int error)
+{
+    switch (error) {
+    case MODEL_OK:          return RD_OK;
+    case MODEL_ERR_OPEN:    return RD_ERR_OPEN;
+    case MODEL_ERR_TEXTURE: return RD_ERR_TEXTURE;
+    case MODEL_ERR_FORMAT:  return RD_ERR_FORMAT;
+    default:                return RD_ERR_MEMORY;
+    }
+}
+
+/**
+ * RD_ModelLoad - parse an OBJ model and its _diffuse.tga texture
+ *
+ * The texture comes from the process wide texture cache, models loaded
+ * from the same file share it.
+ */
+int
+RD_ModelLoad(const char *filename, struct rd_model **model)
+{
+    if (!filename || !model)
+        return RD_ERR_ARGUMENT;
+    pthread_once(&RD_InitOnce, RD_Init);
+
+    *model = (struct rd_model *)calloc(1, sizeof(struct rd_model));
+    if (!*model)
+        return RD_ERR_MEMORY;
+    int error = ModelInit(&(*model)->model, filename);
+    if (error != MODEL_OK) {
+        free(*model);
+        *model = NULL;
+        return RD_ModelError(error);
+    }
+    // a truncated path could name another model, such models aren't cached
+    if (snprintf((*model)->path, sizeof((*model)->path), "%s", filename) >= (int)sizeof((*model)->path))
+        (*model)->path[0] = '\0';
+    pthread_mutex_init(&(*model)->bvh_lock, NULL);
+    return RD_OK;
+}
+
+/**
+ * RD_ModelCompact - quantize the mesh of @model, see ModelCompact
+ *
+ * Must not run while the model is being rendered or queried. The BVH of
+ * the float mesh is dropped, the next query gets one of the packed mesh.
+ */
+int
+RD_ModelCompact(struct rd_model *model)
+{
+    if (!model)
+        return RD_ERR_ARGUMENT;
+    int error = ModelCompact(&model->model);
+    if (error == MODEL_OK) {
+        BV_Delete(&model->bvh);
+        model->indexed = false;
+    }
+    return RD_ModelError(error);
+}
+
+/**
+ * RD_ModelRelease - free a model once no render uses it any more
+ */
+void
+RD_ModelRelease(struct rd_model *model)
+{
+    if (!model)
+        return;
+    ModelDelete(&model->model);
+    BV_Delete(&model->bvh);
+    pthread_mutex_destroy(&model->bvh_lock);
+    free(model);
+}
+
+struct rd_options
+RD_DefaultOptions(void)
+{
+    return (struct rd_options){
+        .width = 800, .height = 800, .samples = 1, .yaw = 0.0f,
+        .shading = RD_SHADE_AUTO, .wireframe = RD_WIREFRAME_OFF
+    };
+}
+
+int
+RD_ContextCreate(struct rd_context **context)
+{
+    if (!context)
+        return RD_ERR_ARGUMENT;
+    pthread_once(&RD_InitOnce, RD_Init);
+
+    *context = (struct rd_context *)calloc(1, sizeof(struct rd_context));
+    if (!*context)
+        return RD_ERR_MEMORY;
+    (*context)->options = RD_DefaultOptions();
+    return RD_OK;
+}
+
+void
+RD_ContextDestroy(struct rd_context *context)
+{
+    if (!context)
+        return;
+    TGA_ImageDelete(&context->image);
+    free(context->zbuffer);
+    free(context);
+}
+
+/**
+ * RD_SetOptions - options of the following renders
+ *
+ * Leaves the context as it was when an option is out of range.
+ */
+int
+RD_SetOptions(struct rd_context *context, const struct rd_options *options)
+{
+    if (!context || !options)
+        return RD_ERR_ARGUMENT;
+    if (options->width < 1 || options->height < 1
+            || options->width > RD_MAX_DIMENSION || options->height > RD_MAX_DIMENSION)
+        return RD_ERR_ARGUMENT;
+    if (options->samples != 1 && options->samples != 4 && options->samples != 8)
+        return RD_ERR_ARGUMENT;
+    if (options->shading < RD_SHADE_AUTO || options->shading > RD_SHADE_PIXEL)
+        return RD_ERR_ARGUMENT;
+    if (options->wireframe < RD_WIREFRAME_OFF || options->wireframe > RD_WIREFRAME_OVERLAY)
+        return RD_ERR_ARGUMENT;
+
+    context->options = *options;
+    context->rendered = false;
+    return RD_OK;
+}
+
+/**
+ * RD_Render - render @model with the options of @context
+ *
+ * The framebuffer and z-buffer are only reallocated when the size grows
+ * or changes.
+ */
+int
+RD_Render(struct rd_context *context, const struct rd_model *model)
+{
+    if (!context || !model)
+        return RD_ERR_ARGUMENT;
+
+    const struct rd_options *o = &context->options;
+    const struct render_options opts = {
+        .samples = o->samples, .yaw = o->yaw, .wireframe = o->wireframe, .shading = o->shading
+    };
+    context->rendered = false;
+    if (context->image.width != o->width || context->image.height != o->height) {
+        TGA_ImageDelete(&context->image);
+        context->image = TGA_ImageInit(o->width, o->height, RGB);
+    } else {
+        TGA_ImageClear(&context->image);
+    }
+    if (context->zcapacity < (long)o->width * o->height) {
+        free(context->zbuffer);
+        context->zcapacity = (long)o->width * o->height;
+        context->zbuffer = (float *)malloc(sizeof(float) * context->zcapacity);
+    }
+    if (!context->image.data || !context->zbuffer) {
+        TGA_ImageDelete(&context->image);
+        free(context->zbuffer);
+        context->zbuffer = NULL;
+        context->zcapacity = 0;
+        return RD_ERR_MEMORY;
+    }
+
+    // renders only read the model, the lazily built edges are under its lock
+    if (!renderBuffered((struct model *)&model->model, &context->image, &opts, context->zbuffer))
+        return RD_ERR_MEMORY;
+    context->rendered = true;
+    return RD_OK;
+}
+
+int
+RD_GetImage(const struct rd_context *context, struct rd_image *image)
+{
+    if (!context || !image)
+        return RD_ERR_ARGUMENT;
+    if (!context->rendered)
+        return RD_ERR_NO_IMAGE;
+    *image = (struct rd_image){
+        .data = context->image.data,
+        .width = context->image.width,
+        .height = context->image.height,
+        .bytespp = context->image.bytespp
+    };
+    return RD_OK;
+}
+
+/**
+ * RD_WriteFile - write the last render, format by extension like main's -o
+ */
+int
+RD_WriteFile(struct rd_context *context, const char *filename)
+{
+    if (!context || !filename)
+        return RD_ERR_ARGUMENT;
+    if (!context->rendered)
+        return RD_ERR_NO_IMAGE;
+    if (!IMG_FindWriter(filename) || !IMG_WriteFile(&context->image, filename))
+        return RD_ERR_OUTPUT;
+    return RD_OK;
+}
+
+/**
+ * RD_ModelBVH - the BVH of @model, opened on the first call
+ *
+ * Safe to call from several threads. Returns NULL when out of memory.
+ */
+static
+const struct bvh *
+RD_ModelBVH(struct rd_model *model)
+{
+    pthread_mutex_lock(&model->bvh_lock);
+    if (!model->indexed)
+        model->indexed = BV_Open(&model->bvh, &model->model, model->path);
+    pthread_mutex_unlock(&model->bvh_lock);
+    return model->indexed ? &model->bvh : NULL;
+}
+
+/**
+ * RD_Pick - what @n pixels of a render of @model with the options of
+ * @context show
+ * @xy: x, y of each pixel, rows from the top like rd_image
+ *
+ * Doesn't need a render, only its options. Along the edges of faces a
+ * pick may be the neighbour of the face a single sample render drew,
+ * which snaps the vertices to whole pixels.
+ */
+int
+RD_Pick(const struct rd_context *context, struct rd_model *model, const int *xy, int n, struct rd_pick *picks)
+{
+    if (!context || !model || n < 0 || (n && (!xy || !picks)))
+        return RD_ERR_ARGUMENT;
+    const struct rd_options *o = &context->options;
+    for (int i = 0; i < n; i++) {
+        if (xy[2 * i] < 0 || xy[2 * i + 1] < 0 || xy[2 * i] >= o->width || xy[2 * i + 1] >= o->height)
+            return RD_ERR_ARGUMENT;
+    }
+    const struct bvh *bvh = RD_ModelBVH(model);
+    v2i *pixels = (v2i *)malloc(sizeof(v2i) * MAX(n, 1));
+    struct bvh_hit *hits = (struct bvh_hit *)malloc(sizeof(struct bvh_hit) * MAX(n, 1));
+    const struct render_options opts = {
+        .samples = o->samples, .yaw = o->yaw, .wireframe = o->wireframe, .shading = o->shading
+    };
+    int result = RD_ERR_MEMORY;
+    if (bvh && pixels && hits) {
+        for (int i = 0; i < n; i++)
+            pixels[i] = V2_int(xy[2 * i], xy[2 * i + 1]);
+        if (pickPixels(bvh, o->width, o->height, &opts, pixels, hits, n)) {
+            for (int i = 0; i < n; i++) {
+                const v2f uv = hits[i].face >= 0 ? BV_HitUV(&model->model, &hits[i]) : V2_float(0.0f, 0.0f);
+                picks[i] = (struct rd_pick){ .face = hits[i].face, .u = uv.x, .v = uv.y };
+            }
+            result = RD_OK;
+        }
+    }
+    free(pixels);
+    free(hits);
+    return result;
+}
+
+/**
+ * RD_Occluded - whether each of @n @rays runs into a face of @model
+ * @occluded: set to 1 or 0 per ray
+ *
+ * Rays next to each other going the same way are traced together, order
+ * them so when there are many.
+ */
+int
+RD_Occluded(struct rd_model *model, const struct rd_ray *rays, int n, unsigned char *occluded)
+{
+    if (!model || n < 0 || (n && (!rays || !occluded)))
+        return RD_ERR_ARGUMENT;
+    const struct bvh *bvh = RD_ModelBVH(model);
+    struct bvh_ray *traced = (struct bvh_ray *)malloc(sizeof(struct bvh_ray) * MAX(n, 1));
+    struct bvh_hit *hits = (struct bvh_hit *)malloc(sizeof(struct bvh_hit) * MAX(n, 1));
+    int result = RD_ERR_MEMORY;
+    if (bvh && traced && hits) {
+        for (int i = 0; i < n; i++) {
+            traced[i] = (struct bvh_ray){
+                .origin = V3_float(rays[i].origin[0], rays[i].origin[1], rays[i].origin[2]),
+                .tmin = 0.0f,
+                .dir = V3_float(rays[i].dir[0], rays[i].dir[1], rays[i].dir[2]),
+                .tmax = rays[i].tmax
+            };
+        }
+        BV_Occluded(bvh, traced, hits, n);
+        for (int i = 0; i < n; i++)
+            occluded[i] = hits[i].face >= 0;
+        result = RD_OK;
+    }
+    free(traced);
+    free(hits);
+    return result;
+}
+
+const char *
+RD_ErrorString(int error)
+{
+    switch (error) {
+    case RD_OK:             return "success";
+    case RD_ERR_ARGUMENT:   return "invalid argument";
+    case RD_ERR_MEMORY:     return "out of memory";
+    case RD_ERR_OPEN:       return "can't open the model";
+    case RD_ERR_TEXTURE:    return "can't load the texture";
+    case RD_ERR_FORMAT:     return "bad model data";
+    case RD_ERR_THREAD:     return "can't start the texture loader";
+    case RD_ERR_OUTPUT:     return "can't write the output";
+    case RD_ERR_NO_IMAGE:   return "nothing rendered yet";
+    default:                return "unknown error";
+    }
+}
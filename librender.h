@@ -0,0 +1,100 @@
+/**
+ * librender - the renderer as a library.
+ *
+ * A loaded model is read-only once RD_ModelLoad (and RD_ModelCompact, if
+ * wanted) returns, any number of threads can render it at the same time.
+ * A context owns the options, the framebuffer and the z-buffer of one
+ * render at a time: use one per thread, the buffers are kept from one
+ * render to the next. Every call reports failures with an rd_error,
+ * nothing in the library exits the process.
+ *
+ * Picking and ray casts go through a BVH of the model, built on the first
+ * query, or read from <model.obj>.bvh next to the OBJ when saved there by
+ * an earlier query for the same version of the file.
+ *
+ * `make lib` builds librender.a and librender.so, which only export the
+ * functions below.
+ */
+#ifndef _LIBRENDER_h_
+
+#define RD_MAX_DIMENSION 16384
+
+enum rd_error {
+    RD_OK = 0,
+    RD_ERR_ARGUMENT = -1,       // NULL handle or option out of range
+    RD_ERR_MEMORY = -2,
+    RD_ERR_OPEN = -3,           // the model file can't be opened
+    RD_ERR_TEXTURE = -4,        // the model's _diffuse.tga is missing or unreadable
+    RD_ERR_FORMAT = -5,         // a face refers to a missing v/vt/vn
+    RD_ERR_THREAD = -6,         // no longer returned, the texture loads as a task of the job system
+    RD_ERR_OUTPUT = -7,         // unknown output format or the file can't be written
+    RD_ERR_NO_IMAGE = -8,       // nothing rendered with this context yet
+};
+
+enum rd_shading {
+    RD_SHADE_AUTO = 0,          // by output size, see render.h
+    RD_SHADE_FACE,
+    RD_SHADE_VERTEX,
+    RD_SHADE_PIXEL,
+};
+
+enum rd_wireframe {
+    RD_WIREFRAME_OFF = 0,
+    RD_WIREFRAME_ONLY,
+    RD_WIREFRAME_OVERLAY,
+};
+
+struct rd_options {
+    int width;                  // 1 to RD_MAX_DIMENSION
+    int height;
+    int samples;                // 1 (no anti-aliasing), 4 or 8
+    float yaw;                  // rotation of the model around the y axis, in radians
+    int shading;                // rd_shading
+    int wireframe;              // rd_wireframe
+};
+
+/* What a pixel of a render shows. */
+struct rd_pick {
+    int face;                   // from 0 in the order of the OBJ, -1 for the background
+    float u, v;                 // texture coordinate of the model there
+};
+
+/* A segment from origin to origin + tmax * dir, in model space. */
+struct rd_ray {
+    float origin[3];
+    float dir[3];
+    float tmax;
+};
+
+/* The last render of a context, valid until its next render. Rows run top
+ * to bottom, pixels are stored B, G, R. */
+struct rd_image {
+    const unsigned char *data;
+    int width;
+    int height;
+    int bytespp;
+};
+
+struct rd_model;
+struct rd_context;
+
+int RD_ModelLoad(const char *filename, struct rd_model **model);
+int RD_ModelCompact(struct rd_model *model);
+void RD_ModelRelease(struct rd_model *model);
+
+struct rd_options RD_DefaultOptions(void);
+int RD_ContextCreate(struct rd_context **context);
+void RD_ContextDestroy(struct rd_context *context);
+int RD_SetOptions(struct rd_context *context, const struct rd_options *options);
+
+int RD_Render(struct rd_context *context, const struct rd_model *model);
+int RD_GetImage(const struct rd_context *context, struct rd_image *image);
+int RD_WriteFile(struct rd_context *context, const char *filename);
+
+int RD_Pick(const struct rd_context *context, struct rd_model *model, const int *xy, int n, struct rd_pick *picks);
+int RD_Occluded(struct rd_model *model, const struct rd_ray *rays, int n, unsigned char *occluded);
+
+const char *RD_ErrorString(int error);
+
+#define _LIBRENDER_h_
+#endif
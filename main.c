@@ -1,227 +1,426 @@
 #include <stdbool.h>
 #include <float.h>
 #include <unistd.h>
+#include <getopt.h>
 #include "geometry.h"
-#include "tga_img.c"
-#include "model.c"
+#include "timer.h"
 
 #define MAX(a, b) ((a < b) ? b : a)
 #define MIN(a, b) ((a < b) ? a : b)
 #define swap(a, b) do {typeof(a) TEMP = a; a = b; b = TEMP;} while (0)
 
-const TGA_Color white = TGA_ColorInit(255, 255, 255, 255);
-const TGA_Color red   = TGA_ColorInit(255,   0,   0, 255);
-const TGA_Color blue  = TGA_ColorInit(  0, 255,   0, 255);
-const TGA_Color green = TGA_ColorInit(  0,   0, 255, 255);
+#include "prof.c"
+#include "cpu.c"
+#include "jobs.c"
+#include "imageops.c"
+#include "tga_img.c"
+#include "texcomp.c"
+#include "texcache.c"
+#include "model.c"
+#include "bvh.c"
+#include "raster.c"
+#include "msaa.c"
+#include "img_write.c"
+#include "stream.c"
+#include "wireframe.c"
+#include "render.c"
+#include "scene.c"
+#include "server.c"
+
+#define MAX_PICKS 64            // -k options
+
+struct progress_output {
+    const char *filename;
+    double start;
+};
 
 static
 void
-line(TGA_Image *image, v2i t0, v2i t1, TGA_Color color)
+progressWrite(TGA_Image *image, int pass, int scale, void *user)
 {
-    bool steep = false;
-    if (fabs(t0.x - t1.x) < fabs(t0.y - t1.y)) {
-        swap(t0.x, t0.y);
-        swap(t1.x, t1.y);
-        steep = true;
-    }
-
-    if (t0.x > t1.x)
-        swap(t0, t1);
-
-    int dy = t1.y - t0.y;
-    int dx = t1.x - t0.x;
-    int derror2 = fabs(dy)*2;
-    int error2 = 0;
-    int y = t0.y;
-
-    for (int x = t0.x; x <= t1.x; x++) {
-        bool imageSet;
-        if (steep) 
-            imageSet = TGA_ImageSet(image, y, x, color);
-        else
-            imageSet = TGA_ImageSet(image, x, y, color);
-        if (!imageSet) {
-            fprintf(stderr, "Can't set pixel at %d, %d\n", x, y);
-        }
-
-        error2 += derror2;
-        if (error2 > dx) {
-            y += (t1.y > t0.y ? 1 : -1);
-            error2 -= dx * 2;
-        }
-    }
+    struct progress_output *out = (struct progress_output *)user;
+    double elapsed = T_Now() - out->start;
+    IMG_WriteFile(image, out->filename);
+    fprintf(stderr, "# pass %d (1/%d) ready at %.3f ms, written at %.3f ms\n",
+            pass, scale, elapsed * 1e3, (T_Now() - out->start) * 1e3);
 }
 
 static
-v3f
-barycentric(v3f A, v3f B, v3f C, v3f P)
+void
+usage(const char *name)
 {
-    v3f s[2];
-    for (int i = 2; i--;) {
-        s[i].raw[0] = C.raw[i] - A.raw[i];
-        s[i].raw[1] = B.raw[i] - A.raw[i];
-        s[i].raw[2] = A.raw[i] - P.raw[i];
-    }
-
-    v3f u = CrossV3_float(s[0], s[1]);
-    if (fabs(u.raw[2]) > 0.001f)
-        return V3_float(1.0f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
-    return V3_float(-1.0f, 1.0f, 1.0f);
+    fprintf(stderr, "usage: %s [-a samples | -s factor] [-r size] [-o output [-m | -M MB]] [-l shading] [-q] [-c] [-j threads] [-T trace.json] [--force-isa isa] [-w|-W] [-k x,y] [-n frames [-p pixfmt] | -P ms] [model.obj | file.scene]\n", name);
+    fprintf(stderr, "       %s [-c] [-j threads] [-T trace.json] [--force-isa isa] -S socket\n", name);
+    fprintf(stderr, "  -a samples   multisample anti-aliasing, 1 (off), 4 or 8\n");
+    fprintf(stderr, "  -s factor    supersample, render factor times larger and box filter down\n");
+    fprintf(stderr, "  -r size      output size as WIDTHxHEIGHT, 800x800 by default\n");
+    fprintf(stderr, "  -o output    output file, format by extension: tga qoi ppm pam\n");
+    fprintf(stderr, "  -m           render straight into the memory mapped output,\n");
+    fprintf(stderr, "               an uncompressed tga\n");
+    fprintf(stderr, "  -M MB        render a model in bands of at most MB megabytes of\n");
+    fprintf(stderr, "               buffers, each written out before the next, for outputs\n");
+    fprintf(stderr, "               too large to hold in memory\n");
+    fprintf(stderr, "  -l shading   lighting rate, face, vertex, pixel or auto (default),\n");
+    fprintf(stderr, "               auto lights thumbnails per vertex and larger renders\n");
+    fprintf(stderr, "               per face as before, vertex or pixel opt in to smooth\n");
+    fprintf(stderr, "  -q           render from the quantized mesh the server keeps\n");
+    fprintf(stderr, "  -c           keep textures block compressed, saved as <texture>.bc1\n");
+    fprintf(stderr, "  -j threads   threads of the job system, the loading, rendering and\n");
+    fprintf(stderr, "               image operations share, one per CPU by default\n");
+    fprintf(stderr, "  -T trace     profile the stages with the hardware counters when\n");
+    fprintf(stderr, "               available, write a Chrome trace and print the totals\n");
+    fprintf(stderr, "               and the work of each job system thread\n");
+    fprintf(stderr, "  --force-isa isa\n");
+    fprintf(stderr, "               kernels to use, sse2, avx2 or avx512, instead of the\n");
+    fprintf(stderr, "               widest this CPU supports\n");
+    fprintf(stderr, "  -w           wireframe only\n");
+    fprintf(stderr, "  -W           wireframe over the shaded render\n");
+    fprintf(stderr, "  -k x,y       print the face, from 0, and texture coordinate under\n");
+    fprintf(stderr, "               pixel x,y of the render, rows from the top; repeatable,\n");
+    fprintf(stderr, "               through a BVH saved as <model.obj>.bvh\n");
+    fprintf(stderr, "  -n frames    render a turntable of raw frames to the output,\n");
+    fprintf(stderr, "               '-' is stdout, FIFOs are fine\n");
+    fprintf(stderr, "  -p pixfmt    raw frame format, rgb24 (default) or rgba\n");
+    fprintf(stderr, "  -P ms        progressive, a coarse pass within ms milliseconds then\n");
+    fprintf(stderr, "               refinements, the output is rewritten after each pass\n");
+    fprintf(stderr, "  -S socket    serve render requests on a Unix socket, '-' is stdin\n");
+    fprintf(stderr, "  file.scene   instances, one '<model.obj> <x> <y> <z> [yaw] [scale]'\n");
+    fprintf(stderr, "               per line, rendered as a single frame\n");
 }
 
-static
-void
-triangle(TGA_Image *image, v3f pts[3], float *zbuffer, TGA_Color color)
+int
+main(int argc, char **argv)
 {
-    v2f bboxmin = V2_float(FLT_MAX, FLT_MAX);
-    v2f bboxmax = V2_float(FLT_MIN, FLT_MIN);
-    v2f clamp = V2_float(image->width - 1, image->height - 1);
-
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 2; j++) {
-            bboxmin.raw[j] = MAX(0.0f,         MIN(bboxmin.raw[j], pts[i].raw[j]));
-            bboxmax.raw[j] = MIN(clamp.raw[j], MAX(bboxmax.raw[j], pts[i].raw[j]));
-        }
-    }
+    struct model model = {0};
+    int width = 800;
+    int height = 800;
+    struct render_options opts = { .samples = 1, .yaw = 0.0f, .wireframe = WIREFRAME_OFF,
+                                   .shading = SHADE_AUTO };
+    const char *output = NULL;
+    int frames = 0;
+    bool alpha = false;
+    double budget = 0.0;
+    int supersample = 1;
+    bool mapped = false;
+    unsigned long band_budget = 0;
+    bool packed = false;
+    bool compressed = false;
+    const char *trace = NULL;
+    const char *serve = NULL;
+    v2i picks[MAX_PICKS];
+    int npicks = 0;
 
-    v3f P;
-    for (P.x = bboxmin.x; P.x <= bboxmax.x; P.x++) {
-        for (P.y = bboxmin.y; P.y <= bboxmax.y; P.y++) {
-            v3f bc_screen = barycentric(pts[0], pts[1], pts[2], P);
-            if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0) continue;
-
-            P.z = 0;
-            for (int i = 0; i < 3; i++)
-                P.z += pts[i].raw[2] * bc_screen.raw[i];
-
-            // compute a normal value
-            v3f w_pts[3];
-            for (int i = 0; i < 3; i++)
-                w_pts[i] = V3_float(pts[i].x * 2.0f / image->width - 1.0f, pts[i].y * 2.0f / image->height - 1.0f, pts[i].z);
-            v3f normal = CrossV3_float(SubV3_float(w_pts[2], w_pts[0]), SubV3_float(w_pts[1], w_pts[0]));
-            normal = NormV3_float(normal);
-            float intensity = DotV3_float(normal, V3_float(0.0, 0.0, -0.95f));
-            
-            TGA_Color c = color;
-            if (intensity > 0.0f) {
-                c = TGA_ColorInit(
-                        intensity * color.r,
-                        intensity * color.g,
-                        intensity * color.b,
-                        color.a);
-            }
+    static const struct option longopts[] = {
+        { "force-isa", required_argument, NULL, 'I' },
+        { NULL, 0, NULL, 0 }
+    };
+    CPU_Init(NULL);
 
-            if (zbuffer[(int)(P.x + P.y * image->width)] < P.z) {
-                zbuffer[(int)(P.x + P.y * image->width)] = P.z;
-                TGA_ImageSet(image, P.x, P.y, c);
+    int opt;
+    while ((opt = getopt_long(argc, argv, "a:s:r:o:mM:l:qcj:T:wWk:n:p:P:S:h", longopts, NULL)) != -1) {
+        switch (opt) {
+        case 'a':
+            opts.samples = atoi(optarg);
+            if (opts.samples != 1 && opts.samples != 4 && opts.samples != 8) {
+                usage(argv[0]);
+                return -1;
             }
+            break;
+        case 's':
+            supersample = atoi(optarg);
+            if (supersample < 1 || supersample > 8) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'r': {
+            // TGA stores the size in 16 bits
+            char extra;
+            if (sscanf(optarg, "%dx%d%c", &width, &height, &extra) != 2
+                    || width < 1 || height < 1 || width > 65535 || height > 65535) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        }
+        case 'o':
+            output = optarg;
+            break;
+        case 'm':
+            mapped = true;
+            break;
+        case 'M':
+            band_budget = atof(optarg) * 1024.0 * 1024.0;
+            if (band_budget < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'l':
+            opts.shading = shadeRateParse(optarg);
+            if (opts.shading < 0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'q':
+            packed = true;
+            break;
+        case 'c':
+            TC_SetCompression(true);
+            compressed = true;
+            break;
+        case 'j':
+            if (atoi(optarg) < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            JS_SetThreads(atoi(optarg));
+            break;
+        case 'T':
+            trace = optarg;
+            PF_Enable();
+            break;
+        case 'I':
+            if (!CPU_Init(optarg))
+                return -1;
+            break;
+        case 'w':
+            opts.wireframe = WIREFRAME_ONLY;
+            break;
+        case 'W':
+            opts.wireframe = WIREFRAME_OVERLAY;
+            break;
+        case 'k': {
+            char extra;
+            if (npicks == MAX_PICKS
+                    || sscanf(optarg, "%d,%d%c", &picks[npicks].x, &picks[npicks].y, &extra) != 2) {
+                usage(argv[0]);
+                return -1;
+            }
+            npicks++;
+            break;
+        }
+        case 'n':
+            frames = atoi(optarg);
+            if (frames < 1) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'p':
+            if (!strcmp(optarg, "rgba")) {
+                alpha = true;
+            } else if (strcmp(optarg, "rgb24")) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'P':
+            budget = atof(optarg) * 1e-3;
+            if (budget <= 0.0) {
+                usage(argv[0]);
+                return -1;
+            }
+            break;
+        case 'S':
+            serve = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return -1;
         }
     }
-}
 
-static
-void
-textureMap(struct model *model, TGA_Image *image, v3f s_pts[3], v2f t_pts[3], float *zbuffer)
-{
-    v2f bboxmin = V2_float(FLT_MAX, FLT_MAX);
-    v2f bboxmax = V2_float(FLT_MIN, FLT_MIN);
-    v2f clamp = V2_float(image->width - 1, image->height - 1);
-
-    for (int i = 0; i < 3; i++) {
-        for (int j = 0; j < 2; j++) {
-            bboxmin.raw[j] = MAX(0.0f,         MIN(bboxmin.raw[j], s_pts[i].raw[j]));
-            bboxmax.raw[j] = MIN(clamp.raw[j], MAX(bboxmax.raw[j], s_pts[i].raw[j]));
+    CPU_Report(stderr);
+    if (serve) {
+        // after every option, the threads and instruction set apply to the server too
+        int served = SRV_Run(serve);
+        if (trace) {
+            PF_Report(stderr);
+            JS_Report(stderr);
+            PF_WriteTrace(trace);
         }
+        return served;
+    }
+    if (!output)
+        output = frames ? "-" : "output.tga";
+    if (!frames && !IMG_FindWriter(output)) {
+        fprintf(stderr, "Unknown output format: %s\n", output);
+        return -1;
+    }
+    if (mapped && (frames || budget > 0.0 || IMG_FindWriter(output)->write != IMG_WriteTGA)) {
+        fprintf(stderr, "-m needs a single frame written to a .tga\n");
+        return -1;
+    }
+    if (band_budget && (frames || budget > 0.0 || mapped || supersample > 1)) {
+        fprintf(stderr, "-M renders a single frame, without -n, -P, -m or -s\n");
+        return -1;
     }
 
-    v3f P;
-    TGA_Color color;
-    for (P.x = bboxmin.x; P.x <= bboxmax.x; P.x++) {
-        for (P.y = bboxmin.y; P.y <= bboxmax.y; P.y++) {
-            v3f bc_screen = barycentric(s_pts[0], s_pts[1], s_pts[2], P);
-            if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0) continue;
-
-            P.z = 0;
-            for (int i = 0; i < 3; i++)
-                P.z += s_pts[i].z * bc_screen.raw[i];
-
-            v2i texture_pts = V2_int(
-                    bc_screen.x * t_pts[0].x + bc_screen.y * t_pts[1].x + bc_screen.z * t_pts[2].x,
-                    bc_screen.x * t_pts[0].y + bc_screen.y * t_pts[1].y + bc_screen.z * t_pts[2].y);
-            color = TGA_ImageGet(&model->texture, texture_pts.x, texture_pts.y);
-
-            // compute a normal value
-            v3f w_pts[3];
-            for (int i = 0; i < 3; i++)
-                w_pts[i] = V3_float(s_pts[i].x * 2.0f / image->width - 1.0f, s_pts[i].y * 2.0f / image->height - 1.0f, s_pts[i].z);
-            v3f normal = CrossV3_float(SubV3_float(w_pts[2], w_pts[0]), SubV3_float(w_pts[1], w_pts[0]));
-            normal = NormV3_float(normal);
-            float intensity = DotV3_float(normal, V3_float(0.0, 0.0, -0.95f));
-            
-            if (intensity > 0.0f) {
-                color = TGA_ColorInit(
-                        intensity * color.r,
-                        intensity * color.g,
-                        intensity * color.b,
-                        color.a);
-            }
+    for (int i = 0; i < npicks; i++) {
+        if (picks[i].x < 0 || picks[i].y < 0 || picks[i].x >= width || picks[i].y >= height) {
+            fprintf(stderr, "-k %d,%d is outside the %dx%d render\n", picks[i].x, picks[i].y, width, height);
+            return -1;
+        }
+    }
 
-            if ((int)(P.x + P.y * image->width) < 0 || (int)(P.x + P.y * image->width) >= image->width * image->height)
-                fprintf(stdout, "out of bounds\n");
-            if (zbuffer[(int)(P.x + P.y * image->width)] < P.z) {
-                zbuffer[(int)(P.x + P.y * image->width)] = P.z;
-                TGA_ImageSet(image, P.x, P.y, color);
+    const char *filename = (optind < argc) ? argv[optind] : "obj/african_head.obj";
+    const char *extension = strrchr(filename, '.');
+    const bool is_scene = extension && !strcmp(extension, ".scene");
+    if (is_scene && npicks) {
+        fprintf(stderr, "-k picks from a model, not a scene\n");
+        return -1;
+    }
+    struct scene scene;
+    SC_Init(&scene);
+    if (is_scene) {
+        if (frames || budget > 0.0 || band_budget) {
+            fprintf(stderr, "Scenes are rendered as a single frame, without -n, -P or -M\n");
+            return -1;
+        }
+        if (!SC_Load(&scene, filename)) {
+            SC_Delete(&scene);
+            return -1;
+        }
+    } else if (ModelInit(&model, filename) != MODEL_OK) {
+        fprintf(stderr, "Can't load the model %s\n", filename);
+        return -1;
+    }
+    for (int i = 0; i < (is_scene ? scene.nmodels : 1); i++)
+        ModelReport(is_scene ? &scene.models[i]->model : &model, stderr);
+    if (packed) {
+        unsigned long before = 0, after = 0;
+        for (int i = 0; i < (is_scene ? scene.nmodels : 1); i++) {
+            struct model *m = is_scene ? &scene.models[i]->model : &model;
+            before += ModelBytes(m);
+            if (ModelCompact(m) != MODEL_OK) {
+                fprintf(stderr, "Can't pack the model %s\n", is_scene ? scene.models[i]->path : filename);
+                if (is_scene)
+                    SC_Delete(&scene);
+                else
+                    ModelDelete(&model);
+                return -1;
             }
+            after += ModelBytes(m);
         }
+        fprintf(stderr, "# mesh %.1f KB, packed %.1f KB\n", before / 1024.0, after / 1024.0);
+    }
+    if (compressed) {
+        struct tc_stats tc;
+        TC_GetStats(&tc);
+        fprintf(stderr, "# texture %.1f KB, compressed %.1f KB\n", (tc.bytes + tc.saved) / 1024.0, tc.bytes / 1024.0);
     }
-}
 
-static
-void
-render(struct model *model, TGA_Image *image)
-{
-    int width = image->width;
-    int height = image->height;
-
-    float *zbuffer = (float *)malloc(sizeof(float)*width*height);
-    for (int i = width * height; i-- ; zbuffer[i] = -FLT_MAX);
-
-    struct ll_face_node *face, *temp;
-    LIST_FOR_EACH_ENTRY_SAFE(face, temp, &model->faces_.list.head, head) {
-        v2f t_coords[3];
-        v3f s_coords[3];
-        for (int j = 0; j < 3; j++) {
-            v3f *v = LL_V3F_GetIndex(&model->verts_, face->indexes[j].ivert);
-            int x = (v->x + 1.0f) * width / 2.0f;
-            int y = (v->y + 1.0f) * height / 2.0f;
-            s_coords[j] = V3_float(x, y, v->z);
-            v3f *t = LL_V3F_GetIndex(&model->textures_, face->indexes[j].iuv);
-            t_coords[j] = V2_float(t->x * model->texture.width, t->y * model->texture.height);
+    if (npicks) {
+        double start = T_Now();
+        struct bvh bvh;
+        struct bvh_hit hits[MAX_PICKS];
+        if (!BV_Open(&bvh, &model, filename)) {
+            fprintf(stderr, "Can't build the BVH of %s\n", filename);
+            ModelDelete(&model);
+            return -1;
         }
-        textureMap(model, image, s_coords, t_coords, (float *)zbuffer);
+        double ready = T_Now() - start;
+        bool picked = pickPixels(&bvh, width, height, &opts, picks, hits, npicks);
+        fprintf(stderr, "# bvh %d nodes ready in %.3f ms, %d picks in %.3f ms\n",
+                bvh.nnodes, ready * 1e3, npicks, (T_Now() - start - ready) * 1e3);
+        for (int i = 0; picked && i < npicks; i++) {
+            if (hits[i].face < 0) {
+                fprintf(stderr, "# pick %d,%d background\n", picks[i].x, picks[i].y);
+                continue;
+            }
+            v2f uv = BV_HitUV(&model, &hits[i]);
+            fprintf(stderr, "# pick %d,%d face %d uv %.4f %.4f\n", picks[i].x, picks[i].y, hits[i].face, uv.x, uv.y);
+        }
+        BV_Delete(&bvh);
     }
-    TGA_ImageFlipVertically(image);
 
-    free(zbuffer);
-}
-
-int
-main(int argc, char **argv)
-{
-    struct model model = {0};
-    const int width = 800;
-    const int height = 800;
+    int result = 0;
+    if (frames) {
+        FILE *file = strcmp(output, "-") ? fopen(output, "wb") : stdout;
+        if (file == NULL) {
+            fprintf(stderr, "Can't open file %s\n", output);
+            ModelDelete(&model);
+            return -1;
+        }
+        if (!renderSequence(&model, width, height, opts, frames, file, alpha))
+            result = -1;
+        if (file != stdout)
+            fclose(file);
+    } else if (band_budget) {
+        int rows = bandRows(&opts, width, height, band_budget);
+        double start = T_Now();
+        if (!renderBanded(&model, width, height, &opts, rows, output))
+            result = -1;
+        double elapsed = T_Now() - start;
+        fprintf(stderr, "# render and write %.3f ms, %d bands of %d rows, %s shading, %.2f Mfaces/s\n",
+                elapsed * 1e3, (height + rows - 1) / rows, rows, shadeRateNames[shadeRate(&opts, &model, width, height)],
+                model.nfaces / elapsed * 1e-6);
+    } else if (budget > 0.0) {
+        TGA_Image image = TGA_ImageInit(width, height, RGB);
+        struct progress_output out = { .filename = output, .start = T_Now() };
+        if (!image.data || !renderProgressive(&model, &image, &opts, budget, progressWrite, &out))
+            result = -1;
+        TGA_ImageDelete(&image);
+    } else {
+        TGA_Mapping map = {0};
+        TGA_Image owned = {0};
+        TGA_Image *image = &owned;
+        if (mapped) {
+            if (TGA_ImageMapFile(&map, output, width, height, RGB))
+                image = &map.image;
+        } else {
+            owned = TGA_ImageInit(width, height, RGB);
+        }
 
-    if (2 == argc)
-        ModelInit(&model, argv[1]);
-    else
-        ModelInit(&model, "obj/african_head.obj");
+        if (!image->data) {
+            result = -1;
+        } else {
+            double start = T_Now();
+            bool drawn;
+            if (supersample > 1) {
+                TGA_Image large = TGA_ImageInit(width * supersample, height * supersample, RGB);
+                drawn = large.data != NULL;
+                if (drawn && is_scene)
+                    drawn = renderScene(&scene, &large, &opts);
+                else if (drawn)
+                    drawn = render(&model, &large, &opts);
+                drawn = drawn && IOP_Resize(&large, image, IOP_BOX);
+                TGA_ImageDelete(&large);
+            } else if (is_scene) {
+                drawn = renderScene(&scene, image, &opts);
+            } else {
+                drawn = render(&model, image, &opts);
+            }
+            double elapsed = T_Now() - start;
+            // scene instances each pick their own rate
+            enum shade_rate rate = is_scene ? opts.shading : shadeRate(&opts, &model, width * supersample, height * supersample);
+            if (!drawn) {
+                fprintf(stderr, "Can't allocate the buffers for a %dx%d render\n", width * supersample, height * supersample);
+                result = -1;
+            } else {
+                fprintf(stderr, "# render %.3f ms, %s shading, %.2f Mfaces/s\n", elapsed * 1e3,
+                        shadeRateNames[rate], (is_scene ? SC_Faces(&scene) : model.nfaces) / elapsed * 1e-6);
+                if (!mapped && !IMG_WriteFile(image, output))
+                    result = -1;
+            }
+        }
 
-    TGA_Image image = TGA_ImageInit(width, height, RGB);
-    render(&model, &image);
-    TGA_ImageWriteFile(&image, "output.tga", true);
+        TGA_ImageUnmapFile(&map);
+        TGA_ImageDelete(&owned);
+    }
 
-    TGA_ImageDelete(&image);
-    ModelDelete(&model);
-    return 0;
+    if (is_scene)
+        SC_Delete(&scene);
+    else
+        ModelDelete(&model);
+    TC_Flush();
+    if (trace) {
+        PF_Report(stderr);
+        JS_Report(stderr);
+        if (!PF_WriteTrace(trace))
+            result = -1;
+    }
+    return result;
 }
@@ -1,48 +1,146 @@
+#include <pthread.h>
 #include "model.h"
+#include "jobs.h"
 
+struct texture_job {
+    char filename[512];
+    struct tc_entry *entry;
+    double time;
+};
+
+static
+void
+ModelLoadTexture(void *arg, long i0, long i1)
+{
+    (void)i0;
+    (void)i1;
+    struct texture_job *job = (struct texture_job *)arg;
+    double start = T_Now();
+
+    job->entry = TC_Acquire(job->filename);
+
+    job->time = T_Now() - start;
+}
+
+static void ModelDelete(struct model *model);
+static void ModelFreeLists(struct model *model);
+
+static
+v3f *
+ModelFlattenList(struct ll_v3f *list, int *count)
+{
+    *count = LL_V3F_Len(list);
+    v3f *result = (v3f *)malloc(sizeof(v3f) * (*count + 1));
+    if (!result)
+        return NULL;
+
+    struct ll_v3f *entry;
+    int i = 0;
+    LIST_FOR_EACH_ENTRY(entry, &list->head, head)
+        result[i++] = entry->vec;
+    return result;
+}
+
+/**
+ * ModelBuildArrays - copy the parsed lists into the flat arrays
+ *
+ * Also checks that every face only refers to existing v/vt entries; vn is
+ * optional and checked only where it's given.
+ */
+static
+int
+ModelBuildArrays(struct model *model)
+{
+    model->verts = ModelFlattenList(&model->verts_, &model->nverts);
+    model->uvs = ModelFlattenList(&model->textures_, &model->nuvs);
+    model->norms = ModelFlattenList(&model->normals_, &model->nnorms);
+
+    int nfaces = 0;
+    struct ll_face_node *face;
+    LIST_FOR_EACH_ENTRY(face, &model->faces_.list.head, head)
+        nfaces++;
+    model->nfaces = nfaces;
+    model->faces = (v3i *)malloc(sizeof(v3i) * 3 * (nfaces + 1));
+    if (!model->verts || !model->uvs || !model->norms || !model->faces)
+        return MODEL_ERR_MEMORY;
+
+    v3i *dst = model->faces;
+    LIST_FOR_EACH_ENTRY(face, &model->faces_.list.head, head) {
+        for (int j = 0; j < 3; j++, dst++) {
+            *dst = face->indexes[j];
+            if (dst->ivert < 1 || dst->ivert > model->nverts
+                    || dst->iuv < 1 || dst->iuv > model->nuvs
+                    || dst->inorm < 0 || dst->inorm > model->nnorms)
+                return MODEL_ERR_FORMAT;
+        }
+    }
+    return MODEL_OK;
+}
+
+/**
+ * ModelInit - load an OBJ file and its <name>_diffuse.tga texture
+ *
+ * The texture is fetched from the shared texture cache, decoding it if
+ * needed, in a task of the job system while the OBJ is parsed.
+ * Returns MODEL_OK, or a model_error after releasing everything; the model
+ * must not be passed to ModelDelete in that case.
+ */
 static
 int
 ModelInit(struct model *model, const char *filename)
 {
+    double start = T_Now();
     memset(model, 0, sizeof(struct model));
     FILE *file = fopen(filename, "r");
     if (file == NULL)
-        return -1;
+        return MODEL_ERR_OPEN;
+    pthread_mutex_init(&model->edges_lock, NULL);
+
+    struct texture_job job = {0};
+    const char *ext = strrchr(filename, '.');
+    if (!ext || strchr(ext, '/'))
+        ext = filename + strlen(filename);
+    snprintf(job.filename, sizeof(job.filename), "%.*s_diffuse.tga", (int)(ext - filename), filename);
+
+    struct js_job loader = {0};
+    JS_Spawn(&loader, ModelLoadTexture, &job);
 
     char line[256];
 
+    struct pf_span parse = PF_Begin("parse");
     LL_V3F_Init(&model->verts_);
     LL_V3F_Init(&model->textures_);
     LL_V3F_Init(&model->normals_);
     LL_Face_Init(&model->faces_);
 
     while (fgets(line, 256, file)) {
-        char *tok = strtok(line, " ");
+        char *save;
+        char *tok = strtok_r(line, " ", &save);
         if (strncmp(tok, "vt", 2) == 0) {
             v3f data = {0};
             for (int i = 0; i < 3; i++) {
-                tok = strtok(NULL, " ");
+                tok = strtok_r(NULL, " ", &save);
                 data.raw[i] = atof(tok);
             }
             LL_V3F_AddEntry(&model->textures_, data);
         } else if (strncmp(tok, "vn", 2) == 0) {
             v3f data = {0};
             for (int i = 0; i < 3; i++) {
-                tok = strtok(NULL, " ");
+                tok = strtok_r(NULL, " ", &save);
                 data.raw[i] = atof(tok);
             }
             LL_V3F_AddEntry(&model->normals_, data);
         } else if (strncmp(tok, "v", 1) == 0) {
             v3f data = {0};
             for (int i = 0; i < 3; i++) {
-                tok = strtok(NULL, " ");
+                tok = strtok_r(NULL, " ", &save);
                 data.raw[i] = atof(tok);
             }
             LL_V3F_AddEntry(&model->verts_, data);
         } else if (strncmp(tok, "f", 1) == 0) {
             v3i data[3];
             for (int i = 0; i < 3; i++) {
-                tok = strtok(NULL, " ");
+                tok = strtok_r(NULL, " ", &save);
 
                 int j,k;
                 char subtok[16];
@@ -65,28 +163,56 @@ ModelInit(struct model *model, const char *filename)
             LL_Face_AddEntry(&model->faces_, data);
         }
     }
-    
-    char texture_filename[128];
-    for (int i = 0; i < 127 && filename[i] != '.'; i++) {
-        texture_filename[i] = filename[i];
-        texture_filename[i+1] = '\0';
+    fclose(file);
+    model->load_stats.parse = T_Now() - start;
+    PF_End(&parse);
+
+    JS_Wait(&loader);
+    model->texture_entry = job.entry;
+    if (job.entry) {
+        model->texture = job.entry->image;
+        if (job.entry->compressed.blocks)
+            model->compressed = &job.entry->compressed;
     }
-    strcat(texture_filename, "_diffuse.tga");
+    model->load_stats.texture = job.time;
+    model->load_stats.total = T_Now() - start;
 
-    // quit out if the texture doesn't exist; we only do with textures
-    if (access(texture_filename, F_OK) == -1)
-        exit(-1);
-    TGA_ImageReadFile(&model->texture, texture_filename);
-    TGA_ImageFlipVertically(&model->texture);
+    // we only do textured models
+    if (!job.entry) {
+        fprintf(stderr, "Can't load the texture %s\n", job.filename);
+        ModelDelete(model);
+        return MODEL_ERR_TEXTURE;
+    }
 
-    fclose(file);
-    fprintf(stderr, "# v# %d vt# %d\n", LL_V3F_Len(&model->verts_), LL_V3F_Len(&model->textures_));
-    return 0;
+    int result = ModelBuildArrays(model);
+    if (result != MODEL_OK) {
+        fprintf(stderr, "Bad model data in %s\n", filename);
+        ModelDelete(model);
+        return result;
+    }
+    ModelFreeLists(model);
+    return MODEL_OK;
 }
 
+/**
+ * ModelReport - texture size, element counts and load times of @model
+ *
+ * Left to the programs, ModelInit itself prints nothing but errors so the
+ * library stays quiet on its host's stderr.
+ */
 static
 void
-ModelDelete(struct model *model)
+ModelReport(const struct model *model, FILE *file)
+{
+    fprintf(file, "%dx%d/%d\n", model->texture.width, model->texture.height, model->texture.bytespp * 8);
+    fprintf(file, "# v# %d vt# %d\n", model->nverts, model->nuvs);
+    fprintf(file, "# load %.3f ms: parse %.3f ms, texture %.3f ms\n",
+            model->load_stats.total * 1e3, model->load_stats.parse * 1e3, model->load_stats.texture * 1e3);
+}
+
+static
+void
+ModelFreeLists(struct model *model)
 {
     while (!L_ListEmpty(&model->verts_.head)) {
         struct ll_v3f *del = LIST_ENTRY(model->verts_.head.next, struct ll_v3f, head);
@@ -108,6 +234,219 @@ ModelDelete(struct model *model)
         L_ListDel(&del->head);
         free(del);
     }
+}
+
+static
+void
+ModelDelete(struct model *model)
+{
+    ModelFreeLists(model);
+    free(model->verts);
+    free(model->uvs);
+    free(model->norms);
+    free(model->faces);
+    free(model->edges);
+    free(model->packed.verts);
+    free(model->packed.uvs);
+    free(model->packed.norms);
+    memset(&model->packed, 0, sizeof(model->packed));
+    model->verts = model->uvs = model->norms = NULL;
+    model->faces = NULL;
+    model->edges = NULL;
+    model->nverts = model->nuvs = model->nnorms = model->nfaces = model->nedges = 0;
+    pthread_mutex_destroy(&model->edges_lock);
+
+    if (model->texture_entry)
+        TC_Release(model->texture_entry);
+    model->texture_entry = NULL;
+    model->compressed = NULL;
+    memset(&model->texture, 0, sizeof(TGA_Image));
+}
+
+/**
+ * ModelBytes - memory held by the model's geometry
+ *
+ * The texture lives in the texture cache and isn't counted.
+ */
+static
+unsigned long
+ModelBytes(const struct model *model)
+{
+    unsigned long result = sizeof(v3i) * 3 * (unsigned long)model->nfaces
+                         + sizeof(v2i) * (unsigned long)model->nedges;
+    if (model->packed.verts) {
+        result += sizeof(model->packed.verts[0]) * (unsigned long)model->nverts
+                + sizeof(model->packed.uvs[0]) * (unsigned long)model->nuvs
+                + sizeof(model->packed.norms[0]) * (unsigned long)model->nnorms;
+    } else {
+        result += sizeof(v3f) * (unsigned long)(model->nverts + model->nuvs + model->nnorms);
+    }
+    return result;
+}
+
+static inline
+unsigned short
+ModelQuantize(float v, float origin, float inv_scale)
+{
+    return (unsigned short)MIN(MAX(lrintf((v - origin) * inv_scale), 0), 65535);
+}
+
+/**
+ * ModelCompact - replace the float geometry with its quantized form
+ *
+ * See struct model_packed for the precision. Degenerate normals come back
+ * as +z. Must be done before the model is shared between threads. Returns
+ * MODEL_OK, or MODEL_ERR_MEMORY leaving the model as it was.
+ */
+static
+int
+ModelCompact(struct model *model)
+{
+    struct model_packed *p = &model->packed;
+    if (p->verts)
+        return MODEL_OK;
+
+    p->verts = malloc(sizeof(p->verts[0]) * MAX(model->nverts, 1));
+    p->uvs = malloc(sizeof(p->uvs[0]) * MAX(model->nuvs, 1));
+    p->norms = malloc(sizeof(p->norms[0]) * MAX(model->nnorms, 1));
+    if (!p->verts || !p->uvs || !p->norms) {
+        free(p->verts);
+        free(p->uvs);
+        free(p->norms);
+        memset(p, 0, sizeof(*p));
+        return MODEL_ERR_MEMORY;
+    }
+
+    v3f lo = V3_float(FLT_MAX, FLT_MAX, FLT_MAX), hi = V3_float(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (int i = 0; i < model->nverts; i++) {
+        for (int k = 0; k < 3; k++) {
+            lo.raw[k] = MIN(lo.raw[k], model->verts[i].raw[k]);
+            hi.raw[k] = MAX(hi.raw[k], model->verts[i].raw[k]);
+        }
+    }
+    for (int k = 0; k < 3 && model->nverts; k++) {
+        p->vorigin.raw[k] = lo.raw[k];
+        p->vscale.raw[k] = (hi.raw[k] - lo.raw[k]) / 65535.0f;
+    }
+    for (int i = 0; i < model->nverts; i++) {
+        for (int k = 0; k < 3; k++) {
+            float inv = p->vscale.raw[k] > 0.0f ? 1.0f / p->vscale.raw[k] : 0.0f;
+            p->verts[i][k] = ModelQuantize(model->verts[i].raw[k], p->vorigin.raw[k], inv);
+        }
+    }
+
+    v2f tlo = V2_float(FLT_MAX, FLT_MAX), thi = V2_float(-FLT_MAX, -FLT_MAX);
+    for (int i = 0; i < model->nuvs; i++) {
+        tlo = V2_float(MIN(tlo.x, model->uvs[i].x), MIN(tlo.y, model->uvs[i].y));
+        thi = V2_float(MAX(thi.x, model->uvs[i].x), MAX(thi.y, model->uvs[i].y));
+    }
+    if (model->nuvs) {
+        p->torigin = tlo;
+        p->tscale = V2_float((thi.x - tlo.x) / 65535.0f, (thi.y - tlo.y) / 65535.0f);
+    }
+    for (int i = 0; i < model->nuvs; i++) {
+        p->uvs[i][0] = ModelQuantize(model->uvs[i].x, p->torigin.x, p->tscale.x > 0.0f ? 1.0f / p->tscale.x : 0.0f);
+        p->uvs[i][1] = ModelQuantize(model->uvs[i].y, p->torigin.y, p->tscale.y > 0.0f ? 1.0f / p->tscale.y : 0.0f);
+    }
+
+    // octahedral: project onto |x|+|y|+|z| = 1, fold the lower half out
+    for (int i = 0; i < model->nnorms; i++) {
+        v3f n = model->norms[i];
+        float sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+        float x = sum > 0.0f ? n.x / sum : 0.0f;
+        float y = sum > 0.0f ? n.y / sum : 0.0f;
+        if (n.z < 0.0f) {
+            float t = x;
+            x = copysignf(1.0f - fabsf(y), t);
+            y = copysignf(1.0f - fabsf(t), y);
+        }
+        p->norms[i][0] = (short)lrintf(MIN(MAX(x, -1.0f), 1.0f) * 32767.0f);
+        p->norms[i][1] = (short)lrintf(MIN(MAX(y, -1.0f), 1.0f) * 32767.0f);
+    }
+
+    free(model->verts);
+    free(model->uvs);
+    free(model->norms);
+    model->verts = model->uvs = model->norms = NULL;
+    return MODEL_OK;
+}
+
+static
+int
+ModelCompareInt(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * ModelEdges - the unique edges of the model's faces
+ * @count: set to the number of edges
+ *
+ * Built on the first call with a counting sort on the lower vertex index,
+ * so shared edges come out once, then kept with the model. Safe to call
+ * from several threads. Returns NULL if it runs out of memory.
+ */
+static
+const v2i *
+ModelEdges(struct model *model, int *count)
+{
+    pthread_mutex_lock(&model->edges_lock);
+    if (model->edges || !model->nfaces) {
+        *count = model->nedges;
+        pthread_mutex_unlock(&model->edges_lock);
+        return model->edges;
+    }
+
+    const int n = model->nverts;
+    const long nslots = (long)model->nfaces * 3;
+    int *start = (int *)calloc(n + 1, sizeof(int));
+    int *his = (int *)malloc(sizeof(int) * nslots);
+    v2i *edges = (v2i *)malloc(sizeof(v2i) * nslots);
+    if (!start || !his || !edges)
+        goto out;
+
+    // bucket the higher index of every edge by its lower index
+    for (long i = 0; i < nslots; i++) {
+        int a = model->faces[i].ivert - 1;
+        int b = model->faces[i - i % 3 + (i + 1) % 3].ivert - 1;
+        start[MIN(a, b) + 1]++;
+    }
+    for (int v = 0; v < n; v++)
+        start[v + 1] += start[v];
+    int *fill = (int *)malloc(sizeof(int) * (n + 1));
+    if (!fill)
+        goto out;
+    memcpy(fill, start, sizeof(int) * (n + 1));
+    for (long i = 0; i < nslots; i++) {
+        int a = model->faces[i].ivert - 1;
+        int b = model->faces[i - i % 3 + (i + 1) % 3].ivert - 1;
+        his[fill[MIN(a, b)]++] = MAX(a, b);
+    }
+    free(fill);
+
+    int nedges = 0;
+    for (int v = 0; v < n; v++) {
+        int *bucket = his + start[v];
+        int k = start[v + 1] - start[v];
+        qsort(bucket, k, sizeof(int), ModelCompareInt);
+        for (int i = 0; i < k; i++) {
+            if (i && bucket[i] == bucket[i - 1]) continue;
+            if (bucket[i] == v) continue;
+            edges[nedges++] = V2_int(v, bucket[i]);
+        }
+    }
+
+    v2i *shrunk = (v2i *)realloc(edges, sizeof(v2i) * MAX(nedges, 1));
+    model->edges = shrunk ? shrunk : edges;
+    model->nedges = nedges;
+    edges = NULL;
 
-    TGA_ImageDelete(&model->texture);
+out:
+    free(start);
+    free(his);
+    free(edges);
+    *count = model->nedges;
+    pthread_mutex_unlock(&model->edges_lock);
+    return model->edges;
 }
@@ -88,14 +88,112 @@ LL_Face_AddEntry(struct ll_face *list, v3i data[3])
     return 0;
 }
 
+enum model_error {
+    MODEL_OK = 0,
+    MODEL_ERR_OPEN = -1,        // the OBJ file can't be opened
+    MODEL_ERR_TEXTURE = -2,     // the _diffuse.tga is missing or unreadable
+    MODEL_ERR_FORMAT = -4,      // a face refers to a missing v/vt/vn
+    MODEL_ERR_MEMORY = -5,
+};
+
+/* Wall clock seconds spent by ModelInit. The texture is decoded on its own
+ * thread while the OBJ is parsed, so total is less than parse + texture. */
+struct model_load_stats {
+    double parse;
+    double texture;
+    double total;
+};
+
+/* Quantized geometry from ModelCompact, replacing the float arrays. Each
+ * position component is a 16-bit step of its bounding box, off by at most
+ * extent / 131070 (plus float rounding); uvs the same within their own
+ * box. Normals are unit vectors folded onto an octahedron with 16 bits per
+ * axis, off by less than 0.05 degrees. A vertex drops from 12 to 6 bytes,
+ * a uv and a normal from 12 to 4. */
+struct model_packed {
+    v3f vorigin;                // position = vorigin + q * vscale
+    v3f vscale;
+    v2f torigin;                // uv = torigin + q * tscale
+    v2f tscale;
+    unsigned short (*verts)[3];
+    unsigned short (*uvs)[2];
+    short (*norms)[2];
+};
+
 struct model {
     struct ll_v3f verts_;
     struct ll_v3f textures_;
     struct ll_v3f normals_;
     struct ll_face faces_;
 
-    TGA_Image texture;
+    // contiguous copies of the lists above for O(1) lookups while
+    // rendering, the lists are emptied once these are built; 0-based, while
+    // the OBJ indexes stored in faces are 1-based. Use ModelVertex, ModelUV
+    // and ModelNormal, these are NULL once the model is packed.
+    v3f *verts;
+    v3f *uvs;
+    v3f *norms;
+    v3i *faces;                 // 3 per face
+    int nverts;
+    int nuvs;
+    int nnorms;
+    int nfaces;
+    struct model_packed packed;
+
+    // unique (lo, hi) 0-based vertex pairs, built on first use by ModelEdges
+    v2i *edges;
+    int nedges;
+    pthread_mutex_t edges_lock;
+
+    TGA_Image texture;          // read-only view of the cached texture
+    const struct bc_texture *compressed;    // when set, texture only has the size
+    struct tc_entry *texture_entry;
+    struct model_load_stats load_stats;
 };
 
+static inline
+v3f
+ModelVertex(const struct model *model, int i)
+{
+    if (!model->packed.verts)
+        return model->verts[i];
+    const unsigned short *q = model->packed.verts[i];
+    const struct model_packed *p = &model->packed;
+    return V3_float(p->vorigin.x + q[0] * p->vscale.x,
+                    p->vorigin.y + q[1] * p->vscale.y,
+                    p->vorigin.z + q[2] * p->vscale.z);
+}
+
+static inline
+v2f
+ModelUV(const struct model *model, int i)
+{
+    if (!model->packed.uvs)
+        return V2_float(model->uvs[i].x, model->uvs[i].y);
+    const unsigned short *q = model->packed.uvs[i];
+    const struct model_packed *p = &model->packed;
+    return V2_float(p->torigin.x + q[0] * p->tscale.x, p->torigin.y + q[1] * p->tscale.y);
+}
+
+/**
+ * ModelNormal - vertex normal @i, unit length once packed
+ */
+static inline
+v3f
+ModelNormal(const struct model *model, int i)
+{
+    if (!model->packed.norms)
+        return model->norms[i];
+    float x = model->packed.norms[i][0] / 32767.0f;
+    float y = model->packed.norms[i][1] / 32767.0f;
+    float z = 1.0f - fabsf(x) - fabsf(y);
+    if (z < 0.0f) {
+        float t = x;
+        x = copysignf(1.0f - fabsf(y), t);
+        y = copysignf(1.0f - fabsf(t), y);
+    }
+    return NormV3_float(V3_float(x, y, z));
+}
+
 #define _MODEL_h_
 #endif
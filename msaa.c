@@ -0,0 +1,194 @@
+#include "msaa.h"
+
+/* Sample offsets from the pixel center, in 1/16th of a pixel. These are
+ * the usual rotated/sparse grid patterns for 4x and 8x. */
+static const signed char MSAA_Pattern4[4][2] = {
+    {-2, -6}, { 6, -2}, {-6,  2}, { 2,  6}
+};
+
+static const signed char MSAA_Pattern8[8][2] = {
+    { 1, -3}, {-1,  3}, { 5,  1}, {-3, -5},
+    {-5,  5}, {-7, -1}, { 3,  7}, { 7, -7}
+};
+
+static
+bool
+MSAA_BufferInit(struct msaa_buffer *buffer, int w, int h, int samples)
+{
+    if (samples != 1 && samples != 4 && samples != 8)
+        return false;
+
+    unsigned long n = (unsigned long)w * h * samples;
+    buffer->width = w;
+    buffer->height = h;
+    buffer->samples = samples;
+    buffer->top = 0;
+    buffer->depth = (float *)malloc(sizeof(float) * n);
+    buffer->color = (unsigned int *)calloc(n, sizeof(unsigned int));
+    if (!buffer->depth || !buffer->color) {
+        free(buffer->depth);
+        free(buffer->color);
+        memset(buffer, 0, sizeof(struct msaa_buffer));
+        return false;
+    }
+
+    RK_ClearDepth(buffer->depth, n);
+    return true;
+}
+
+/**
+ * MSAA_BufferClear - reset every sample, to reuse the buffer for a band
+ */
+static
+void
+MSAA_BufferClear(struct msaa_buffer *buffer)
+{
+    unsigned long n = (unsigned long)buffer->width * buffer->height * buffer->samples;
+    RK_ClearDepth(buffer->depth, n);
+    memset(buffer->color, 0, sizeof(unsigned int) * n);
+}
+
+static
+void
+MSAA_BufferDelete(struct msaa_buffer *buffer)
+{
+    free(buffer->depth);
+    free(buffer->color);
+    memset(buffer, 0, sizeof(struct msaa_buffer));
+}
+
+static inline
+float
+MSAA_Edge(v3f a, v3f b, float px, float py)
+{
+    return (b.x - a.x) * (py - a.y) - (b.y - a.y) * (px - a.x);
+}
+
+/**
+ * MSAA_TextureMap - rasterize one textured triangle into the buffer
+ * @buffer: multisample target
+ * @tri: screen space positions (subpixel precision is kept), texel
+ *       coordinates, texture and lighting
+ * @flags: RASTER_LIT, optionally with RASTER_GOURAUD or RASTER_PHONG, and
+ *         RASTER_COMPRESSED to sample tri->compressed
+ *
+ * Coverage and the depth test are done per sample; the texture is sampled
+ * and lit once per pixel at the centroid of the covered samples, which
+ * always lies inside the triangle. Flat lighting is applied when positive.
+ */
+static
+void
+MSAA_TextureMap(struct msaa_buffer *buffer, const struct raster_tri *tri, int flags)
+{
+    const v3f *s_pts = tri->s;
+    const v2f *t_pts = tri->t;
+    TGA_Image *texture = (TGA_Image *)tri->texture;
+    const struct bc_texture *compressed = (flags & RASTER_COMPRESSED) ? tri->compressed : NULL;
+    const bool lit = flags & RASTER_LIT;
+    const int smooth = lit ? flags & (RASTER_GOURAUD | RASTER_PHONG) : 0;
+
+    float area = MSAA_Edge(s_pts[0], s_pts[1], s_pts[2].x, s_pts[2].y);
+    if (fabsf(area) < 1e-6f)
+        return;
+    float inv_area = 1.0f / area;
+
+    const signed char (*pattern)[2] = (buffer->samples == 8) ? MSAA_Pattern8 : MSAA_Pattern4;
+    const int samples = buffer->samples;
+
+    float minx = FLT_MAX, miny = FLT_MAX, maxx = -FLT_MAX, maxy = -FLT_MAX;
+    for (int i = 0; i < 3; i++) {
+        minx = MIN(minx, s_pts[i].x);
+        miny = MIN(miny, s_pts[i].y);
+        maxx = MAX(maxx, s_pts[i].x);
+        maxy = MAX(maxy, s_pts[i].y);
+    }
+    int x0 = MAX(0,                  (int)floorf(minx - 0.5f));
+    int y0 = MAX(buffer->top,        (int)floorf(miny - 0.5f));
+    int x1 = MIN(buffer->width - 1,  (int)ceilf(maxx + 0.5f));
+    int y1 = MIN(buffer->top + buffer->height - 1, (int)ceilf(maxy + 0.5f));
+
+    for (int y = y0; y <= y1; y++) {
+        for (int x = x0; x <= x1; x++) {
+            unsigned long base = ((unsigned long)(y - buffer->top) * buffer->width + x) * samples;
+            unsigned int mask = 0;
+            int covered = 0;
+            v3f bc_sum = V3_float(0.0f, 0.0f, 0.0f);
+
+            for (int k = 0; k < samples; k++) {
+                float px = x + pattern[k][0] / 16.0f;
+                float py = y + pattern[k][1] / 16.0f;
+                v3f bc = V3_float(
+                        MSAA_Edge(s_pts[1], s_pts[2], px, py) * inv_area,
+                        MSAA_Edge(s_pts[2], s_pts[0], px, py) * inv_area,
+                        0.0f);
+                bc.z = 1.0f - bc.x - bc.y;
+                if (bc.x < 0 || bc.y < 0 || bc.z < 0) continue;
+
+                float z = bc.x * s_pts[0].z + bc.y * s_pts[1].z + bc.z * s_pts[2].z;
+                if (buffer->depth[base + k] < z) {
+                    buffer->depth[base + k] = z;
+                    mask |= 1u << k;
+                    bc_sum = AddV3_float(bc_sum, bc);
+                    covered++;
+                }
+            }
+            if (!mask) continue;
+
+            v3f bc = MulV3_float(1.0f / covered, bc_sum);
+            v2i texture_pts = V2_int(
+                    bc.x * t_pts[0].x + bc.y * t_pts[1].x + bc.z * t_pts[2].x,
+                    bc.x * t_pts[0].y + bc.y * t_pts[1].y + bc.z * t_pts[2].y);
+            TGA_Color color = compressed ? BC_Get(compressed, texture_pts.x, texture_pts.y)
+                                         : TGA_ImageGet(texture, texture_pts.x, texture_pts.y);
+            float intensity = smooth ? RK_SmoothIntensity(tri, smooth, bc) : tri->intensity;
+            if (lit && (smooth || intensity > 0.0f)) {
+                color = TGA_ColorInit(
+                        intensity * color.r,
+                        intensity * color.g,
+                        intensity * color.b,
+                        color.a);
+            }
+
+            for (int k = 0; k < samples; k++) {
+                if (mask & (1u << k))
+                    buffer->color[base + k] = color.val;
+            }
+        }
+    }
+}
+
+/**
+ * MSAA_Resolve - average the samples of each pixel into an image
+ * @buffer: multisample source
+ * @image: destination, must have the same dimensions as the buffer
+ */
+static
+bool
+MSAA_Resolve(struct msaa_buffer *buffer, TGA_Image *image)
+{
+    if (!image->data || image->width != buffer->width || image->height != buffer->height)
+        return false;
+
+    struct pf_span span = PF_Begin("resolve");
+    const int samples = buffer->samples;
+    for (int y = 0; y < buffer->height; y++) {
+        for (int x = 0; x < buffer->width; x++) {
+            unsigned long base = ((unsigned long)y * buffer->width + x) * samples;
+            unsigned int sum[4] = {0};
+            for (int k = 0; k < samples; k++) {
+                TGA_Color s = { .val = buffer->color[base + k] };
+                for (int t = 0; t < 4; t++)
+                    sum[t] += s.raw[t];
+            }
+
+            TGA_Color c;
+            for (int t = 0; t < 4; t++)
+                c.raw[t] = (sum[t] + samples / 2) / samples;
+            c.bytespp = 4;
+            TGA_ImageSet(image, x, y, c);
+        }
+    }
+    PF_End(&span);
+
+    return true;
+}
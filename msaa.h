@@ -0,0 +1,30 @@
+/**
+ * Multisample buffer used for anti-aliased rendering.
+ *
+ * Every pixel stores `samples` coverage/depth samples, but the texture
+ * lookup and lighting are only evaluated once per pixel per triangle and
+ * the result is copied to every sample the triangle covers. The buffer is
+ * resolved into a TGA_Image by averaging the samples of each pixel.
+ *
+ * Memory per pixel (4 bytes color + 4 bytes depth per sample):
+ *      1x  ->  8 bytes  (plain z-buffer + RGBA color)
+ *      4x  -> 32 bytes
+ *      8x  -> 64 bytes
+ * compared with 112 bytes per output pixel (16 samples of RGB + depth) and
+ * 16x the shading work when rendering at 4x width/height and downsampling.
+ */
+#ifndef _MSAA_h_
+
+#define MSAA_MAX_SAMPLES 8
+
+struct msaa_buffer {
+    int width;
+    int height;
+    int samples;
+    int top;            // frame row of the first row, like raster_target
+    float *depth;
+    unsigned int *color;
+};
+
+#define _MSAA_h_
+#endif
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include "prof.h"
+
+static struct profiler PF_Profiler = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static pthread_key_t PF_ThreadKey;
+static pthread_once_t PF_ThreadKeyOnce = PTHREAD_ONCE_INIT;
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} PF_Counters[PF_NCOUNTERS] = {
+    [PF_CYCLES]         = { "cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PF_INSTRUCTIONS]   = { "instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PF_L1D_MISSES]     = { "l1d_misses",    PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                                                 | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                                                 | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    [PF_LLC_MISSES]     = { "llc_misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PF_BRANCH_MISSES]  = { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+static
+void
+PF_ThreadDelete(void *arg)
+{
+    struct pf_thread *thread = (struct pf_thread *)arg;
+    for (int i = 0; i < PF_NCOUNTERS; i++) {
+        if (thread->fds[i] != -1)
+            close(thread->fds[i]);
+    }
+    free(thread);
+}
+
+static
+void
+PF_ThreadKeyInit(void)
+{
+    pthread_key_create(&PF_ThreadKey, PF_ThreadDelete);
+}
+
+/**
+ * PF_Thread - counters of the calling thread, opened on first use
+ *
+ * Returns NULL when out of memory.
+ */
+static
+struct pf_thread *
+PF_Thread(void)
+{
+    pthread_once(&PF_ThreadKeyOnce, PF_ThreadKeyInit);
+    struct pf_thread *thread = (struct pf_thread *)pthread_getspecific(PF_ThreadKey);
+    if (thread)
+        return thread;
+
+    thread = (struct pf_thread *)malloc(sizeof(struct pf_thread));
+    if (!thread)
+        return NULL;
+    thread->tid = (int)syscall(SYS_gettid);
+    for (int i = 0; i < PF_NCOUNTERS; i++) {
+        // user space only, which a perf_event_paranoid of 2 still allows
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PF_Counters[i].type;
+        attr.config = PF_Counters[i].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        thread->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+    pthread_setspecific(PF_ThreadKey, thread);
+    return thread;
+}
+
+static
+unsigned int
+PF_Read(uint64_t counters[PF_NCOUNTERS])
+{
+    struct pf_thread *thread = PF_Thread();
+    unsigned int valid = 0;
+    for (int i = 0; thread && i < PF_NCOUNTERS; i++) {
+        if (thread->fds[i] != -1 && read(thread->fds[i], &counters[i], sizeof(uint64_t)) == sizeof(uint64_t))
+            valid |= 1u << i;
+    }
+    return valid;
+}
+
+/**
+ * PF_Enable - start recording spans
+ *
+ * Says on stderr which counters the calling thread can't read.
+ */
+static
+void
+PF_Enable(void)
+{
+    PF_Profiler.origin = T_Now();
+    PF_Profiler.enabled = true;
+
+    struct pf_thread *thread = PF_Thread();
+    char missing[128] = "";
+    for (int i = 0; thread && i < PF_NCOUNTERS; i++) {
+        if (thread->fds[i] == -1)
+            snprintf(missing + strlen(missing), sizeof(missing) - strlen(missing), " %s", PF_Counters[i].name);
+    }
+    if (missing[0])
+        fprintf(stderr, "# profile: no%s counters, timestamps only for those\n", missing);
+}
+
+static
+struct pf_span
+PF_Begin(const char *name)
+{
+    struct pf_span span = {0};
+    if (!PF_Profiler.enabled)
+        return span;
+    span.name = name;
+    span.valid = PF_Read(span.counters);
+    span.start = T_Now();
+    return span;
+}
+
+static
+void
+PF_End(const struct pf_span *span)
+{
+    if (!span->name)
+        return;
+    struct pf_event event = { .name = span->name, .start = span->start, .end = T_Now() };
+    event.valid = PF_Read(event.counters) & span->valid;
+    for (int i = 0; i < PF_NCOUNTERS; i++)
+        event.counters[i] = (event.valid & (1u << i)) ? event.counters[i] - span->counters[i] : 0;
+    struct pf_thread *thread = PF_Thread();
+    event.tid = thread ? thread->tid : 0;
+
+    pthread_mutex_lock(&PF_Profiler.lock);
+    if (PF_Profiler.nevents == PF_Profiler.capacity) {
+        long capacity = MAX(256, PF_Profiler.capacity * 2);
+        struct pf_event *events = realloc(PF_Profiler.events, sizeof(struct pf_event) * capacity);
+        if (!events) {
+            pthread_mutex_unlock(&PF_Profiler.lock);
+            return;
+        }
+        PF_Profiler.events = events;
+        PF_Profiler.capacity = capacity;
+    }
+    PF_Profiler.events[PF_Profiler.nevents++] = event;
+    pthread_mutex_unlock(&PF_Profiler.lock);
+}
+
+/**
+ * PF_Report - totals per stage, in the order the stages first ended
+ *
+ * Misses are per thousand instructions. A column is only filled when
+ * every span of the stage had the counters it needs.
+ */
+static
+void
+PF_Report(FILE *file)
+{
+    pthread_mutex_lock(&PF_Profiler.lock);
+    fprintf(file, "# profile %-16s %6s %10s %10s %6s %8s %8s %8s\n", "stage", "spans", "ms",
+            "Mcycles", "IPC", "L1D/ki", "LLC/ki", "br/ki");
+    for (long i = 0; i < PF_Profiler.nevents; i++) {
+        const char *name = PF_Profiler.events[i].name;
+        bool seen = false;
+        for (long j = 0; j < i && !seen; j++)
+            seen = !strcmp(PF_Profiler.events[j].name, name);
+        if (seen)
+            continue;
+
+        long spans = 0;
+        double time = 0.0;
+        uint64_t totals[PF_NCOUNTERS] = {0};
+        unsigned int valid = ~0u;
+        for (long j = i; j < PF_Profiler.nevents; j++) {
+            const struct pf_event *event = &PF_Profiler.events[j];
+            if (strcmp(event->name, name))
+                continue;
+            spans++;
+            time += event->end - event->start;
+            valid &= event->valid;
+            for (int k = 0; k < PF_NCOUNTERS; k++)
+                totals[k] += event->counters[k];
+        }
+
+        // cycles, IPC, then the misses per thousand instructions
+        char columns[PF_NCOUNTERS][16];
+        const bool instructions = (valid & (1u << PF_INSTRUCTIONS)) && totals[PF_INSTRUCTIONS];
+        for (int k = 0; k < PF_NCOUNTERS; k++) {
+            const unsigned int needs = (k == PF_CYCLES) ? 1u << PF_CYCLES : (1u << k) | (1u << PF_INSTRUCTIONS);
+            snprintf(columns[k], sizeof(columns[k]), "-");
+            if ((valid & needs) != needs)
+                continue;
+            if (k == PF_CYCLES)
+                snprintf(columns[k], sizeof(columns[k]), "%.3f", totals[k] * 1e-6);
+            else if (k == PF_INSTRUCTIONS && totals[PF_CYCLES] && (valid & 1u << PF_CYCLES))
+                snprintf(columns[k], sizeof(columns[k]), "%.2f", (double)totals[k] / totals[PF_CYCLES]);
+            else if (k != PF_INSTRUCTIONS && instructions)
+                snprintf(columns[k], sizeof(columns[k]), "%.2f", totals[k] * 1e3 / totals[PF_INSTRUCTIONS]);
+        }
+        fprintf(file, "# profile %-16s %6ld %10.3f %10s %6s %8s %8s %8s\n", name, spans, time * 1e3,
+                columns[PF_CYCLES], columns[PF_INSTRUCTIONS], columns[PF_L1D_MISSES],
+                columns[PF_LLC_MISSES], columns[PF_BRANCH_MISSES]);
+    }
+    pthread_mutex_unlock(&PF_Profiler.lock);
+}
+
+/**
+ * PF_WriteTrace - write the spans as Chrome trace "complete" events
+ */
+static
+bool
+PF_WriteTrace(const char *filename)
+{
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Can't open file %s\n", filename);
+        return false;
+    }
+
+    const int pid = (int)getpid();
+    pthread_mutex_lock(&PF_Profiler.lock);
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (long i = 0; i < PF_Profiler.nevents; i++) {
+        const struct pf_event *event = &PF_Profiler.events[i];
+        fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"render\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f,\"args\":{", i ? ",\n" : "", event->name, pid, event->tid,
+                (event->start - PF_Profiler.origin) * 1e6, (event->end - event->start) * 1e6);
+        bool first = true;
+        for (int k = 0; k < PF_NCOUNTERS; k++) {
+            if (!(event->valid & (1u << k)))
+                continue;
+            fprintf(file, "%s\"%s\":%llu", first ? "" : ",", PF_Counters[k].name,
+                    (unsigned long long)event->counters[k]);
+            first = false;
+        }
+        fprintf(file, "}}");
+    }
+    fprintf(file, "\n]}\n");
+    pthread_mutex_unlock(&PF_Profiler.lock);
+
+    bool result = !ferror(file);
+    result = !fclose(file) && result;
+    return result;
+}
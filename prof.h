@@ -0,0 +1,61 @@
+/**
+ * Opt-in profiling.
+ *
+ * PF_Begin and PF_End bracket a pipeline stage on the calling thread.
+ * While profiling is on, every span records its wall clock interval and,
+ * where perf_event_open is allowed, the hardware counters of the thread
+ * over that interval: cycles, instructions, L1 data read misses, last
+ * level cache misses and branch misses. Counters that can't be opened, in
+ * most containers and VMs or with a strict perf_event_paranoid, are left
+ * out and the spans only keep their timestamps.
+ *
+ * The spans are summed per stage by PF_Report and written as a Chrome
+ * trace by PF_WriteTrace, one track per thread with the counters as the
+ * event arguments, for chrome://tracing or Perfetto.
+ */
+#ifndef _PROF_h_
+#include <pthread.h>
+#include <stdint.h>
+
+enum pf_counter {
+    PF_CYCLES,
+    PF_INSTRUCTIONS,
+    PF_L1D_MISSES,
+    PF_LLC_MISSES,
+    PF_BRANCH_MISSES,
+    PF_NCOUNTERS
+};
+
+struct pf_span {
+    const char *name;           // NULL when profiling was off at PF_Begin
+    double start;
+    uint64_t counters[PF_NCOUNTERS];
+    unsigned int valid;         // bit per counter that could be read
+};
+
+struct pf_event {
+    const char *name;           // static string, stages are told apart by it
+    int tid;
+    double start;
+    double end;
+    uint64_t counters[PF_NCOUNTERS];
+    unsigned int valid;         // bit per counter read at both ends
+};
+
+/* Per thread counter file descriptors, closed when the thread exits. */
+struct pf_thread {
+    int fds[PF_NCOUNTERS];      // -1 when not available
+    int tid;
+};
+
+struct profiler {
+    bool enabled;
+    double origin;              // T_Now() at PF_Enable, the trace's 0
+    struct pf_event *events;
+    long nevents;
+    long capacity;
+    pthread_mutex_t lock;
+};
+
+#define _PROF_h_
+#endif
@@ -0,0 +1,138 @@
+#include "raster.h"
+
+/**
+ * RK_SmoothIntensity - light intensity at barycentric @bc of a triangle
+ * @flags: RASTER_PHONG lights the interpolated normal, otherwise the
+ *         vertex intensities are interpolated
+ */
+static inline
+float
+RK_SmoothIntensity(const struct raster_tri *tri, int flags, v3f bc)
+{
+    if (flags & RASTER_PHONG) {
+        v3f n = AddV3_float(AddV3_float(MulV3_float(bc.x, tri->n[0]), MulV3_float(bc.y, tri->n[1])),
+                MulV3_float(bc.z, tri->n[2]));
+        float d = DotV3_float(n, tri->light);
+        return (d > 0.0f) ? d / sqrtf(DotV3_float(n, n)) : 0.0f;
+    }
+    return bc.x * tri->vi[0] + bc.y * tri->vi[1] + bc.z * tri->vi[2];
+}
+
+#define RK_CAT_(a, b) a##b
+#define RK_CAT(a, b) RK_CAT_(a, b)
+
+/* Returns the number of pixels it wrote. */
+typedef int (*RK_Kernel)(const struct raster_target *, const struct raster_tri *, int);
+
+/* Every kernel of one instruction set. */
+struct rk_kernels {
+    RK_Kernel generic;
+    void (*clear_depth)(float *zbuffer, long n);
+    // indexed by the raster_flags, then RGB/RGBA
+    RK_Kernel kernels[8][2];
+    // lit and depth tested smooth variants, indexed by Gouraud/Phong, then
+    // flat/textured, then RGB/RGBA
+    RK_Kernel smooth[2][2][2];
+    // depth tested variants sampling a compressed texture, indexed by
+    // unlit, flat, Gouraud and Phong lighting, then RGB/RGBA
+    RK_Kernel compressed[4][2];
+};
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#define RK_ISA(name) name##_SSE2
+#define RK_LANES 4
+#include "raster_isa.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define RK_ISA(name) name##_AVX2
+#define RK_LANES 8
+#include "raster_isa.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+#define RK_ISA(name) name##_AVX512
+#define RK_LANES 16
+#include "raster_isa.h"
+#pragma GCC pop_options
+
+/* Triangles narrower than this many pixels leave most of 16 lanes idle,
+ * with AVX-512 they take the 8 lane AVX2 kernels. */
+#define RK_WIDE 16
+
+/* Indexed by cpu_isa, then narrower than RK_WIDE or not. */
+static const struct rk_kernels *RK_Tables[CPU_NISAS][2] = {
+    [CPU_SSE2]   = { &RK_Table_SSE2, &RK_Table_SSE2 },
+    [CPU_AVX2]   = { &RK_Table_AVX2, &RK_Table_AVX2 },
+    [CPU_AVX512] = { &RK_Table_AVX2, &RK_Table_AVX512 },
+};
+
+/**
+ * RK_ClearDepth - set @n floats of a z-buffer to the far plane
+ */
+static inline
+void
+RK_ClearDepth(float *zbuffer, long n)
+{
+    RK_Tables[CPU_Isa][1]->clear_depth(zbuffer, n);
+}
+
+/**
+ * RK_Select - pick the kernel for a triangle
+ *
+ * Flat lighting is dropped for faces with a non-positive intensity, which
+ * are drawn with the unscaled color. Smooth lighting clamps at zero.
+ * Compressed textures without a depth test go through the generic kernel.
+ */
+static inline
+RK_Kernel
+RK_Select(const struct raster_target *target, const struct raster_tri *tri, int *flags)
+{
+    if (!(*flags & RASTER_LIT))
+        *flags &= ~(RASTER_GOURAUD | RASTER_PHONG);
+    if (*flags & RASTER_PHONG)
+        *flags &= ~RASTER_GOURAUD;
+    if (!(*flags & (RASTER_GOURAUD | RASTER_PHONG)) && !(tri->intensity > 0.0f))
+        *flags &= ~RASTER_LIT;
+    if (!(*flags & RASTER_TEXTURED))
+        *flags &= ~RASTER_COMPRESSED;
+    if (*flags & RASTER_COMPRESSED) {
+        if (!tri->compressed || !tri->compressed->blocks)
+            return NULL;
+    } else if ((*flags & RASTER_TEXTURED) && (!tri->texture || !tri->texture->data)) {
+        return NULL;
+    }
+    const float span = MAX(MAX(tri->s[0].x, tri->s[1].x), tri->s[2].x) - MIN(MIN(tri->s[0].x, tri->s[1].x), tri->s[2].x);
+    const struct rk_kernels *k = RK_Tables[CPU_Isa][span >= RK_WIDE];
+    if (target->bytespp != RGB && target->bytespp != RGBA)
+        return k->generic;
+    if (*flags & RASTER_COMPRESSED) {
+        if (!(*flags & RASTER_DEPTH))
+            return k->generic;
+        int lighting = !(*flags & RASTER_LIT) ? 0 : (*flags & RASTER_GOURAUD) ? 2 : (*flags & RASTER_PHONG) ? 3 : 1;
+        return k->compressed[lighting][target->bytespp == RGBA];
+    }
+    if (*flags & (RASTER_GOURAUD | RASTER_PHONG)) {
+        if (!(*flags & RASTER_DEPTH))
+            return k->generic;
+        return k->smooth[!!(*flags & RASTER_PHONG)][!!(*flags & RASTER_TEXTURED)][target->bytespp == RGBA];
+    }
+    return k->kernels[*flags & 7][target->bytespp == RGBA];
+}
+
+/**
+ * RK_Draw - rasterize one triangle
+ * @flags: raster_flags
+ *
+ * Returns the number of pixels written, that passed the depth test.
+ */
+static
+int
+RK_Draw(const struct raster_target *target, const struct raster_tri *tri, int flags)
+{
+    RK_Kernel kernel = RK_Select(target, tri, &flags);
+    return kernel ? kernel(target, tri, flags) : 0;
+}
@@ -0,0 +1,70 @@
+/**
+ * Triangle rasterizer.
+ *
+ * One kernel body (raster_kernel.h) is instantiated for every combination
+ * of flat/textured, unlit/lit, depth test off/on and RGB/RGBA target, so
+ * the per pixel loop of each variant has no feature checks left in it.
+ * Smooth lighting, interpolated vertex intensities (Gouraud) or normals
+ * lit per pixel (Phong), has its own depth tested variants, and so does
+ * sampling a block compressed texture.
+ * RK_Draw picks the variant once per triangle. A generic instantiation that
+ * reads the same switches at runtime is kept as the fallback for other
+ * target formats and as a baseline for `bench raster`.
+ *
+ * The whole set is built for every cpu_isa (raster_isa.h), testing 4, 8 or
+ * 16 pixels of a row at once, and taken from the instruction set CPU_Init
+ * picked. With AVX-512, triangles narrower than RK_WIDE use the AVX2 set.
+ *
+ * A target can hold a band of the frame, rows top to top + height - 1.
+ * Triangles keep their frame coordinates, so a band gets the same pixels
+ * as the matching rows of a whole frame render.
+ */
+#ifndef _RASTER_h_
+
+enum raster_flags {
+    RASTER_TEXTURED = 1 << 0,   // sample tri->texture, otherwise tri->color
+    RASTER_LIT      = 1 << 1,   // scale by tri->intensity when it's positive
+    RASTER_DEPTH    = 1 << 2,   // test and write target->zbuffer
+    RASTER_GOURAUD  = 1 << 3,   // with LIT, interpolate tri->vi instead
+    RASTER_PHONG    = 1 << 4,   // with LIT, light the interpolated tri->n
+    RASTER_COMPRESSED = 1 << 5, // with TEXTURED, sample tri->compressed
+};
+
+struct raster_target {
+    unsigned char *data;        // rows of width * bytespp bytes
+    float *zbuffer;             // width * height, larger z is closer
+    int width;
+    int height;
+    int bytespp;
+    int top;                    // frame row of the first row, 0 unless banded
+};
+
+struct raster_tri {
+    v3f s[3];                   // screen space, pixel centers on integers
+    v2f t[3];                   // texel coordinates
+    TGA_Color color;
+    float intensity;            // flat lighting
+    float vi[3];                // RASTER_GOURAUD, intensity of each vertex
+    v3f n[3];                   // RASTER_PHONG, unit normal of each vertex
+    v3f light;                  // RASTER_PHONG, direction times strength
+    const TGA_Image *texture;
+    const struct bc_texture *compressed;
+};
+
+/* Faces whose RK_Area is within this of zero draw nothing. */
+#define RK_DEGENERATE 0.001f
+
+/**
+ * RK_Area - twice the signed screen area of @s, as the kernels compute it
+ */
+static inline
+float
+RK_Area(const v3f s[3])
+{
+    const float cax = s[2].x - s[0].x, cay = s[2].y - s[0].y;
+    const float bax = s[1].x - s[0].x, bay = s[1].y - s[0].y;
+    return cax * bay - bax * cay;
+}
+
+#define _RASTER_h_
+#endif
@@ -0,0 +1,322 @@
+/**
+ * The raster kernels of one instruction set, included once per cpu_isa by
+ * raster.c (so there is no include guard) between the target pragmas of
+ * that set. Expects:
+ *
+ *      RK_ISA(name)    name suffixed with the instruction set
+ *      RK_LANES        pixels tested at once, floats in one vector
+ *
+ * and defines the rk_kernels RK_ISA(RK_Table).
+ */
+typedef float RK_ISA(rk_floats) __attribute__((vector_size(4 * RK_LANES)));
+typedef int RK_ISA(rk_ints) __attribute__((vector_size(4 * RK_LANES)));
+#define RK_FLOATS RK_ISA(rk_floats)
+#define RK_INTS RK_ISA(rk_ints)
+
+#define RK_NAME RK_ISA(RK_Generic)
+#define RK_TEXTURED (flags & (RASTER_TEXTURED | RASTER_COMPRESSED))
+#define RK_LIT (flags & RASTER_LIT)
+#define RK_DEPTH (flags & RASTER_DEPTH)
+#define RK_SMOOTH (flags & (RASTER_GOURAUD | RASTER_PHONG))
+#define RK_BPP target->bytespp
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_Flat_RGB)
+#define RK_TEXTURED 0
+#define RK_LIT 0
+#define RK_DEPTH 0
+#define RK_SMOOTH 0
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_Flat_RGBA)
+#define RK_TEXTURED 0
+#define RK_LIT 0
+#define RK_DEPTH 0
+#define RK_SMOOTH 0
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_FlatLit_RGB)
+#define RK_TEXTURED 0
+#define RK_LIT 1
+#define RK_DEPTH 0
+#define RK_SMOOTH 0
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_FlatLit_RGBA)
+#define RK_TEXTURED 0
+#define RK_LIT 1
+#define RK_DEPTH 0
+#define RK_SMOOTH 0
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_FlatDepth_RGB)
+#define RK_TEXTURED 0
+#define RK_LIT 0
+#define RK_DEPTH 1
+#define RK_SMOOTH 0
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_FlatDepth_RGBA)
+#define RK_TEXTURED 0
+#define RK_LIT 0
+#define RK_DEPTH 1
+#define RK_SMOOTH 0
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_FlatLitDepth_RGB)
+#define RK_TEXTURED 0
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH 0
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_FlatLitDepth_RGBA)
+#define RK_TEXTURED 0
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH 0
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_Tex_RGB)
+#define RK_TEXTURED 1
+#define RK_LIT 0
+#define RK_DEPTH 0
+#define RK_SMOOTH 0
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_Tex_RGBA)
+#define RK_TEXTURED 1
+#define RK_LIT 0
+#define RK_DEPTH 0
+#define RK_SMOOTH 0
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexLit_RGB)
+#define RK_TEXTURED 1
+#define RK_LIT 1
+#define RK_DEPTH 0
+#define RK_SMOOTH 0
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexLit_RGBA)
+#define RK_TEXTURED 1
+#define RK_LIT 1
+#define RK_DEPTH 0
+#define RK_SMOOTH 0
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexDepth_RGB)
+#define RK_TEXTURED 1
+#define RK_LIT 0
+#define RK_DEPTH 1
+#define RK_SMOOTH 0
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexDepth_RGBA)
+#define RK_TEXTURED 1
+#define RK_LIT 0
+#define RK_DEPTH 1
+#define RK_SMOOTH 0
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexLitDepth_RGB)
+#define RK_TEXTURED 1
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH 0
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexLitDepth_RGBA)
+#define RK_TEXTURED 1
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH 0
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_FlatGouraudDepth_RGB)
+#define RK_TEXTURED 0
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH RASTER_GOURAUD
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_FlatGouraudDepth_RGBA)
+#define RK_TEXTURED 0
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH RASTER_GOURAUD
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexGouraudDepth_RGB)
+#define RK_TEXTURED 1
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH RASTER_GOURAUD
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexGouraudDepth_RGBA)
+#define RK_TEXTURED 1
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH RASTER_GOURAUD
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_FlatPhongDepth_RGB)
+#define RK_TEXTURED 0
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH RASTER_PHONG
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_FlatPhongDepth_RGBA)
+#define RK_TEXTURED 0
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH RASTER_PHONG
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexPhongDepth_RGB)
+#define RK_TEXTURED 1
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH RASTER_PHONG
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexPhongDepth_RGBA)
+#define RK_TEXTURED 1
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH RASTER_PHONG
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexBCDepth_RGB)
+#define RK_TEXTURED (RASTER_TEXTURED | RASTER_COMPRESSED)
+#define RK_LIT 0
+#define RK_DEPTH 1
+#define RK_SMOOTH 0
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexBCDepth_RGBA)
+#define RK_TEXTURED (RASTER_TEXTURED | RASTER_COMPRESSED)
+#define RK_LIT 0
+#define RK_DEPTH 1
+#define RK_SMOOTH 0
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexBCLitDepth_RGB)
+#define RK_TEXTURED (RASTER_TEXTURED | RASTER_COMPRESSED)
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH 0
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexBCLitDepth_RGBA)
+#define RK_TEXTURED (RASTER_TEXTURED | RASTER_COMPRESSED)
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH 0
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexBCGouraudDepth_RGB)
+#define RK_TEXTURED (RASTER_TEXTURED | RASTER_COMPRESSED)
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH RASTER_GOURAUD
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexBCGouraudDepth_RGBA)
+#define RK_TEXTURED (RASTER_TEXTURED | RASTER_COMPRESSED)
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH RASTER_GOURAUD
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexBCPhongDepth_RGB)
+#define RK_TEXTURED (RASTER_TEXTURED | RASTER_COMPRESSED)
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH RASTER_PHONG
+#define RK_BPP RGB
+#include "raster_kernel.h"
+
+#define RK_NAME RK_ISA(RK_TexBCPhongDepth_RGBA)
+#define RK_TEXTURED (RASTER_TEXTURED | RASTER_COMPRESSED)
+#define RK_LIT 1
+#define RK_DEPTH 1
+#define RK_SMOOTH RASTER_PHONG
+#define RK_BPP RGBA
+#include "raster_kernel.h"
+
+static
+void
+RK_ISA(RK_ClearDepth)(float *zbuffer, long n)
+{
+    const RK_FLOATS far = (RK_FLOATS){0} - FLT_MAX;
+    long i = 0;
+    for (; i + RK_LANES <= n; i += RK_LANES)
+        memcpy(zbuffer + i, &far, sizeof(far));
+    for (; i < n; i++)
+        zbuffer[i] = -FLT_MAX;
+}
+
+static const struct rk_kernels RK_ISA(RK_Table) = {
+    .generic = RK_ISA(RK_Generic),
+    .clear_depth = RK_ISA(RK_ClearDepth),
+    .kernels = {
+        [0]                                           = { RK_ISA(RK_Flat_RGB),         RK_ISA(RK_Flat_RGBA) },
+        [RASTER_LIT]                                  = { RK_ISA(RK_FlatLit_RGB),      RK_ISA(RK_FlatLit_RGBA) },
+        [RASTER_DEPTH]                                = { RK_ISA(RK_FlatDepth_RGB),    RK_ISA(RK_FlatDepth_RGBA) },
+        [RASTER_LIT | RASTER_DEPTH]                   = { RK_ISA(RK_FlatLitDepth_RGB), RK_ISA(RK_FlatLitDepth_RGBA) },
+        [RASTER_TEXTURED]                             = { RK_ISA(RK_Tex_RGB),          RK_ISA(RK_Tex_RGBA) },
+        [RASTER_TEXTURED | RASTER_LIT]                = { RK_ISA(RK_TexLit_RGB),       RK_ISA(RK_TexLit_RGBA) },
+        [RASTER_TEXTURED | RASTER_DEPTH]              = { RK_ISA(RK_TexDepth_RGB),     RK_ISA(RK_TexDepth_RGBA) },
+        [RASTER_TEXTURED | RASTER_LIT | RASTER_DEPTH] = { RK_ISA(RK_TexLitDepth_RGB),  RK_ISA(RK_TexLitDepth_RGBA) },
+    },
+    .smooth = {
+        { { RK_ISA(RK_FlatGouraudDepth_RGB), RK_ISA(RK_FlatGouraudDepth_RGBA) },
+          { RK_ISA(RK_TexGouraudDepth_RGB),  RK_ISA(RK_TexGouraudDepth_RGBA) } },
+        { { RK_ISA(RK_FlatPhongDepth_RGB),   RK_ISA(RK_FlatPhongDepth_RGBA) },
+          { RK_ISA(RK_TexPhongDepth_RGB),    RK_ISA(RK_TexPhongDepth_RGBA) } },
+    },
+    .compressed = {
+        { RK_ISA(RK_TexBCDepth_RGB),         RK_ISA(RK_TexBCDepth_RGBA) },
+        { RK_ISA(RK_TexBCLitDepth_RGB),      RK_ISA(RK_TexBCLitDepth_RGBA) },
+        { RK_ISA(RK_TexBCGouraudDepth_RGB),  RK_ISA(RK_TexBCGouraudDepth_RGBA) },
+        { RK_ISA(RK_TexBCPhongDepth_RGB),    RK_ISA(RK_TexBCPhongDepth_RGBA) },
+    },
+};
+
+#undef RK_FLOATS
+#undef RK_INTS
+#undef RK_LANES
+#undef RK_ISA
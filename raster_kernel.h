@@ -0,0 +1,216 @@
+/**
+ * Raster kernel body, included once per variant by raster.c (so there is
+ * no include guard). Expects:
+ *
+ *      RK_NAME         name of the generated function
+ *      RK_TEXTURED     0, RASTER_TEXTURED to sample the texture, or with
+ *                      RASTER_COMPRESSED to sample the compressed one
+ *      RK_LIT          non-zero to scale the color by the intensity
+ *      RK_DEPTH        non-zero to test and write the z-buffer
+ *      RK_SMOOTH       0, RASTER_GOURAUD or RASTER_PHONG, used when lit
+ *      RK_BPP          bytes per pixel of the target
+ *
+ * and from raster_isa.h RK_LANES with its RK_FLOATS and RK_INTS vectors.
+ *
+ * The switches are constants for the specialized kernels, so the compiler
+ * drops the dead paths, and runtime expressions for the generic one.
+ *
+ * Pixels are sampled on integer coordinates. The barycentric coordinates
+ * come from the cross product of the (C-A, B-A, A-P) x and y components,
+ * with the parts that only depend on the triangle hoisted out of the loop.
+ * They and the depth test are computed for RK_LANES pixels of a row at
+ * once, with the same operations per lane as one pixel at a time.
+ *
+ * Micro triangles, whose bounding box spans more than one row but has no
+ * more pixels than RK_LANES, are tested with the rows of the box packed
+ * side by side in one vector, the same operations per lane again. Dense
+ * meshes are mostly made of those.
+ *
+ * Returns the number of pixels written.
+ */
+#define RK_SHADE RK_CAT(RK_NAME, _Shade)
+
+/* Color of the pixel at barycentric @bc, before it is stored. */
+static inline
+TGA_Color
+RK_SHADE(const struct raster_tri *tri, int flags, v3f bc, TGA_Color flat, const unsigned char *tex,
+         const struct bc_texture *ctex, int tw, int th, int tbpp, unsigned int tmask)
+{
+    (void)flags;
+    (void)tbpp;
+    TGA_Color c = flat;
+    const float intensity = (RK_LIT && RK_SMOOTH) ? RK_SmoothIntensity(tri, RK_SMOOTH, bc) : tri->intensity;
+    if (RK_LIT && RK_SMOOTH && !RK_TEXTURED) {
+        c = TGA_ColorInit(
+                intensity * flat.r,
+                intensity * flat.g,
+                intensity * flat.b,
+                flat.a);
+    }
+    if (RK_TEXTURED) {
+        int tx = bc.x * tri->t[0].x + bc.y * tri->t[1].x + bc.z * tri->t[2].x;
+        int ty = bc.x * tri->t[0].y + bc.y * tri->t[1].y + bc.z * tri->t[2].y;
+        // out of range texels read as 0, like TGA_ImageGet
+        unsigned int inside = ((unsigned)tx < (unsigned)tw) & ((unsigned)ty < (unsigned)th);
+        if (RK_TEXTURED & RASTER_COMPRESSED) {
+            long b = inside ? (long)(ty >> 2) * ctex->bw + (tx >> 2) : 0;
+            c.val = BC_Texel(&ctex->blocks[b], ctex->alpha, ((ty & 3) << 2) | (tx & 3)) & -inside;
+        } else {
+            long offset = inside ? ((long)ty * tw + tx) * tbpp : 0;
+            memcpy(&c.val, tex + offset, sizeof(c.val));
+            c.val &= tmask & -inside;
+        }
+        if (RK_LIT) {
+            c = TGA_ColorInit(
+                    intensity * c.r,
+                    intensity * c.g,
+                    intensity * c.b,
+                    c.a);
+        }
+    }
+    return c;
+}
+
+static
+int
+RK_NAME(const struct raster_target *target, const struct raster_tri *tri, int flags)
+{
+    (void)flags;
+    const v3f A = tri->s[0], B = tri->s[1], C = tri->s[2];
+    const float cax = C.x - A.x, cay = C.y - A.y;
+    const float bax = B.x - A.x, bay = B.y - A.y;
+    const float uz = RK_Area(tri->s);
+    if (fabsf(uz) <= RK_DEGENERATE)
+        return 0;
+
+    float minx = MIN(MIN(A.x, B.x), C.x), maxx = MAX(MAX(A.x, B.x), C.x);
+    float miny = MIN(MIN(A.y, B.y), C.y), maxy = MAX(MAX(A.y, B.y), C.y);
+    int x0 = MAX(0,                  (int)ceilf(minx));
+    int y0 = MAX(target->top,        (int)ceilf(miny));
+    int x1 = MIN(target->width - 1,  (int)floorf(maxx));
+    int y1 = MIN(target->top + target->height - 1, (int)floorf(maxy));
+
+    const int bpp = RK_BPP;
+    TGA_Color flat = tri->color;
+    if (RK_LIT && !RK_SMOOTH && !RK_TEXTURED) {
+        flat = TGA_ColorInit(
+                tri->intensity * flat.r,
+                tri->intensity * flat.g,
+                tri->intensity * flat.b,
+                flat.a);
+    }
+
+    const unsigned char *tex = NULL;
+    int tw = 0, th = 0, tbpp = 0;
+    unsigned int tmask = 0;
+    const struct bc_texture *ctex = NULL;
+    if (RK_TEXTURED & RASTER_COMPRESSED) {
+        ctex = tri->compressed;
+        tw = ctex->width;
+        th = ctex->height;
+    } else if (RK_TEXTURED) {
+        tex = tri->texture->data;
+        tw = tri->texture->width;
+        th = tri->texture->height;
+        tbpp = tri->texture->bytespp;
+        tmask = (tbpp == RGBA) ? 0xffffffffu : (tbpp == RGB) ? 0x00ffffffu : 0x000000ffu;
+    }
+
+    int written = 0;
+
+    // a micro triangle: lane i is pixel (i % cols, i / cols) of the box
+    const int cols = x1 - x0 + 1, rows = y1 - y0 + 1;
+    if (rows > 1 && cols > 0 && (long)cols * rows <= RK_LANES) {
+        RK_FLOATS px, py;
+        RK_INTS valid;
+        long pixel[RK_LANES];
+        for (int i = 0, c = 0, r = 0; i < RK_LANES; i++) {
+            px[i] = x0 + c;
+            py[i] = y0 + r;
+            valid[i] = -(r < rows);
+            pixel[i] = valid[i] ? (long)(y0 + r - target->top) * target->width + x0 + c : 0;
+            if (++c == cols) {
+                c = 0;
+                r++;
+            }
+        }
+        const RK_FLOATS ux = bax * (A.y - py) - (A.x - px) * bay;
+        const RK_FLOATS uy = (A.x - px) * cay - cax * (A.y - py);
+        const RK_FLOATS b0 = 1.0f - (ux + uy) / uz, b1 = uy / uz, b2 = ux / uz;
+        RK_INTS covered = ~((b0 < 0.0f) | (b1 < 0.0f) | (b2 < 0.0f)) & valid;
+
+        RK_FLOATS z = {0};
+        if (RK_DEPTH) {
+            z += A.z * b0;
+            z += B.z * b1;
+            z += C.z * b2;
+            RK_FLOATS zold;
+            for (int i = 0; i < RK_LANES; i++)
+                zold[i] = valid[i] ? target->zbuffer[pixel[i]] : FLT_MAX;
+            covered &= zold < z;
+        }
+
+        for (int i = 0; i < cols * rows; i++) {
+            if (!covered[i])
+                continue;
+            if (RK_DEPTH)
+                target->zbuffer[pixel[i]] = z[i];
+            const TGA_Color c = RK_SHADE(tri, flags, V3_float(b0[i], b1[i], b2[i]), flat, tex, ctex, tw, th, tbpp, tmask);
+            memcpy(target->data + pixel[i] * bpp, c.raw, bpp);
+            written++;
+        }
+        return written;
+    }
+
+    for (int y = y0; y <= y1; y++) {
+        const float py = y;
+        unsigned char *row = target->data + (long)(y - target->top) * target->width * bpp;
+        float *zrow = RK_DEPTH ? target->zbuffer + (long)(y - target->top) * target->width : NULL;
+
+        // RK_LANES pixels are tested at once, then the covered ones shaded
+        for (int x = x0; x <= x1; x += RK_LANES) {
+            RK_FLOATS px;
+            for (int i = 0; i < RK_LANES; i++)
+                px[i] = x + i;
+            const RK_FLOATS ux = bax * (A.y - py) - (A.x - px) * bay;
+            const RK_FLOATS uy = (A.x - px) * cay - cax * (A.y - py);
+            const RK_FLOATS b0 = 1.0f - (ux + uy) / uz, b1 = uy / uz, b2 = ux / uz;
+            RK_INTS covered = ~((b0 < 0.0f) | (b1 < 0.0f) | (b2 < 0.0f)) & (px <= (float)x1);
+
+            RK_FLOATS z = {0};
+            if (RK_DEPTH) {
+                z += A.z * b0;
+                z += B.z * b1;
+                z += C.z * b2;
+                // a whole vector of the row when it fits, lanes past x1 fail
+                RK_FLOATS zold;
+                if (x + RK_LANES <= target->width) {
+                    memcpy(&zold, zrow + x, sizeof(zold));
+                } else {
+                    for (int i = 0; i < RK_LANES; i++)
+                        zold[i] = (x + i <= x1) ? zrow[x + i] : FLT_MAX;
+                }
+                covered &= zold < z;
+            }
+
+            for (int i = 0; i < RK_LANES && x + i <= x1; i++) {
+                if (!covered[i])
+                    continue;
+                if (RK_DEPTH)
+                    zrow[x + i] = z[i];
+                const TGA_Color c = RK_SHADE(tri, flags, V3_float(b0[i], b1[i], b2[i]), flat, tex, ctex, tw, th, tbpp, tmask);
+                memcpy(row + (long)(x + i) * bpp, c.raw, bpp);
+                written++;
+            }
+        }
+    }
+    return written;
+}
+
+#undef RK_SHADE
+#undef RK_NAME
+#undef RK_TEXTURED
+#undef RK_LIT
+#undef RK_DEPTH
+#undef RK_SMOOTH
+#undef RK_BPP
@@ -0,0 +1,977 @@
+#include "render.h"
+
+/**
+ * line - draw a line, the parts outside the image are clipped away
+ */
+static
+void
+line(TGA_Image *image, v2i t0, v2i t1, TGA_Color color)
+{
+    float x0 = t0.x, y0 = t0.y, x1 = t1.x, y1 = t1.y;
+    if (!image->data || !WF_ClipLine(&x0, &y0, &x1, &y1, image->width, image->height))
+        return;
+    WF_Line(image, 0, lrintf(x0), lrintf(y0), lrintf(x1), lrintf(y1), color);
+}
+
+static
+float
+faceIntensity(v3f s_pts[3], int width, int height)
+{
+    v3f w_pts[3];
+    for (int i = 0; i < 3; i++)
+        w_pts[i] = V3_float(s_pts[i].x * 2.0f / width - 1.0f, s_pts[i].y * 2.0f / height - 1.0f, s_pts[i].z);
+    v3f normal = CrossV3_float(SubV3_float(w_pts[2], w_pts[0]), SubV3_float(w_pts[1], w_pts[0]));
+    normal = NormV3_float(normal);
+    return DotV3_float(normal, V3_float(0.0, 0.0, -0.95f));
+}
+
+static const char *shadeRateNames[] = {
+    [SHADE_AUTO] = "auto", [SHADE_FACE] = "face",
+    [SHADE_VERTEX] = "vertex", [SHADE_PIXEL] = "pixel"
+};
+
+/**
+ * shadeRateParse - shade_rate from its name, -1 if unknown
+ */
+static
+int
+shadeRateParse(const char *name)
+{
+    for (int i = 0; i < (int)(sizeof(shadeRateNames) / sizeof(shadeRateNames[0])); i++) {
+        if (!strcmp(name, shadeRateNames[i]))
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * shadeRate - the shade_rate a render of @width x @height will use
+ */
+static
+int
+shadeRate(const struct render_options *opts, const struct model *model, int width, int height)
+{
+    int size = MAX(width, height);
+    if (!model->nnorms)
+        return SHADE_FACE;
+    if (opts->shading != SHADE_AUTO)
+        return opts->shading;
+    // larger renders keep the flat lighting, smooth shading is asked for
+    return (size > SHADE_ICON && size <= SHADE_THUMBNAIL) ? SHADE_VERTEX : SHADE_FACE;
+}
+
+/**
+ * lightNormal - normal @i of @model rotated by the yaw and normalized
+ * @intensity: set to the light at it
+ */
+static inline
+v3f
+lightNormal(const struct shade_stage *ss, const struct model *model, int i, float *intensity)
+{
+    v3f n = rotateY(ModelNormal(model, i), ss->cy, ss->sy);
+    float len = sqrtf(DotV3_float(n, n));
+    // a degenerate normal stays zero and lights as black
+    n = (len > 0.0f) ? MulV3_float(1.0f / len, n) : n;
+    *intensity = MAX(0.0f, DotV3_float(n, ss->light));
+    return n;
+}
+
+/**
+ * shadeStage - light the vertex normals for a render of @width x @height
+ * @lazy: light them per face instead, for a render that may stop early
+ *
+ * Normals are rotated and lit once per render rather than once for every
+ * face that uses them. Falls back to per face lighting when the model has
+ * no normals or there is no memory for them.
+ */
+static
+void
+shadeStage(struct shade_stage *ss, const struct render_options *opts, const struct model *model, int width, int height,
+           bool lazy)
+{
+    memset(ss, 0, sizeof(*ss));
+    ss->light = V3_float(0.0f, 0.0f, 0.95f);
+    ss->cy = cosf(opts->yaw);
+    ss->sy = sinf(opts->yaw);
+    ss->rate = shadeRate(opts, model, width, height);
+    if (ss->rate == SHADE_FACE || lazy)
+        return;
+
+    ss->normals = (v3f *)malloc(sizeof(v3f) * model->nnorms);
+    ss->intensity = (float *)malloc(sizeof(float) * model->nnorms);
+    if (!ss->normals || !ss->intensity)
+        goto flat;
+
+    for (int i = 0; i < model->nnorms; i++)
+        ss->normals[i] = lightNormal(ss, model, i, &ss->intensity[i]);
+    return;
+
+flat:
+    free(ss->normals);
+    free(ss->intensity);
+    ss->normals = NULL;
+    ss->intensity = NULL;
+    ss->rate = SHADE_FACE;
+}
+
+static
+void
+shadeStageDelete(struct shade_stage *ss)
+{
+    free(ss->normals);
+    free(ss->intensity);
+    memset(ss, 0, sizeof(*ss));
+}
+
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#pragma GCC optimize("vect-cost-model=dynamic")
+#define VS_ISA(name) name##_SSE2
+#include "render_isa.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#pragma GCC optimize("vect-cost-model=dynamic")
+#define VS_ISA(name) name##_AVX2
+#include "render_isa.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+#pragma GCC optimize("vect-cost-model=dynamic")
+#define VS_ISA(name) name##_AVX512
+#include "render_isa.h"
+#pragma GCC pop_options
+
+static void (*const projectVerticesIsa[CPU_NISAS])(const struct vertex_stage *, const v3f *, v3f *, int) = {
+    [CPU_SSE2] = projectVertices_SSE2, [CPU_AVX2] = projectVertices_AVX2, [CPU_AVX512] = projectVertices_AVX512
+};
+
+/**
+ * projectModel - every vertex of @model in screen space
+ *
+ * Each vertex is transformed once rather than once for every face that
+ * uses it. Returns NULL when out of memory, free() the result.
+ */
+static
+v3f *
+projectModel(const struct model *model, const struct vertex_stage *vs)
+{
+    const bool packed = model->packed.verts != NULL;
+    v3f *screen = (v3f *)malloc(sizeof(v3f) * MAX(model->nverts, 1) * (packed ? 2 : 1));
+    if (!screen)
+        return NULL;
+
+    const v3f *verts = model->verts;
+    if (packed) {
+        v3f *decoded = screen + model->nverts;
+        for (int i = 0; i < model->nverts; i++)
+            decoded[i] = ModelVertex(model, i);
+        verts = decoded;
+    }
+    projectVerticesIsa[CPU_Isa](vs, verts, screen, model->nverts);
+    return screen;
+}
+
+/**
+ * setupFace - transform face @i of the model into screen space
+ * @screen: the vertices from projectModel, or NULL to project them here
+ *
+ * @cull: skip the faces the single sample kernels would
+ *
+ * Returns the lighting raster_flags for the face, or -1 for a culled
+ * face, before its attributes are fetched. Faces with a vertex that has
+ * no normal are lit per face.
+ */
+static inline
+int
+setupFace(struct model *model, int i, const struct vertex_stage *vs, const v3f *screen,
+          const struct shade_stage *ss, bool cull, struct raster_tri *tri)
+{
+    const v3i *face = model->faces + 3 * i;
+    for (int j = 0; j < 3; j++)
+        tri->s[j] = screen ? screen[face[j].ivert - 1] : projectVertex(vs, ModelVertex(model, face[j].ivert - 1));
+    // dense meshes snapped to whole pixels collapse about half their faces
+    if (cull && fabsf(RK_Area(tri->s)) <= RK_DEGENERATE)
+        return -1;
+
+    for (int j = 0; j < 3; j++) {
+        v2f t = ModelUV(model, face[j].iuv - 1);
+        tri->t[j] = V2_float(t.x * model->texture.width, t.y * model->texture.height);
+    }
+    if (ss->rate == SHADE_FACE || !face[0].inorm || !face[1].inorm || !face[2].inorm) {
+        tri->intensity = faceIntensity(tri->s, vs->width, vs->height);
+        return RASTER_LIT;
+    }
+
+    for (int j = 0; j < 3; j++) {
+        const int k = face[j].inorm - 1;
+        if (ss->normals) {
+            tri->n[j] = ss->normals[k];
+            tri->vi[j] = ss->intensity[k];
+        } else {
+            tri->n[j] = lightNormal(ss, model, k, &tri->vi[j]);
+        }
+    }
+    tri->light = ss->light;
+    return RASTER_LIT | ((ss->rate == SHADE_VERTEX) ? RASTER_GOURAUD : RASTER_PHONG);
+}
+
+static inline
+int
+gcd(int a, int b)
+{
+    while (b) {
+        int r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
+/**
+ * drawFace - rasterize face @i of @model into @target, or @msaa without one
+ * @tri: scratch, with the texture of the model set
+ *
+ * Returns the number of pixels written to @target, 0 with @msaa.
+ */
+static inline
+int
+drawFace(struct model *model, int i, const struct vertex_stage *vs, const v3f *screen, const struct shade_stage *ss,
+         const struct raster_target *target, struct msaa_buffer *msaa, struct raster_tri *tri)
+{
+    const int sampling = model->compressed ? RASTER_TEXTURED | RASTER_COMPRESSED : RASTER_TEXTURED;
+    int flags = setupFace(model, i, vs, screen, ss, target != NULL, tri);
+    if (flags < 0)
+        return 0;
+    flags |= sampling;
+    if (target)
+        return RK_Draw(target, tri, RASTER_DEPTH | flags);
+    MSAA_TextureMap(msaa, tri, flags);
+    return 0;
+}
+
+/**
+ * bandRange - the bands, of @rows rows from the top, a face can touch
+ *
+ * Covers the pixels whose samples the face can reach, a row more on each
+ * side than the single sample kernels need. Returns false when the face
+ * is above or below the frame.
+ */
+static inline
+bool
+bandRange(const v3f *screen, const v3i *face, int height, int rows, int *first, int *last)
+{
+    float miny = FLT_MAX, maxy = -FLT_MAX;
+    for (int j = 0; j < 3; j++) {
+        miny = MIN(miny, screen[face[j].ivert - 1].y);
+        maxy = MAX(maxy, screen[face[j].ivert - 1].y);
+    }
+    if (!(maxy + 0.5f >= 0.0f) || !(miny - 0.5f <= height - 1))
+        return false;
+
+    // frame rows go up, bands are counted from the top
+    const int lo = (int)MAX(0.0f, floorf(miny - 0.5f));
+    const int hi = (int)MIN(height - 1.0f, ceilf(maxy + 0.5f));
+    *first = (height - 1 - hi) / rows;
+    *last = (height - 1 - lo) / rows;
+    return true;
+}
+
+/**
+ * binFaces - sort the faces into the bands of @rows rows they can touch
+ * @first: nbands + 1 entries, band b's faces are (*faces)[first[b]] up to
+ *         (*faces)[first[b + 1]], in face order
+ * @faces: set to the array to free
+ *
+ * Returns false when out of memory.
+ */
+static
+bool
+binFaces(const struct model *model, const v3f *screen, int height, int rows, long *first, int **faces)
+{
+    const int nbands = (height + rows - 1) / rows;
+    struct pf_span span = PF_Begin("bin");
+
+    // counted, then filled from the start of each band's range
+    int b0, b1;
+    memset(first, 0, sizeof(long) * (nbands + 1));
+    for (int i = 0; i < model->nfaces; i++) {
+        if (bandRange(screen, model->faces + 3 * i, height, rows, &b0, &b1)) {
+            for (int b = b0; b <= b1; b++)
+                first[b + 1]++;
+        }
+    }
+    for (int b = 0; b < nbands; b++)
+        first[b + 1] += first[b];
+    *faces = (int *)malloc(sizeof(int) * MAX(first[nbands], 1));
+    for (int i = 0; *faces && i < model->nfaces; i++) {
+        if (bandRange(screen, model->faces + 3 * i, height, rows, &b0, &b1)) {
+            for (int b = b0; b <= b1; b++)
+                (*faces)[first[b]++] = i;
+        }
+    }
+    // each band's start was moved to the next one's
+    for (int b = nbands; b > 0; b--)
+        first[b] = first[b - 1];
+    first[0] = 0;
+    PF_End(&span);
+    return *faces != NULL;
+}
+
+/**
+ * visibilityCacheInit - empty cache for a sequence of frames of @model
+ *
+ * Returns false when out of memory.
+ */
+static
+bool
+visibilityCacheInit(struct visibility_cache *cache, const struct model *model)
+{
+    memset(cache, 0, sizeof(struct visibility_cache));
+    cache->nfaces = model->nfaces;
+    cache->visible = -1;
+    cache->last = (unsigned char *)calloc(MAX(model->nfaces, 1), 1);
+    cache->next = (unsigned char *)calloc(MAX(model->nfaces, 1), 1);
+    return cache->last && cache->next;
+}
+
+static
+void
+visibilityCacheDelete(struct visibility_cache *cache)
+{
+    free(cache->last);
+    free(cache->next);
+    memset(cache, 0, sizeof(struct visibility_cache));
+}
+
+/**
+ * visibilityCacheSwap - make the frame just drawn the last one
+ */
+static
+void
+visibilityCacheSwap(struct visibility_cache *cache)
+{
+    unsigned char *last = cache->next;
+    cache->next = cache->last;
+    cache->last = last;
+    memset(cache->next, 0, cache->nfaces);
+    cache->visible = 0;
+    for (int i = 0; i < cache->nfaces; i++)
+        cache->visible += last[i];
+}
+
+/**
+ * towardsFar - the next float below @z, for depths above -FLT_MAX
+ */
+static inline
+float
+towardsFar(float z)
+{
+    if (z == 0.0f)
+        return -FLT_TRUE_MIN;
+    union { float f; int32_t i; } u = { z };
+    u.i += z > 0.0f ? -1 : 1;
+    return u.f;
+}
+
+/* Faces sorted into stripes of the target, drawn by parallel tasks. */
+struct draw_stripes {
+    struct model *model;
+    const struct vertex_stage *vs;
+    const v3f *screen;
+    const struct shade_stage *ss;
+    const struct raster_target *target;
+    const struct msaa_buffer *msaa;
+    int rows;
+    const long *first;          // NULL with a single stripe of every face
+    const int *faces;
+    struct visibility_cache *cache;
+    float *tiles;               // per stripe, tw * th least depths once primed
+    int tw, th;
+};
+
+/**
+ * primeStripe - draw the faces visible in the last frame into @target
+ * @tiles: set to the least depth of each tile of the stripe
+ *
+ * Only the depth matters, the colors are all drawn over again. Every
+ * depth they wrote is then moved one float towards the far plane: a face
+ * passes the strict depth test afterwards exactly where it's at least as
+ * near as the occluders, so the first of the nearest faces still wins.
+ */
+static
+void
+primeStripe(const struct draw_stripes *job, const struct raster_target *target, float *tiles, long k0, long k1)
+{
+    struct raster_tri tri = {0};
+    for (long k = k0; k < k1; k++) {
+        const int i = job->faces ? job->faces[k] : (int)k;
+        if (!job->cache->last[i])
+            continue;
+        const v3i *face = job->model->faces + 3 * i;
+        for (int j = 0; j < 3; j++)
+            tri.s[j] = job->screen[face[j].ivert - 1];
+        RK_Draw(target, &tri, RASTER_DEPTH);
+    }
+
+    for (long t = 0; t < (long)job->tw * job->th; t++)
+        tiles[t] = FLT_MAX;
+    for (int y = 0; y < target->height; y++) {
+        float *zrow = target->zbuffer + (long)y * target->width;
+        float *trow = tiles + (long)(y / VISIBILITY_TILE) * job->tw;
+        for (int x = 0; x < target->width; x++) {
+            if (zrow[x] > -FLT_MAX)
+                zrow[x] = towardsFar(zrow[x]);
+            trow[x / VISIBILITY_TILE] = MIN(trow[x / VISIBILITY_TILE], zrow[x]);
+        }
+    }
+}
+
+/**
+ * faceHidden - whether face @i is behind the primed depth of every tile
+ * its pixels fall in
+ *
+ * The depth of a pixel is taken as at most the nearest vertex, with a
+ * margin for the rounding of the barycentric coordinates.
+ */
+static inline
+bool
+faceHidden(const struct draw_stripes *job, const struct raster_target *target, const float *tiles, int i)
+{
+    const v3i *face = job->model->faces + 3 * i;
+    const v3f A = job->screen[face[0].ivert - 1], B = job->screen[face[1].ivert - 1], C = job->screen[face[2].ivert - 1];
+    const int x0 = MAX(0,                  (int)ceilf(MIN(MIN(A.x, B.x), C.x)));
+    const int y0 = MAX(target->top,        (int)ceilf(MIN(MIN(A.y, B.y), C.y)));
+    const int x1 = MIN(target->width - 1,  (int)floorf(MAX(MAX(A.x, B.x), C.x)));
+    const int y1 = MIN(target->top + target->height - 1, (int)floorf(MAX(MAX(A.y, B.y), C.y)));
+    if (x0 > x1 || y0 > y1)
+        return false;
+
+    const float far = MAX(MAX(fabsf(A.z), fabsf(B.z)), fabsf(C.z));
+    const float bound = MAX(MAX(A.z, B.z), C.z) + 1e-5f * (far + 1.0f);
+    for (int ty = (y0 - target->top) / VISIBILITY_TILE; ty <= (y1 - target->top) / VISIBILITY_TILE; ty++) {
+        for (int tx = x0 / VISIBILITY_TILE; tx <= x1 / VISIBILITY_TILE; tx++) {
+            if (!(tiles[ty * job->tw + tx] > bound))
+                return false;
+        }
+    }
+    return true;
+}
+
+static
+void
+drawStripes(void *arg, long b0, long b1)
+{
+    const struct draw_stripes *job = (const struct draw_stripes *)arg;
+    const int height = job->vs->height;
+    struct visibility_cache *cache = job->cache;
+    struct raster_tri tri = { .texture = &job->model->texture, .compressed = job->model->compressed };
+    for (long b = b0; b < b1; b++) {
+        // counted from the top like bands, over the frame rows they cover
+        const int rows = MIN(job->rows, height - (int)b * job->rows);
+        const int top = height - (int)b * job->rows - rows;
+        struct raster_target target = {0};
+        struct msaa_buffer msaa = {0};
+        if (job->target) {
+            target = *job->target;
+            target.data += (long)top * target.width * target.bytespp;
+            target.zbuffer += (long)top * target.width;
+            target.height = rows;
+            target.top = top;
+        } else {
+            msaa = *job->msaa;
+            msaa.depth += (long)top * msaa.width * msaa.samples;
+            msaa.color += (long)top * msaa.width * msaa.samples;
+            msaa.height = rows;
+            msaa.top = top;
+        }
+
+        const long k0 = job->first ? job->first[b] : 0;
+        const long k1 = job->first ? job->first[b + 1] : job->model->nfaces;
+        float *tiles = job->tiles ? job->tiles + b * job->tw * job->th : NULL;
+        if (tiles)
+            primeStripe(job, &target, tiles, k0, k1);
+
+        long culled = 0;
+        for (long k = k0; k < k1; k++) {
+            const int i = job->faces ? job->faces[k] : (int)k;
+            if (tiles && faceHidden(job, &target, tiles, i)) {
+                culled++;
+                continue;
+            }
+            const int written = drawFace(job->model, i, job->vs, job->screen, job->ss,
+                                         job->target ? &target : NULL, &msaa, &tri);
+            // stripes sharing a face only ever set its flag
+            if (cache && written)
+                __atomic_store_n(&cache->next[i], 1, __ATOMIC_RELAXED);
+        }
+        if (tiles) {
+            __atomic_fetch_add(&cache->draws, k1 - k0, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&cache->culled, culled, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/**
+ * drawFacesStriped - drawFaces without a deadline, in stripes of rows
+ * @cache: visibility of the last frame to draw against, or NULL
+ *
+ * Each stripe draws the faces that touch it in face order, clipped to its
+ * rows, so the image is the same as drawn by one thread. The stripes are
+ * split between the threads of the job system. Returns false, having
+ * drawn nothing, when it isn't worth it or out of memory.
+ */
+static
+bool
+drawFacesStriped(struct model *model, const struct vertex_stage *vs, const v3f *screen, const struct shade_stage *ss,
+                 const struct raster_target *target, struct msaa_buffer *msaa, struct visibility_cache *cache)
+{
+    const int threads = JS_Threads();
+    const int height = vs->height;
+    const bool whole = target ? (target->top == 0 && target->height == height)
+                              : (msaa->top == 0 && msaa->height == height);
+    if (!target || (cache && cache->nfaces != model->nfaces))
+        cache = NULL;
+    if (!screen || !whole || (threads == 1 && !cache))
+        return false;
+
+    // a few stripes per thread for the stealing to even out
+    int nstripes = 1;
+    if (threads > 1 && height >= 2 * RENDER_STRIPE_ROWS)
+        nstripes = MIN(height / RENDER_STRIPE_ROWS, 4 * threads);
+    if (nstripes == 1 && !cache)
+        return false;
+    const int rows = (height + nstripes - 1) / nstripes;
+    const int nbands = (height + rows - 1) / rows;
+
+    struct draw_stripes job = {
+        .model = model, .vs = vs, .screen = screen, .ss = ss, .target = target, .msaa = msaa,
+        .rows = rows, .cache = cache
+    };
+    long *first = NULL;
+    int *faces = NULL;
+    bool result = true;
+    if (nbands > 1) {
+        first = (long *)malloc(sizeof(long) * (nbands + 1));
+        result = first && binFaces(model, screen, height, rows, first, &faces);
+        job.first = first;
+        job.faces = faces;
+    }
+    // without the memory for the tiles the frame is drawn as a first one
+    const long culled = cache ? cache->culled : 0;
+    if (result && cache && cache->visible >= 0 && cache->skip == 0) {
+        job.tw = (vs->width + VISIBILITY_TILE - 1) / VISIBILITY_TILE;
+        job.th = (rows + VISIBILITY_TILE - 1) / VISIBILITY_TILE;
+        job.tiles = (float *)malloc(sizeof(float) * job.tw * job.th * nbands);
+    }
+    if (result) {
+        JS_ParallelFor(drawStripes, &job, nbands, 1);
+        if (cache && job.tiles) {
+            cache->frames++;
+            cache->occluders += cache->visible;
+            if (cache->culled - culled <= cache->visible)
+                cache->skip = VISIBILITY_RETRY;
+        } else if (cache && cache->skip > 0) {
+            cache->skip--;
+        }
+        if (cache)
+            visibilityCacheSwap(cache);
+    }
+    free(job.tiles);
+    free(faces);
+    free(first);
+    return result;
+}
+
+/**
+ * drawFaces - rasterize every face of @model through a vertex stage
+ * @target: single sample target, or NULL to draw into @msaa
+ * @deadline: T_Now() time to stop at, or 0 to draw every face
+ * @cache: visibility_cache of a sequence without a deadline, or NULL
+ *
+ * With a deadline the faces are visited in a strided order so that a
+ * partial result is spread over the whole mesh. Without one the frame is
+ * split between the threads of the job system. Returns the number of
+ * faces drawn.
+ */
+static
+int
+drawFaces(struct model *model, const struct vertex_stage *vs, const struct shade_stage *ss,
+          const struct raster_target *target, struct msaa_buffer *msaa, double deadline,
+          struct visibility_cache *cache)
+{
+    struct raster_tri tri = { .texture = &model->texture, .compressed = model->compressed };
+
+    // a golden ratio stride coprime with the face count visits every face
+    int step = 1;
+    if (deadline > 0.0 && model->nfaces > 2) {
+        step = (int)(model->nfaces * 0.618f) | 1;
+        while (gcd(step, model->nfaces) != 1)
+            step += 2;
+    }
+
+    struct pf_span span = PF_Begin("raster");
+    // a pass against a deadline projects only the faces it gets to
+    v3f *screen = (deadline > 0.0) ? NULL : projectModel(model, vs);
+    int drawn = 0;
+    if (deadline <= 0.0 && drawFacesStriped(model, vs, screen, ss, target, msaa, cache))
+        drawn = model->nfaces;
+    for (int k = drawn, i = 0; k < model->nfaces; k++, i = (i + step) % model->nfaces) {
+        if (deadline > 0.0 && !(k & 15) && T_Now() > deadline)
+            break;
+        drawFace(model, i, vs, screen, ss, target, msaa, &tri);
+        drawn++;
+    }
+    free(screen);
+    PF_End(&span);
+    return drawn;
+}
+
+static
+bool
+renderMultisample(struct model *model, TGA_Image *image, const struct render_options *opts)
+{
+    struct vertex_stage vs = vertexStage(opts, image->width, image->height, false);
+
+    struct msaa_buffer buffer;
+    if (!MSAA_BufferInit(&buffer, image->width, image->height, opts->samples)) {
+        fprintf(stderr, "Can't allocate a %dx multisample buffer\n", opts->samples);
+        return false;
+    }
+
+    struct shade_stage ss;
+    shadeStage(&ss, opts, model, image->width, image->height, false);
+    drawFaces(model, &vs, &ss, NULL, &buffer, 0.0, NULL);
+
+    MSAA_Resolve(&buffer, image);
+    TGA_ImageFlipVertically(image);
+    MSAA_BufferDelete(&buffer);
+    shadeStageDelete(&ss);
+    return true;
+}
+
+/**
+ * renderFaces - single sample render, optionally against a deadline
+ * @deadline: see drawFaces
+ * @zbuffer: width * height floats to reuse, or NULL to allocate one
+ *
+ * Returns the number of faces drawn, -1 when out of memory.
+ */
+static
+int
+renderFaces(struct model *model, TGA_Image *image, const struct render_options *opts, double deadline, float *zbuffer)
+{
+    int width = image->width;
+    int height = image->height;
+    struct vertex_stage vs = vertexStage(opts, width, height, true);
+
+    float *owned = NULL;
+    if (!zbuffer)
+        zbuffer = owned = (float *)malloc(sizeof(float)*width*height);
+    if (!zbuffer)
+        return -1;
+    RK_ClearDepth(zbuffer, (long)width * height);
+
+    struct raster_target target = {
+        .data = image->data,
+        .zbuffer = zbuffer,
+        .width = width,
+        .height = height,
+        .bytespp = image->bytespp
+    };
+    struct shade_stage ss;
+    shadeStage(&ss, opts, model, width, height, deadline > 0.0);
+    int drawn = drawFaces(model, &vs, &ss, &target, NULL, deadline, opts->visibility);
+    TGA_ImageFlipVertically(image);
+
+    shadeStageDelete(&ss);
+    free(owned);
+    return drawn;
+}
+
+/**
+ * renderBuffered - full render of @model into @image
+ * @zbuffer: width * height floats to reuse, or NULL
+ *
+ * Returns false when out of memory.
+ */
+static
+bool
+renderBuffered(struct model *model, TGA_Image *image, const struct render_options *opts, float *zbuffer)
+{
+    if (opts->wireframe != WIREFRAME_ONLY) {
+        if (opts->samples > 1) {
+            if (!renderMultisample(model, image, opts))
+                return false;
+        } else if (renderFaces(model, image, opts, 0.0, zbuffer) < 0) {
+            return false;
+        }
+    }
+
+    if (opts->wireframe != WIREFRAME_OFF) {
+        // match the snapping of the single sample rasterizer
+        struct vertex_stage vs = vertexStage(opts, image->width, image->height, opts->samples == 1);
+        WF_Draw(model, image, &vs, 0, TGA_ColorInit(255, 255, 255, 255));
+    }
+    return true;
+}
+
+/* Returns false when out of memory. */
+static
+bool
+render(struct model *model, TGA_Image *image, const struct render_options *opts)
+{
+    return renderBuffered(model, image, opts, NULL);
+}
+
+/**
+ * bandRows - rows per band for the band buffers to fit in @budget bytes
+ *
+ * A row takes the color, the depth and, with multisampling, the samples
+ * of every pixel. Never less than one row.
+ */
+static
+int
+bandRows(const struct render_options *opts, int width, int height, unsigned long budget)
+{
+    unsigned long depth = (opts->wireframe == WIREFRAME_ONLY) ? 0
+                        : (opts->samples > 1) ? opts->samples * (sizeof(float) + sizeof(unsigned int))
+                        : sizeof(float);
+    unsigned long row = (unsigned long)width * (RGB + depth);
+    return (int)MAX(1, MIN((unsigned long)height, budget / row));
+}
+
+/**
+ * renderBanded - render @model in horizontal bands streamed to @output
+ * @rows: rows per band, see bandRows
+ *
+ * Only one band of color, depth or multisample buffers is allocated, so
+ * the memory used for pixels scales with @rows instead of the image
+ * height. The faces are sorted into the bands they touch once, then each
+ * band is cleared, drawn from its own faces, flipped and written out
+ * before the next one starts. Faces keep their frame coordinates, the
+ * image is the same as the one render() would give. Returns false when
+ * out of memory or when the output can't be written.
+ */
+static
+bool
+renderBanded(struct model *model, int width, int height, const struct render_options *opts, int rows, const char *output)
+{
+    struct img_stream stream;
+    if (!IMG_StreamOpen(&stream, output, width, height, RGB))
+        return false;
+
+    const bool shaded = opts->wireframe != WIREFRAME_ONLY;
+    const int nbands = (height + rows - 1) / rows;
+    struct vertex_stage vs = vertexStage(opts, width, height, opts->samples == 1);
+    struct shade_stage ss = {0};
+    TGA_Image band = TGA_ImageInit(width, rows, RGB);
+    struct msaa_buffer msaa = {0};
+    float *zbuffer = NULL;
+    v3f *screen = NULL;
+    long *first = NULL;
+    int *faces = NULL;
+    bool result = band.data != NULL;
+
+    if (result && shaded) {
+        if (opts->samples > 1) {
+            result = MSAA_BufferInit(&msaa, width, rows, opts->samples);
+        } else {
+            zbuffer = (float *)malloc(sizeof(float) * width * rows);
+            result = zbuffer != NULL;
+        }
+        screen = projectModel(model, &vs);
+        first = (long *)malloc(sizeof(long) * (nbands + 1));
+        result = result && screen && first;
+        shadeStage(&ss, opts, model, width, height, false);
+    }
+
+    if (result && shaded)
+        result = binFaces(model, screen, height, rows, first, &faces);
+    if (!result)
+        fprintf(stderr, "Can't allocate the buffers for %d row bands\n", rows);
+
+    struct raster_tri tri = { .texture = &model->texture, .compressed = model->compressed };
+    for (int b = 0; result && b < nbands; b++) {
+        // the band's rows from the top, then its first row of the frame
+        const int y = b * rows;
+        TGA_Image view = { .data = band.data, .width = width, .height = MIN(rows, height - y), .bytespp = RGB };
+        const int top = height - y - view.height;
+        TGA_ImageClear(&view);
+
+        if (shaded) {
+            struct pf_span span = PF_Begin("raster");
+            struct raster_target target = {
+                .data = view.data,
+                .zbuffer = zbuffer,
+                .width = width,
+                .height = view.height,
+                .bytespp = RGB,
+                .top = top
+            };
+            if (zbuffer) {
+                RK_ClearDepth(zbuffer, (long)width * view.height);
+            } else {
+                msaa.height = view.height;
+                msaa.top = top;
+                MSAA_BufferClear(&msaa);
+            }
+            for (long k = first[b]; k < first[b + 1]; k++)
+                drawFace(model, faces[k], &vs, screen, &ss, zbuffer ? &target : NULL, &msaa, &tri);
+            PF_End(&span);
+
+            if (!zbuffer)
+                MSAA_Resolve(&msaa, &view);
+            TGA_ImageFlipVertically(&view);
+        }
+        if (opts->wireframe != WIREFRAME_OFF)
+            WF_Draw(model, &view, &vs, y, TGA_ColorInit(255, 255, 255, 255));
+
+        result = IMG_StreamWrite(&stream, &view);
+    }
+
+    result = IMG_StreamClose(&stream) && result;
+    shadeStageDelete(&ss);
+    free(faces);
+    free(first);
+    free(screen);
+    free(zbuffer);
+    MSAA_BufferDelete(&msaa);
+    TGA_ImageDelete(&band);
+    return result;
+}
+
+/**
+ * renderProgressive - render in passes of increasing resolution
+ * @budget: seconds allowed for the first, 1/8 resolution, pass
+ * @callback: called with the full size image after each pass
+ *
+ * The first pass stops drawing when the budget runs out, whatever the
+ * mesh size, so a coarse image is available after a few milliseconds; a
+ * quarter of the budget is kept for flipping and upscaling it. The
+ * following passes render at 1/4, 1/2 and full resolution, the coarse
+ * passes are upscaled into @image. Returns false when the full resolution
+ * pass is out of memory, a coarse pass that is just gets skipped.
+ */
+static
+bool
+renderProgressive(struct model *model, TGA_Image *image, const struct render_options *opts, double budget, progress_fn callback, void *user)
+{
+    static const int scales[] = { 8, 4, 2, 1 };
+    double deadline = T_Now() + budget * 0.75;
+
+    for (int pass = 0; pass < (int)(sizeof(scales) / sizeof(scales[0])); pass++) {
+        int scale = scales[pass];
+        if (scale == 1) {
+            TGA_ImageClear(image);
+            if (!render(model, image, opts))
+                return false;
+        } else {
+            TGA_Image coarse = TGA_ImageInit(MAX(1, image->width / scale), MAX(1, image->height / scale), image->bytespp);
+            if (!coarse.data)
+                continue;
+            int drawn = renderFaces(model, &coarse, opts, pass ? 0.0 : deadline, NULL);
+            if (!pass && drawn < model->nfaces)
+                fprintf(stderr, "# coarse pass drew %d of %d faces\n", drawn, model->nfaces);
+            IOP_Resize(&coarse, image, IOP_NEAREST);
+            TGA_ImageDelete(&coarse);
+        }
+        callback(image, pass, scale, user);
+    }
+    return true;
+}
+
+/**
+ * renderSequence - render a turntable and stream the raw frames
+ * @opts: yaw is the starting angle, one full turn is spread over @frames
+ * @file: stdout or an opened file/FIFO
+ *
+ * Frame n+1 is rendered while the writer thread is still writing frame n.
+ * Single sample frames are drawn against the faces the previous one saw,
+ * see visibility_cache.
+ */
+static
+bool
+renderSequence(struct model *model, int width, int height, struct render_options opts, int frames, FILE *file, bool alpha)
+{
+    struct frame_stream stream;
+    if (!FS_Init(&stream, file, width, height, RGB, alpha))
+        return false;
+
+    struct visibility_cache cache = {0};
+    if (opts.samples == 1 && opts.wireframe != WIREFRAME_ONLY && visibilityCacheInit(&cache, model))
+        opts.visibility = &cache;
+
+    const float start = opts.yaw;
+    double render_time = 0.0;
+    double begin = T_Now();
+    bool result = true;
+    for (int i = 0; result && i < frames; i++) {
+        TGA_Image *image = FS_Acquire(&stream);
+
+        double t = T_Now();
+        opts.yaw = start + 2.0f * (float)M_PI * i / frames;
+        bool drawn = render(model, image, &opts);
+        render_time += T_Now() - t;
+
+        result = FS_Submit(&stream) && drawn;
+    }
+    result = FS_Close(&stream) && result;
+
+    double total = T_Now() - begin;
+    fprintf(stderr, "# %d frames in %.3f s (%.1f fps), render %.3f s, write %.3f s\n",
+            stream.written, total, stream.written / total, render_time, stream.write_time);
+    if (cache.frames > 0)
+        fprintf(stderr, "# visibility %ld of %d frames culled, %.0f occluders per frame, %.1f%% of the faces\n",
+                cache.frames, stream.written, (double)cache.occluders / cache.frames,
+                100.0 * cache.culled / MAX(cache.draws, 1));
+    visibilityCacheDelete(&cache);
+    return result;
+}
+
+/**
+ * pickPixels - the face under each of @n @pixels of a render with @opts
+ * @pixels: x, y of the pixel, rows counted from the top like the image
+ * @hits: face -1 where the background shows, see BV_HitUV for the texture
+ *
+ * Casts a ray through the center of each pixel, the nearest face wins like
+ * in the z-buffer. Single sample renders snap the vertices to whole pixels,
+ * so along the edges of faces a pick can be the neighbour of the face
+ * drawn. Returns false when out of memory.
+ */
+static
+bool
+pickPixels(const struct bvh *bvh, int width, int height, const struct render_options *opts,
+           const v2i *pixels, struct bvh_hit *hits, long n)
+{
+    struct bvh_ray *rays = (struct bvh_ray *)malloc(sizeof(struct bvh_ray) * MAX(n, 1));
+    if (!rays)
+        return false;
+
+    // start in front of the whole model, looking down z into the screen
+    const struct vertex_stage vs = vertexStage(opts, width, height, false);
+    float front = 1.0f;
+    if (bvh->nnodes) {
+        const struct bvh_node *root = bvh->nodes;
+        const v3f far = V3_float(MAX(fabsf(root->lo[0]), fabsf(root->hi[0])), MAX(fabsf(root->lo[1]), fabsf(root->hi[1])),
+                                 MAX(fabsf(root->lo[2]), fabsf(root->hi[2])));
+        front += sqrtf(DotV3_float(far, far));
+    }
+    // the inverse of the rotation in projectVertex
+    const v3f dir = rotateY(V3_float(0.0f, 0.0f, -1.0f), vs.cy, -vs.sy);
+    for (long i = 0; i < n; i++) {
+        const float x = (2.0f * pixels[i].x / width - 1.0f - vs.offset.x) / vs.scale;
+        const float y = (2.0f * (height - 1 - pixels[i].y) / height - 1.0f - vs.offset.y) / vs.scale;
+        rays[i] = (struct bvh_ray){
+            .origin = rotateY(V3_float(x, y, front), vs.cy, -vs.sy),
+            .tmin = 0.0f,
+            .dir = dir,
+            .tmax = FLT_MAX
+        };
+    }
+    BV_Intersect(bvh, rays, hits, n);
+    free(rays);
+    return true;
+}
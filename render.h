@@ -0,0 +1,117 @@
+/**
+ * Rendering pipeline: vertex stage, single sample, multisample,
+ * progressive and sequence renders of a model into a TGA_Image, and
+ * banded renders streamed to a file for images too large to hold.
+ */
+#ifndef _RENDER_h_
+#include "wireframe.h"
+
+/* Where lighting is evaluated. SHADE_AUTO picks by output size: per vertex
+ * for thumbnails above SHADE_ICON and up to SHADE_THUMBNAIL pixels, per
+ * face otherwise, so full size renders keep the flat lighting unless asked.
+ * Models without vertex normals are always lit per face. */
+enum shade_rate {
+    SHADE_AUTO = 0,
+    SHADE_FACE,                 // one intensity from the face normal
+    SHADE_VERTEX,               // vertex normals lit, interpolated (Gouraud)
+    SHADE_PIXEL,                // vertex normals interpolated, lit (Phong)
+};
+
+#define SHADE_ICON 64
+#define SHADE_THUMBNAIL 256
+
+#define RENDER_STRIPE_ROWS 16   // least rows of a stripe drawn by one task
+
+struct render_options {
+    int samples;    // 1 (no anti-aliasing), 4 or 8
+    float yaw;      // rotation of the model around the y axis, in radians
+    int wireframe;  // render_wireframe
+    int shading;    // shade_rate
+    struct visibility_cache *visibility;    // single sample sequences, or NULL
+};
+
+#define VISIBILITY_TILE 8       // pixels on a side of a culling tile
+#define VISIBILITY_RETRY 8      // frames drawn plainly after culling didn't pay
+
+/* Per sequence record of the faces that wrote pixels in the last frame.
+ * They're drawn first into the depth of the next one, then faces behind
+ * them as a whole are skipped and the others only shaded where they're
+ * in front, which leaves the image unchanged. Models that hide little of
+ * themselves cost more to prime than they save, so when a frame culls no
+ * more faces than it primed the next VISIBILITY_RETRY are drawn plainly,
+ * only keeping the record. */
+struct visibility_cache {
+    int nfaces;
+    unsigned char *last;        // per face, wrote a pixel in the last frame
+    unsigned char *next;        // filled while drawing the current frame
+    int visible;                // faces set in last, -1 before the first frame
+    int skip;                   // frames left to draw without priming
+    long frames;                // drawn against the cache
+    long occluders;             // faces drawn first, over those frames
+    long draws;                 // faces drawn in a stripe, culled or not
+    long culled;                // of those, behind the occluders as a whole
+};
+
+/* Per render state of the vertex stage. */
+struct vertex_stage {
+    float cy, sy;       // cos and sin of the yaw
+    float scale;        // applied after the rotation, then the offset
+    v3f offset;
+    int width;
+    int height;
+    bool snap;          // round screen positions down to whole pixels
+};
+
+/* Per render lighting of the model's vertex normals. */
+struct shade_stage {
+    int rate;           // shade_rate, never SHADE_AUTO
+    v3f light;          // towards the viewer, times the strength
+    float cy, sy;       // cos and sin of the yaw
+    v3f *normals;       // model->norms rotated and normalized, NULL to light them per face
+    float *intensity;   // SHADE_VERTEX, the light at each normal
+};
+
+static inline
+v3f
+rotateY(v3f v, float c, float s)
+{
+    return V3_float(c * v.x + s * v.z, v.y, c * v.z - s * v.x);
+}
+
+static inline
+struct vertex_stage
+vertexStage(const struct render_options *opts, int width, int height, bool snap)
+{
+    struct vertex_stage result = {
+        .cy = cosf(opts->yaw),
+        .sy = sinf(opts->yaw),
+        .scale = 1.0f,
+        .offset = V3_float(0.0f, 0.0f, 0.0f),
+        .width = width,
+        .height = height,
+        .snap = snap
+    };
+    return result;
+}
+
+/**
+ * projectVertex - model space to screen space, before the vertical flip
+ */
+static inline
+v3f
+projectVertex(const struct vertex_stage *vs, v3f v)
+{
+    v = AddV3_float(MulV3_float(vs->scale, rotateY(v, vs->cy, vs->sy)), vs->offset);
+    if (vs->snap) {
+        int x = (v.x + 1.0f) * vs->width / 2.0f;
+        int y = (v.y + 1.0f) * vs->height / 2.0f;
+        return V3_float(x, y, v.z);
+    }
+    // keep subpixel precision, the pixel center sits on the integer
+    return V3_float((v.x + 1.0f) * vs->width / 2.0f, (v.y + 1.0f) * vs->height / 2.0f, v.z);
+}
+
+typedef void (*progress_fn)(TGA_Image *image, int pass, int scale, void *user);
+
+#define _RENDER_h_
+#endif
@@ -0,0 +1,35 @@
+/**
+ * The vertex transform of one instruction set, included once per cpu_isa
+ * by render.c (so there is no include guard) between the target pragmas
+ * of that set. Expects VS_ISA(name), the name suffixed with the set.
+ *
+ * Same arithmetic as projectVertex, written as loops without calls or
+ * branches so that the compiler vectorizes them for the set.
+ */
+static
+void
+VS_ISA(projectVertices)(const struct vertex_stage *vs, const v3f *restrict in, v3f *restrict out, int n)
+{
+    const float cy = vs->cy, sy = vs->sy, scale = vs->scale;
+    const float ox = vs->offset.x, oy = vs->offset.y, oz = vs->offset.z;
+    const float width = vs->width, height = vs->height;
+    if (vs->snap) {
+        for (int i = 0; i < n; i++) {
+            const float x = scale * (cy * in[i].x + sy * in[i].z) + ox;
+            const float y = scale * in[i].y + oy;
+            out[i].x = (int)((x + 1.0f) * width / 2.0f);
+            out[i].y = (int)((y + 1.0f) * height / 2.0f);
+            out[i].z = scale * (cy * in[i].z - sy * in[i].x) + oz;
+        }
+    } else {
+        for (int i = 0; i < n; i++) {
+            const float x = scale * (cy * in[i].x + sy * in[i].z) + ox;
+            const float y = scale * in[i].y + oy;
+            out[i].x = (x + 1.0f) * width / 2.0f;
+            out[i].y = (y + 1.0f) * height / 2.0f;
+            out[i].z = scale * (cy * in[i].z - sy * in[i].x) + oz;
+        }
+    }
+}
+
+#undef VS_ISA
@@ -0,0 +1,254 @@
+#include "scene.h"
+
+static
+void
+SC_Init(struct scene *scene)
+{
+    memset(scene, 0, sizeof(struct scene));
+}
+
+static
+void
+SC_Delete(struct scene *scene)
+{
+    for (int i = 0; i < scene->nmodels; i++) {
+        ModelDelete(&scene->models[i]->model);
+        free(scene->models[i]);
+    }
+    free(scene->models);
+    free(scene->instances);
+    memset(scene, 0, sizeof(struct scene));
+}
+
+/**
+ * SC_AddModel - index of the model at @path, loading it on first use
+ *
+ * Returns the index, or the model_error of the load.
+ */
+static
+int
+SC_AddModel(struct scene *scene, const char *path)
+{
+    for (int i = 0; i < scene->nmodels; i++) {
+        if (!strcmp(scene->models[i]->path, path))
+            return i;
+    }
+
+    if (scene->nmodels == scene->models_capacity) {
+        int capacity = MAX(8, scene->models_capacity * 2);
+        struct scene_model **models = realloc(scene->models, sizeof(*models) * capacity);
+        if (!models)
+            return MODEL_ERR_MEMORY;
+        scene->models = models;
+        scene->models_capacity = capacity;
+    }
+
+    // models are allocated one by one, they hold a mutex and must not move
+    struct scene_model *entry = (struct scene_model *)calloc(1, sizeof(struct scene_model));
+    if (!entry)
+        return MODEL_ERR_MEMORY;
+    snprintf(entry->path, sizeof(entry->path), "%s", path);
+    int error = ModelInit(&entry->model, path);
+    if (error != MODEL_OK) {
+        free(entry);
+        return error;
+    }
+
+    scene->models[scene->nmodels] = entry;
+    return scene->nmodels++;
+}
+
+static
+bool
+SC_AddInstance(struct scene *scene, int model, v3f offset, float yaw, float scale)
+{
+    if (model < 0 || model >= scene->nmodels)
+        return false;
+
+    if (scene->ninstances == scene->instances_capacity) {
+        int capacity = MAX(16, scene->instances_capacity * 2);
+        struct scene_instance *instances = realloc(scene->instances, sizeof(*instances) * capacity);
+        if (!instances)
+            return false;
+        scene->instances = instances;
+        scene->instances_capacity = capacity;
+    }
+
+    scene->instances[scene->ninstances++] = (struct scene_instance){
+        .model = model, .offset = offset, .yaw = yaw, .scale = scale
+    };
+    return true;
+}
+
+/**
+ * SC_Load - add the instances of a scene file to @scene
+ *
+ * Relative model paths are taken from the directory of the scene file.
+ */
+static
+bool
+SC_Load(struct scene *scene, const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Can't open file %s\n", filename);
+        return false;
+    }
+
+    const char *slash = strrchr(filename, '/');
+    int dirlen = slash ? (int)(slash - filename + 1) : 0;
+
+    char line[1024];
+    bool result = true;
+    for (int n = 1; result && fgets(line, sizeof(line), file); n++) {
+        char *comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+
+        char name[512];
+        v3f offset;
+        float yaw = 0.0f, scale = 1.0f;
+        int fields = sscanf(line, "%511s %f %f %f %f %f", name, &offset.x, &offset.y, &offset.z, &yaw, &scale);
+        if (fields <= 0)
+            continue;
+        if (fields < 4 || !(scale > 0.0f)) {
+            fprintf(stderr, "%s:%d: expected <model.obj> <x> <y> <z> [yaw] [scale]\n", filename, n);
+            result = false;
+            break;
+        }
+
+        char path[1024];
+        snprintf(path, sizeof(path), "%.*s%s", name[0] == '/' ? 0 : dirlen, filename, name);
+        int model = SC_AddModel(scene, path);
+        if (model < 0) {
+            fprintf(stderr, "%s:%d: can't load the model %s\n", filename, n, path);
+            result = false;
+        } else if (!SC_AddInstance(scene, model, offset, yaw, scale)) {
+            result = false;
+        }
+    }
+
+    fclose(file);
+    return result;
+}
+
+/**
+ * SC_Faces - faces drawn for the whole scene
+ */
+static
+long
+SC_Faces(const struct scene *scene)
+{
+    long result = 0;
+    for (int i = 0; i < scene->ninstances; i++)
+        result += scene->models[scene->instances[i].model]->model.nfaces;
+    return result;
+}
+
+struct sc_order {
+    float z;
+    int instance;
+};
+
+static
+int
+SC_CompareNearest(const void *a, const void *b)
+{
+    const struct sc_order *x = (const struct sc_order *)a, *y = (const struct sc_order *)b;
+    if (x->z != y->z)
+        return (x->z < y->z) - (x->z > y->z);
+    return x->instance - y->instance;
+}
+
+/**
+ * SC_InstanceStage - vertex stage and options of one instance
+ */
+static
+struct vertex_stage
+SC_InstanceStage(const struct scene_instance *instance, const struct render_options *opts,
+                 struct render_options *instance_opts, int width, int height)
+{
+    *instance_opts = *opts;
+    instance_opts->yaw += instance->yaw;
+    struct vertex_stage vs = vertexStage(instance_opts, width, height, opts->samples == 1);
+    vs.scale = instance->scale;
+    vs.offset = instance->offset;
+    return vs;
+}
+
+/**
+ * renderScene - render every instance of @scene into @image
+ *
+ * Instances are drawn nearest first by their offset. Each instance picks
+ * its own shade_rate from its size on screen, so small ones in a large
+ * image are lit like thumbnails.
+ */
+static
+bool
+renderScene(struct scene *scene, TGA_Image *image, const struct render_options *opts)
+{
+    const int width = image->width, height = image->height;
+    struct sc_order *order = (struct sc_order *)malloc(sizeof(struct sc_order) * MAX(scene->ninstances, 1));
+    if (!order)
+        return false;
+    for (int i = 0; i < scene->ninstances; i++)
+        order[i] = (struct sc_order){ .z = scene->instances[i].offset.z, .instance = i };
+    qsort(order, scene->ninstances, sizeof(struct sc_order), SC_CompareNearest);
+
+    struct msaa_buffer buffer = {0};
+    float *zbuffer = NULL;
+    if (opts->wireframe != WIREFRAME_ONLY) {
+        if (opts->samples > 1) {
+            if (!MSAA_BufferInit(&buffer, width, height, opts->samples)) {
+                fprintf(stderr, "Can't allocate a %dx multisample buffer\n", opts->samples);
+                free(order);
+                return false;
+            }
+        } else {
+            zbuffer = (float *)malloc(sizeof(float) * width * height);
+            if (!zbuffer) {
+                free(order);
+                return false;
+            }
+            RK_ClearDepth(zbuffer, (long)width * height);
+        }
+
+        struct raster_target target = {
+            .data = image->data,
+            .zbuffer = zbuffer,
+            .width = width,
+            .height = height,
+            .bytespp = image->bytespp
+        };
+        for (int k = 0; k < scene->ninstances; k++) {
+            const struct scene_instance *instance = &scene->instances[order[k].instance];
+            struct model *model = &scene->models[instance->model]->model;
+            struct render_options instance_opts;
+            struct vertex_stage vs = SC_InstanceStage(instance, opts, &instance_opts, width, height);
+
+            struct shade_stage ss;
+            shadeStage(&ss, &instance_opts, model, width * instance->scale, height * instance->scale, false);
+            drawFaces(model, &vs, &ss, zbuffer ? &target : NULL, &buffer, 0.0, NULL);
+            shadeStageDelete(&ss);
+        }
+
+        if (opts->samples > 1) {
+            MSAA_Resolve(&buffer, image);
+            MSAA_BufferDelete(&buffer);
+        }
+        TGA_ImageFlipVertically(image);
+    }
+
+    if (opts->wireframe != WIREFRAME_OFF) {
+        for (int k = 0; k < scene->ninstances; k++) {
+            const struct scene_instance *instance = &scene->instances[order[k].instance];
+            struct render_options instance_opts;
+            struct vertex_stage vs = SC_InstanceStage(instance, opts, &instance_opts, width, height);
+            WF_Draw(&scene->models[instance->model]->model, image, &vs, 0, TGA_ColorInit(255, 255, 255, 255));
+        }
+    }
+
+    free(zbuffer);
+    free(order);
+    return true;
+}
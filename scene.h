@@ -0,0 +1,41 @@
+/**
+ * Instanced scenes.
+ *
+ * A scene is a list of instances, each a scale, yaw and offset applied to
+ * a model. Every model file is loaded once and shared by all of its
+ * instances. renderScene draws all of them into one framebuffer and
+ * z-buffer, nearest instances first so that the depth test rejects the
+ * hidden pixels of the later ones before they are textured and lit.
+ *
+ * Scene files have one instance per line, '#' starts a comment:
+ *
+ *      <model.obj> <x> <y> <z> [yaw=0] [scale=1]
+ *
+ * x, y and z are in the same [-1, 1] space as the model coordinates, with
+ * larger z closer to the viewer; yaw is in radians.
+ */
+#ifndef _SCENE_h_
+
+struct scene_model {
+    char path[1024];
+    struct model model;
+};
+
+struct scene_instance {
+    int model;                  // index into scene->models
+    v3f offset;
+    float yaw;                  // added to the render_options yaw
+    float scale;
+};
+
+struct scene {
+    struct scene_model **models;
+    int nmodels;
+    int models_capacity;
+    struct scene_instance *instances;
+    int ninstances;
+    int instances_capacity;
+};
+
+#define _SCENE_h_
+#endif
@@ -0,0 +1,468 @@
+#include <errno.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "server.h"
+
+static struct model_cache MC_Cache = {
+    .lru = LIST_HEAD_INIT(MC_Cache.lru),
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static struct srv_stats SRV_Stats = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static
+void
+__MC_Free(struct mc_entry *entry)
+{
+    ModelDelete(&entry->model);
+    free(entry);
+}
+
+/**
+ * Drop unreferenced entries from the tail while over MC_MAX_MODELS or
+ * MC_DEFAULT_BUDGET. Needs the lock.
+ */
+static
+void
+__MC_Evict(void)
+{
+    struct mc_entry *entry, *temp;
+    for (entry = LIST_ENTRY(MC_Cache.lru.prev, struct mc_entry, head),
+         temp = LIST_ENTRY(entry->head.prev, struct mc_entry, head);
+         &entry->head != &MC_Cache.lru
+            && (MC_Cache.entries > MC_MAX_MODELS || MC_Cache.bytes > MC_DEFAULT_BUDGET);
+         entry = temp, temp = LIST_ENTRY(temp->head.prev, struct mc_entry, head)) {
+        if (entry->refs)
+            continue;
+        L_ListDelInit(&entry->head);
+        MC_Cache.entries--;
+        MC_Cache.bytes -= entry->bytes;
+        __MC_Free(entry);
+    }
+}
+
+/**
+ * Find a live entry for @path and take a reference, unlinking stale ones.
+ * Needs the lock.
+ */
+static
+struct mc_entry *
+__MC_Lookup(const char *path, struct timespec mtime)
+{
+    struct mc_entry *entry, *temp;
+    LIST_FOR_EACH_ENTRY_SAFE(entry, temp, &MC_Cache.lru, head) {
+        if (strcmp(entry->path, path))
+            continue;
+
+        if (entry->mtime.tv_sec == mtime.tv_sec && entry->mtime.tv_nsec == mtime.tv_nsec) {
+            entry->refs++;
+            L_ListMove(&entry->head, &MC_Cache.lru);
+            return entry;
+        }
+
+        L_ListDelInit(&entry->head);
+        MC_Cache.entries--;
+        MC_Cache.bytes -= entry->bytes;
+        if (entry->refs)
+            entry->stale = true;
+        else
+            __MC_Free(entry);
+    }
+    return NULL;
+}
+
+/**
+ * MC_Acquire - get the loaded model at @path
+ *
+ * Returns a referenced entry to release with MC_Release, or NULL with
+ * @error set to the model_error.
+ */
+static
+struct mc_entry *
+MC_Acquire(const char *path, int *error)
+{
+    struct stat st;
+    if (stat(path, &st) == -1) {
+        *error = MODEL_ERR_OPEN;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&MC_Cache.lock);
+    struct mc_entry *entry = __MC_Lookup(path, st.st_mtim);
+    if (entry) {
+        MC_Cache.hits++;
+        pthread_mutex_unlock(&MC_Cache.lock);
+        return entry;
+    }
+    MC_Cache.misses++;
+    pthread_mutex_unlock(&MC_Cache.lock);
+
+    struct mc_entry *loaded = (struct mc_entry *)calloc(1, sizeof(struct mc_entry));
+    if (!loaded) {
+        *error = MODEL_ERR_MEMORY;
+        return NULL;
+    }
+    if ((*error = ModelInit(&loaded->model, path)) != MODEL_OK) {
+        free(loaded);
+        return NULL;
+    }
+    ModelReport(&loaded->model, stderr);
+    // resident models are kept quantized
+    if ((*error = ModelCompact(&loaded->model)) != MODEL_OK) {
+        __MC_Free(loaded);
+        return NULL;
+    }
+    loaded->bytes = ModelBytes(&loaded->model);
+    snprintf(loaded->path, sizeof(loaded->path), "%s", path);
+    loaded->mtime = st.st_mtim;
+    loaded->refs = 1;
+    INIT_LIST_HEAD(&loaded->head);
+
+    pthread_mutex_lock(&MC_Cache.lock);
+    entry = __MC_Lookup(path, st.st_mtim);
+    if (entry) {
+        __MC_Free(loaded);
+    } else {
+        entry = loaded;
+        L_ListAdd(&entry->head, &MC_Cache.lru);
+        MC_Cache.entries++;
+        MC_Cache.bytes += entry->bytes;
+        __MC_Evict();
+    }
+    pthread_mutex_unlock(&MC_Cache.lock);
+
+    return entry;
+}
+
+static
+void
+MC_Release(struct mc_entry *entry)
+{
+    pthread_mutex_lock(&MC_Cache.lock);
+    if (--entry->refs == 0) {
+        if (entry->stale)
+            __MC_Free(entry);
+        else
+            __MC_Evict();
+    }
+    pthread_mutex_unlock(&MC_Cache.lock);
+}
+
+static
+void
+SRV_Record(double latency, bool ok)
+{
+    pthread_mutex_lock(&SRV_Stats.lock);
+    SRV_Stats.requests++;
+    if (!ok) {
+        SRV_Stats.errors++;
+    } else {
+        SRV_Stats.total += latency;
+        SRV_Stats.max = MAX(SRV_Stats.max, latency);
+        SRV_Stats.window[SRV_Stats.next] = latency;
+        SRV_Stats.next = (SRV_Stats.next + 1) % SRV_LATENCY_WINDOW;
+        SRV_Stats.filled = MIN(SRV_Stats.filled + 1, SRV_LATENCY_WINDOW);
+    }
+    pthread_mutex_unlock(&SRV_Stats.lock);
+}
+
+static
+int
+SRV_CompareDouble(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static
+void
+SRV_ReplyStats(struct srv_client *client)
+{
+    double window[SRV_LATENCY_WINDOW];
+
+    pthread_mutex_lock(&SRV_Stats.lock);
+    unsigned long requests = SRV_Stats.requests;
+    unsigned long errors = SRV_Stats.errors;
+    unsigned long ok = requests - errors;
+    double mean = ok ? SRV_Stats.total / ok : 0.0;
+    double max = SRV_Stats.max;
+    int n = SRV_Stats.filled;
+    memcpy(window, SRV_Stats.window, sizeof(double) * n);
+    pthread_mutex_unlock(&SRV_Stats.lock);
+
+    qsort(window, n, sizeof(double), SRV_CompareDouble);
+    double p50 = n ? window[(n - 1) * 50 / 100] : 0.0;
+    double p90 = n ? window[(n - 1) * 90 / 100] : 0.0;
+    double p99 = n ? window[(n - 1) * 99 / 100] : 0.0;
+
+    pthread_mutex_lock(&MC_Cache.lock);
+    int models = MC_Cache.entries;
+    unsigned long model_bytes = MC_Cache.bytes;
+    unsigned long model_hits = MC_Cache.hits;
+    unsigned long model_misses = MC_Cache.misses;
+    pthread_mutex_unlock(&MC_Cache.lock);
+
+    struct tc_stats tc;
+    TC_GetStats(&tc);
+
+    fprintf(client->out, "ok requests=%lu errors=%lu mean=%.3f p50=%.3f p90=%.3f p99=%.3f max=%.3f "
+            "models=%d model_bytes=%lu model_hits=%lu model_misses=%lu texture_hits=%lu texture_misses=%lu "
+            "texture_bytes=%lu texture_saved=%lu isa=%s\n",
+            requests, errors, mean * 1e3, p50 * 1e3, p90 * 1e3, p99 * 1e3, max * 1e3,
+            models, model_bytes, model_hits, model_misses, tc.hits, tc.misses, tc.bytes, tc.saved,
+            CPU_IsaNames[CPU_Isa]);
+}
+
+/**
+ * SRV_Render - handle a render request, @args are the key=value tokens
+ *
+ * Returns false with @error set when the request fails.
+ */
+static
+bool
+SRV_Render(struct srv_client *client, char *args, const char **error)
+{
+    const char *model_path = NULL;
+    const char *output = NULL;
+    int width = 800, height = 800;
+    struct render_options opts = { .samples = 1, .yaw = 0.0f, .wireframe = WIREFRAME_OFF,
+                                   .shading = SHADE_AUTO };
+
+    char *save;
+    for (char *tok = strtok_r(args, " \t\r\n", &save); tok; tok = strtok_r(NULL, " \t\r\n", &save)) {
+        char *value = strchr(tok, '=');
+        if (!value) {
+            *error = "expected key=value";
+            return false;
+        }
+        *value++ = '\0';
+
+        if (!strcmp(tok, "model"))
+            model_path = value;
+        else if (!strcmp(tok, "output"))
+            output = value;
+        else if (!strcmp(tok, "width"))
+            width = atoi(value);
+        else if (!strcmp(tok, "height"))
+            height = atoi(value);
+        else if (!strcmp(tok, "yaw"))
+            opts.yaw = atof(value);
+        else if (!strcmp(tok, "samples"))
+            opts.samples = atoi(value);
+        else if (!strcmp(tok, "wireframe"))
+            opts.wireframe = !strcmp(value, "only") ? WIREFRAME_ONLY
+                           : !strcmp(value, "overlay") ? WIREFRAME_OVERLAY : WIREFRAME_OFF;
+        else if (!strcmp(tok, "shading"))
+            opts.shading = shadeRateParse(value);
+        else {
+            *error = "unknown key";
+            return false;
+        }
+    }
+
+    if (!model_path || !output) {
+        *error = "model and output are required";
+        return false;
+    }
+    if (width < 1 || height < 1 || width > SRV_MAX_DIMENSION || height > SRV_MAX_DIMENSION) {
+        *error = "bad width/height";
+        return false;
+    }
+    if (opts.samples != 1 && opts.samples != 4 && opts.samples != 8) {
+        *error = "samples must be 1, 4 or 8";
+        return false;
+    }
+    if (opts.shading < 0) {
+        *error = "shading must be auto, face, vertex or pixel";
+        return false;
+    }
+    if (!IMG_FindWriter(output)) {
+        *error = "unknown output format";
+        return false;
+    }
+
+    double start = T_Now();
+    struct pf_span span = PF_Begin("request");
+    int result;
+    struct mc_entry *entry = MC_Acquire(model_path, &result);
+    if (!entry) {
+        *error = (result == MODEL_ERR_OPEN) ? "can't open the model"
+               : (result == MODEL_ERR_TEXTURE) ? "can't load the texture"
+               : (result == MODEL_ERR_FORMAT) ? "bad model data"
+               : "can't load the model";
+        return false;
+    }
+    double loaded = T_Now();
+
+    // the framebuffer and z-buffer stay around for the next request
+    if (client->image.width != width || client->image.height != height) {
+        TGA_ImageDelete(&client->image);
+        client->image = TGA_ImageInit(width, height, RGB);
+    } else {
+        TGA_ImageClear(&client->image);
+    }
+    if (client->zcapacity < (long)width * height) {
+        free(client->zbuffer);
+        client->zcapacity = (long)width * height;
+        client->zbuffer = (float *)malloc(sizeof(float) * client->zcapacity);
+    }
+    if (!client->image.data || !client->zbuffer) {
+        TGA_ImageDelete(&client->image);
+        free(client->zbuffer);
+        client->zbuffer = NULL;
+        client->zcapacity = 0;
+        MC_Release(entry);
+        *error = "out of memory";
+        return false;
+    }
+
+    if (!renderBuffered(&entry->model, &client->image, &opts, client->zbuffer)) {
+        MC_Release(entry);
+        *error = "out of memory";
+        return false;
+    }
+    MC_Release(entry);
+    double rendered = T_Now();
+
+    if (!IMG_WriteFile(&client->image, output)) {
+        *error = "can't write the output";
+        return false;
+    }
+    double done = T_Now();
+    PF_End(&span);
+
+    fprintf(client->out, "ok total=%.3f load=%.3f render=%.3f encode=%.3f\n",
+            (done - start) * 1e3, (loaded - start) * 1e3, (rendered - loaded) * 1e3, (done - rendered) * 1e3);
+    SRV_Record(done - start, true);
+    return true;
+}
+
+/**
+ * SRV_Serve - answer requests from @client until quit or end of input
+ */
+static
+void
+SRV_Serve(struct srv_client *client)
+{
+    char line[4096];
+    while (fgets(line, sizeof(line), client->in)) {
+        char *command = line + strspn(line, " \t\r\n");
+        char *args = command + strcspn(command, " \t\r\n");
+        if (*args)
+            *args++ = '\0';
+        if (!*command)
+            continue;
+
+        if (!strcmp(command, "render")) {
+            const char *error = NULL;
+            if (!SRV_Render(client, args, &error)) {
+                fprintf(client->out, "error %s\n", error);
+                SRV_Record(0.0, false);
+            }
+        } else if (!strcmp(command, "stats")) {
+            SRV_ReplyStats(client);
+        } else if (!strcmp(command, "quit")) {
+            fprintf(client->out, "ok\n");
+            fflush(client->out);
+            break;
+        } else {
+            fprintf(client->out, "error unknown command\n");
+        }
+        fflush(client->out);
+    }
+
+    TGA_ImageDelete(&client->image);
+    free(client->zbuffer);
+    client->zbuffer = NULL;
+    client->zcapacity = 0;
+}
+
+static
+void *
+SRV_ClientThread(void *arg)
+{
+    struct srv_client *client = (struct srv_client *)arg;
+    SRV_Serve(client);
+    fclose(client->in);
+    fclose(client->out);
+    free(client);
+    return NULL;
+}
+
+/**
+ * SRV_Run - serve stdin/stdout when @path is "-", else listen on the Unix
+ * domain socket at @path with one thread per connection
+ *
+ * Only returns on errors, or at the end of stdin.
+ */
+static
+int
+SRV_Run(const char *path)
+{
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!strcmp(path, "-")) {
+        struct srv_client client = { .in = stdin, .out = stdout };
+        SRV_Serve(&client);
+        return 0;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 || listen(fd, 16) == -1) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    fprintf(stderr, "# listening on %s\n", path);
+
+    useconds_t backoff = 0;
+    for (;;) {
+        int conn = accept(fd, NULL, NULL);
+        if (conn == -1) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            // out of descriptors or memory, wait for clients to finish instead of spinning
+            if (!backoff)
+                perror("accept");
+            backoff = MIN(MAX(2 * backoff, SRV_ACCEPT_BACKOFF_MIN), SRV_ACCEPT_BACKOFF_MAX);
+            usleep(backoff);
+            continue;
+        }
+        backoff = 0;
+
+        struct srv_client *client = (struct srv_client *)calloc(1, sizeof(struct srv_client));
+        int conn2 = dup(conn);
+        if (client && conn2 != -1) {
+            client->in = fdopen(conn, "r");
+            client->out = fdopen(conn2, "w");
+        }
+        pthread_t thread;
+        if (!client || !client->in || !client->out
+                || pthread_create(&thread, NULL, SRV_ClientThread, client) != 0) {
+            fprintf(stderr, "Can't serve a new connection\n");
+            if (client && client->in) fclose(client->in); else close(conn);
+            if (client && client->out) fclose(client->out); else if (conn2 != -1) close(conn2);
+            free(client);
+            continue;
+        }
+        pthread_detach(thread);
+    }
+
+    close(fd);
+    return 0;
+}
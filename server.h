@@ -0,0 +1,76 @@
+/**
+ * Render server.
+ *
+ * Listens on a Unix domain socket, or reads stdin, for one request per
+ * line and answers each with one line. Parsed models stay resident in a
+ * model cache, packed with ModelCompact and bounded by MC_MAX_MODELS and
+ * MC_DEFAULT_BUDGET bytes, textures in the texture cache and every connection keeps
+ * its framebuffer and z-buffer between requests. Each connection is served
+ * by its own thread.
+ *
+ *      render model=<obj> output=<file> [width=800] [height=800]
+ *             [yaw=<radians>] [samples=1|4|8] [wireframe=off|only|overlay]
+ *             [shading=auto|face|vertex|pixel]
+ *          -> ok total=<ms> load=<ms> render=<ms> encode=<ms>
+ *      stats
+ *          -> ok requests=<n> errors=<n> mean=<ms> p50=<ms> p90=<ms>
+ *             p99=<ms> max=<ms> models=<n> model_bytes=<n> model_hits=<n> model_misses=<n>
+ *             texture_hits=<n> texture_misses=<n> texture_bytes=<n>
+ *             texture_saved=<n> isa=sse2|avx2|avx512
+ *      quit
+ *
+ * Failures are answered with "error <message>". Percentiles cover the
+ * last SRV_LATENCY_WINDOW requests.
+ */
+#ifndef _SERVER_h_
+#include <pthread.h>
+#include <sys/stat.h>
+#include "list.h"
+
+#define MC_MAX_MODELS 256
+#define MC_DEFAULT_BUDGET (256ul << 20)
+#define SRV_LATENCY_WINDOW 1024
+#define SRV_ACCEPT_BACKOFF_MIN 1000     // us, first wait after accept() fails
+#define SRV_ACCEPT_BACKOFF_MAX 1000000  // us, the waits double up to this
+#define SRV_MAX_DIMENSION 16384
+
+struct mc_entry {
+    struct list_head head;      // in the LRU list, most recently used first
+    char path[512];
+    struct timespec mtime;
+    struct model model;         // shared read-only between renders
+    unsigned long bytes;        // ModelBytes when it was added, before edges
+    int refs;
+    bool stale;
+};
+
+struct model_cache {
+    struct list_head lru;
+    int entries;
+    unsigned long bytes;
+    unsigned long hits;
+    unsigned long misses;
+    pthread_mutex_t lock;
+};
+
+struct srv_stats {
+    unsigned long requests;
+    unsigned long errors;
+    double total;
+    double max;
+    double window[SRV_LATENCY_WINDOW];
+    int next;                   // slot of the next latency, wraps around
+    int filled;                 // slots holding a latency, up to the window
+    pthread_mutex_t lock;
+};
+
+struct srv_client {
+    FILE *in;
+    FILE *out;
+    TGA_Image image;
+    float *zbuffer;
+    long zcapacity;
+};
+
+#define _SERVER_h_
+#endif
@@ -0,0 +1,162 @@
+#include "stream.h"
+
+static
+bool
+FS_WriteFrame(struct frame_stream *stream, TGA_Image *image)
+{
+    const int bpp = image->bytespp;
+    const int channels = stream->alpha ? 4 : 3;
+    unsigned long linebytes = (unsigned long)image->width * channels;
+
+    const unsigned char *src = image->data;
+    for (int j = 0; j < image->height; j++) {
+        unsigned char *dst = stream->line;
+        for (int i = 0; i < image->width; i++, src += bpp, dst += channels) {
+            dst[0] = src[2];
+            dst[1] = src[1];
+            dst[2] = src[0];
+            if (channels == 4)
+                dst[3] = (bpp == RGBA) ? src[3] : 255;
+        }
+        if (fwrite(stream->line, 1, linebytes, stream->file) != linebytes)
+            return false;
+    }
+    return fflush(stream->file) == 0;
+}
+
+static
+void *
+FS_WriterThread(void *arg)
+{
+    struct frame_stream *stream = (struct frame_stream *)arg;
+
+    pthread_mutex_lock(&stream->lock);
+    for (;;) {
+        int k = stream->next_write;
+        while (!stream->ready[k] && !stream->done)
+            pthread_cond_wait(&stream->cond, &stream->lock);
+        if (!stream->ready[k])
+            break;
+        pthread_mutex_unlock(&stream->lock);
+
+        double start = T_Now();
+        struct pf_span span = PF_Begin("write frame");
+        bool ok = stream->failed || FS_WriteFrame(stream, &stream->frames[k]);
+        PF_End(&span);
+        double elapsed = T_Now() - start;
+
+        pthread_mutex_lock(&stream->lock);
+        if (!ok && !stream->failed) {
+            fprintf(stderr, "%d: Can't write frame %d\n", ferror(stream->file), stream->written);
+            stream->failed = true;
+        }
+        stream->write_time += elapsed;
+        stream->written++;
+        stream->ready[k] = false;
+        stream->next_write = k ^ 1;
+        pthread_cond_broadcast(&stream->cond);
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+    return NULL;
+}
+
+/**
+ * FS_Init - allocate both frames and start the writer thread
+ * @file: destination, stdout or an opened file/FIFO; not closed by us
+ * @alpha: write rgba instead of rgb24
+ */
+static
+bool
+FS_Init(struct frame_stream *stream, FILE *file, int w, int h, int bpp, bool alpha)
+{
+    memset(stream, 0, sizeof(struct frame_stream));
+    stream->file = file;
+    stream->alpha = alpha;
+    stream->frames[0] = TGA_ImageInit(w, h, bpp);
+    stream->frames[1] = TGA_ImageInit(w, h, bpp);
+    stream->line = (unsigned char *)malloc((unsigned long)w * 4);
+    if (!stream->frames[0].data || !stream->frames[1].data || !stream->line)
+        goto fail;
+
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+    if (pthread_create(&stream->thread, NULL, FS_WriterThread, stream) != 0) {
+        pthread_cond_destroy(&stream->cond);
+        pthread_mutex_destroy(&stream->lock);
+        goto fail;
+    }
+    return true;
+
+fail:
+    fprintf(stderr, "Can't set up the frame stream\n");
+    TGA_ImageDelete(&stream->frames[0]);
+    TGA_ImageDelete(&stream->frames[1]);
+    free(stream->line);
+    stream->line = NULL;
+    return false;
+}
+
+/**
+ * FS_Acquire - get the next frame to render into
+ *
+ * Blocks while the writer still owns it. The frame is cleared.
+ */
+static
+TGA_Image *
+FS_Acquire(struct frame_stream *stream)
+{
+    int k = stream->next_render;
+
+    pthread_mutex_lock(&stream->lock);
+    while (stream->ready[k])
+        pthread_cond_wait(&stream->cond, &stream->lock);
+    pthread_mutex_unlock(&stream->lock);
+
+    TGA_ImageClear(&stream->frames[k]);
+    return &stream->frames[k];
+}
+
+/**
+ * FS_Submit - hand the frame returned by FS_Acquire to the writer
+ */
+static
+bool
+FS_Submit(struct frame_stream *stream)
+{
+    int k = stream->next_render;
+
+    pthread_mutex_lock(&stream->lock);
+    stream->ready[k] = true;
+    stream->next_render = k ^ 1;
+    bool result = !stream->failed;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+
+    return result;
+}
+
+/**
+ * FS_Close - flush the pending frames and stop the writer thread
+ *
+ * Returns false if any frame failed to be written.
+ */
+static
+bool
+FS_Close(struct frame_stream *stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    stream->done = true;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+
+    pthread_join(stream->thread, NULL);
+    pthread_cond_destroy(&stream->cond);
+    pthread_mutex_destroy(&stream->lock);
+
+    TGA_ImageDelete(&stream->frames[0]);
+    TGA_ImageDelete(&stream->frames[1]);
+    free(stream->line);
+    stream->line = NULL;
+    return !stream->failed;
+}
@@ -0,0 +1,36 @@
+/**
+ * Raw frame stream with a background writer thread.
+ *
+ * Two frames are in flight: the renderer fills one while the writer thread
+ * converts the other to packed rgb24/rgba and writes it out, so the I/O of
+ * frame n overlaps the rendering of frame n+1. The output is headerless
+ * and can be piped straight into ffmpeg:
+ *
+ *      ./main -n 120 -o - model.obj | \
+ *          ffmpeg -f rawvideo -pix_fmt rgb24 -s 800x800 -i - out.mp4
+ */
+#ifndef _STREAM_h_
+#include <pthread.h>
+
+struct frame_stream {
+    FILE *file;
+    bool alpha;
+    bool failed;
+    bool done;
+
+    TGA_Image frames[2];
+    bool ready[2];
+    int next_render;
+    int next_write;
+    unsigned char *line;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    int written;
+    double write_time;
+};
+
+#define _STREAM_h_
+#endif
@@ -0,0 +1,243 @@
+#include "texcache.h"
+
+static struct texture_cache TC_Cache = {
+    .lru = LIST_HEAD_INIT(TC_Cache.lru),
+    .budget = TC_DEFAULT_BUDGET,
+    .stats = { .budget = TC_DEFAULT_BUDGET },
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static
+void
+__TC_Free(struct tc_entry *entry)
+{
+    TGA_ImageDelete(&entry->image);
+    BC_Delete(&entry->compressed);
+    free(entry);
+}
+
+/**
+ * Bytes a compressed entry saves over the decoded image.
+ */
+static
+unsigned long
+__TC_Saved(const struct tc_entry *entry)
+{
+    if (!entry->compressed.blocks)
+        return 0;
+    return (unsigned long)entry->image.width * entry->image.height * entry->image.bytespp - entry->bytes;
+}
+
+/**
+ * Drop an entry from the LRU list and the accounting. Needs the lock.
+ */
+static
+void
+__TC_Unlink(struct tc_entry *entry)
+{
+    L_ListDelInit(&entry->head);
+    TC_Cache.stats.entries--;
+    TC_Cache.stats.bytes -= entry->bytes;
+    TC_Cache.stats.saved -= __TC_Saved(entry);
+}
+
+/**
+ * Evict unreferenced entries from the tail until we fit the budget.
+ * Needs the lock.
+ */
+static
+void
+__TC_Evict(void)
+{
+    struct tc_entry *entry, *temp;
+    for (entry = LIST_ENTRY(TC_Cache.lru.prev, struct tc_entry, head),
+         temp = LIST_ENTRY(entry->head.prev, struct tc_entry, head);
+         &entry->head != &TC_Cache.lru && TC_Cache.stats.bytes > TC_Cache.budget;
+         entry = temp, temp = LIST_ENTRY(temp->head.prev, struct tc_entry, head)) {
+        if (entry->refs)
+            continue;
+        __TC_Unlink(entry);
+        __TC_Free(entry);
+        TC_Cache.stats.evictions++;
+    }
+}
+
+static
+void
+TC_SetBudget(unsigned long bytes)
+{
+    pthread_mutex_lock(&TC_Cache.lock);
+    TC_Cache.budget = bytes;
+    TC_Cache.stats.budget = bytes;
+    __TC_Evict();
+    pthread_mutex_unlock(&TC_Cache.lock);
+}
+
+/**
+ * TC_SetCompression - keep the textures loaded from now on block compressed
+ *
+ * Textures already cached keep their format, requests made with the other
+ * setting load their own copy.
+ */
+static
+void
+TC_SetCompression(bool compress)
+{
+    pthread_mutex_lock(&TC_Cache.lock);
+    TC_Cache.compress = compress;
+    pthread_mutex_unlock(&TC_Cache.lock);
+}
+
+static
+void
+TC_GetStats(struct tc_stats *stats)
+{
+    pthread_mutex_lock(&TC_Cache.lock);
+    *stats = TC_Cache.stats;
+    pthread_mutex_unlock(&TC_Cache.lock);
+}
+
+/**
+ * Find a live entry for @path with the given mtime and compression, and
+ * take a reference. Stale entries found on the way are unlinked. Needs the
+ * lock.
+ */
+static
+struct tc_entry *
+__TC_Lookup(const char *path, struct timespec mtime, bool compress)
+{
+    struct tc_entry *entry, *temp;
+    LIST_FOR_EACH_ENTRY_SAFE(entry, temp, &TC_Cache.lru, head) {
+        if (strcmp(entry->path, path) || entry->compress != compress)
+            continue;
+
+        if (entry->mtime.tv_sec == mtime.tv_sec && entry->mtime.tv_nsec == mtime.tv_nsec) {
+            entry->refs++;
+            L_ListMove(&entry->head, &TC_Cache.lru);
+            return entry;
+        }
+
+        __TC_Unlink(entry);
+        if (entry->refs)
+            entry->stale = true;
+        else
+            __TC_Free(entry);
+    }
+    return NULL;
+}
+
+/**
+ * TC_Acquire - get the decoded, vertically flipped texture at @path
+ *
+ * Returns a referenced entry, release it with TC_Release, or NULL when the
+ * file can't be read. The image must be treated as read-only. With
+ * compression on, textures that can be compressed come back in
+ * entry->compressed, with only the dimensions left in the image.
+ */
+static
+struct tc_entry *
+TC_Acquire(const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) == -1)
+        return NULL;
+
+    pthread_mutex_lock(&TC_Cache.lock);
+    const bool compress = TC_Cache.compress;
+    struct tc_entry *entry = __TC_Lookup(path, st.st_mtim, compress);
+    if (entry) {
+        TC_Cache.stats.hits++;
+        pthread_mutex_unlock(&TC_Cache.lock);
+        return entry;
+    }
+    TC_Cache.stats.misses++;
+    pthread_mutex_unlock(&TC_Cache.lock);
+
+    // decode without holding the lock, other textures can still be served
+    struct tc_entry *loaded = (struct tc_entry *)calloc(1, sizeof(struct tc_entry));
+    if (!loaded)
+        return NULL;
+    char cached[sizeof(loaded->path) + sizeof(BC_SUFFIX)];
+    snprintf(cached, sizeof(cached), "%s" BC_SUFFIX, path);
+    if (compress && BC_ReadFile(&loaded->compressed, cached, &st)) {
+        loaded->image = (TGA_Image){
+            .width = loaded->compressed.width,
+            .height = loaded->compressed.height,
+            .bytespp = loaded->compressed.bytespp
+        };
+    } else {
+        struct pf_span decode = PF_Begin("texture decode");
+        bool decoded = TGA_ImageReadFile(&loaded->image, path) && TGA_ImageFlipVertically(&loaded->image);
+        PF_End(&decode);
+        if (!decoded) {
+            __TC_Free(loaded);
+            return NULL;
+        }
+        // textures that can't be compressed stay decoded
+        if (compress) {
+            struct pf_span encode = PF_Begin("texture compress");
+            if (BC_Encode(&loaded->compressed, &loaded->image)) {
+                free(loaded->image.data);
+                loaded->image.data = NULL;
+                BC_WriteFile(&loaded->compressed, cached, &st);
+            }
+            PF_End(&encode);
+        }
+    }
+    snprintf(loaded->path, sizeof(loaded->path), "%s", path);
+    loaded->mtime = st.st_mtim;
+    loaded->compress = compress;
+    loaded->bytes = loaded->compressed.blocks ? BC_Bytes(&loaded->compressed)
+                  : (unsigned long)loaded->image.width * loaded->image.height * loaded->image.bytespp;
+    loaded->refs = 1;
+    INIT_LIST_HEAD(&loaded->head);
+
+    pthread_mutex_lock(&TC_Cache.lock);
+    // someone else may have loaded the same file in the meantime
+    entry = __TC_Lookup(path, st.st_mtim, compress);
+    if (entry) {
+        __TC_Free(loaded);
+    } else {
+        entry = loaded;
+        L_ListAdd(&entry->head, &TC_Cache.lru);
+        TC_Cache.stats.entries++;
+        TC_Cache.stats.bytes += entry->bytes;
+        TC_Cache.stats.saved += __TC_Saved(entry);
+        __TC_Evict();
+    }
+    pthread_mutex_unlock(&TC_Cache.lock);
+
+    return entry;
+}
+
+static
+void
+TC_Release(struct tc_entry *entry)
+{
+    pthread_mutex_lock(&TC_Cache.lock);
+    if (--entry->refs == 0) {
+        if (entry->stale)
+            __TC_Free(entry);
+        else
+            __TC_Evict();
+    }
+    pthread_mutex_unlock(&TC_Cache.lock);
+}
+
+/**
+ * TC_Flush - free every unreferenced entry
+ */
+static
+void
+TC_Flush(void)
+{
+    pthread_mutex_lock(&TC_Cache.lock);
+    struct tc_entry *entry, *temp;
+    LIST_FOR_EACH_ENTRY_SAFE(entry, temp, &TC_Cache.lru, head) {
+        if (entry->refs)
+            continue;
+        __TC_Unlink(entry);
+        __TC_Free(entry);
+    }
+    pthread_mutex_unlock(&TC_Cache.lock);
+}
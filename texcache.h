@@ -0,0 +1,55 @@
+/**
+ * Process wide cache of decoded textures.
+ *
+ * Entries are keyed by path and modification time and handed out as
+ * refcounted, read-only handles, so models sharing a diffuse map share
+ * one decoded copy. Unreferenced entries stay resident until the total
+ * size goes over the byte budget, then the least recently used ones are
+ * evicted. Referenced entries are never evicted, the budget can be
+ * exceeded while they are in use.
+ *
+ * With compression on, textures are kept block compressed (texcomp.h)
+ * instead of decoded. The encoded blocks are saved next to the source as
+ * <texture>.bc1 when that directory is writable, so later loads, from
+ * this process or another one, skip both the decode and the encode.
+ */
+#ifndef _TEXCACHE_h_
+#include <pthread.h>
+#include <sys/stat.h>
+#include "list.h"
+#include "texcomp.h"
+
+#define TC_DEFAULT_BUDGET (256ul << 20)
+
+struct tc_entry {
+    struct list_head head;      // in the LRU list, most recently used first
+    char path[512];
+    struct timespec mtime;
+    TGA_Image image;            // flipped to the orientation models sample in
+    struct bc_texture compressed;   // image.data is NULL when it's used
+    bool compress;              // loaded with compression on
+    unsigned long bytes;
+    int refs;
+    bool stale;                 // file changed, freed on the last release
+};
+
+struct tc_stats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    unsigned long entries;
+    unsigned long bytes;
+    unsigned long saved;        // by the compressed entries
+    unsigned long budget;
+};
+
+struct texture_cache {
+    struct list_head lru;
+    unsigned long budget;
+    bool compress;              // for the textures loaded from now on
+    struct tc_stats stats;
+    pthread_mutex_t lock;
+};
+
+#define _TEXCACHE_h_
+#endif
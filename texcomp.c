@@ -0,0 +1,320 @@
+#include <limits.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include "texcomp.h"
+
+static inline
+uint16_t
+BC_Pack565(const int c[3])
+{
+    return (uint16_t)((((c[2] * 31 + 127) / 255) << 11) | (((c[1] * 63 + 127) / 255) << 5) | ((c[0] * 31 + 127) / 255));
+}
+
+/**
+ * BC_Expand565 - an endpoint as a TGA_Color value, without alpha
+ */
+static inline
+unsigned int
+BC_Expand565(uint16_t c)
+{
+    const unsigned int r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+    return (((r << 3) | (r >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+}
+
+/**
+ * BC_Color - palette entry @k of the expanded endpoints @a and @b
+ *
+ * The channels are spread into 21-bit lanes of one 64-bit word, so the
+ * weighted sum and the division by 3, as a multiply by 683/2048 that is
+ * exact below 766, are done for all three at once.
+ */
+static inline
+unsigned int
+BC_Color(unsigned int a, unsigned int b, int k)
+{
+    const uint64_t wa = (0x01020003u >> (8 * k)) & 3, wb = 3 - wa;
+    const uint64_t la = (a & 0xff) | ((uint64_t)(a & 0xff00) << 13) | ((uint64_t)(a & 0xff0000) << 26);
+    const uint64_t lb = (b & 0xff) | ((uint64_t)(b & 0xff00) << 13) | ((uint64_t)(b & 0xff0000) << 26);
+    const uint64_t q = ((wa * la + wb * lb) * 683) >> 11;
+    return (unsigned int)((q & 0xff) | ((q >> 13) & 0xff00) | ((q >> 26) & 0xff0000));
+}
+
+/**
+ * BC_Texel - TGA_Color value of texel @i, row major, of a block
+ *
+ * Only the palette entry the texel uses is computed, the raster kernels
+ * call it for every sample.
+ */
+static inline
+unsigned int
+BC_Texel(const struct bc_block *block, unsigned int alpha, int i)
+{
+    return BC_Color(BC_Expand565(block->c0), BC_Expand565(block->c1), (block->indices >> (2 * i)) & 3) | alpha << 24;
+}
+
+/**
+ * BC_Fetch - decode the texel at (@x, @y), which must be inside the texture
+ */
+static inline
+TGA_Color
+BC_Fetch(const struct bc_texture *texture, int x, int y)
+{
+    const struct bc_block *block = &texture->blocks[(long)(y >> 2) * texture->bw + (x >> 2)];
+    TGA_Color result = { .val = BC_Texel(block, texture->alpha, ((y & 3) << 2) | (x & 3)) };
+    result.bytespp = texture->bytespp;
+    return result;
+}
+
+/**
+ * BC_Get - texel at (@x, @y), 0 outside of the texture like TGA_ImageGet
+ */
+static
+TGA_Color
+BC_Get(const struct bc_texture *texture, int x, int y)
+{
+    if (!texture->blocks || x < 0 || y < 0 || x >= texture->width || y >= texture->height)
+        return (TGA_Color){ .val = 0, .bytespp = 1 };
+    return BC_Fetch(texture, x, y);
+}
+
+/**
+ * BC_EncodeBlock - fit the 4x4 block at block coordinates (@bx, @by)
+ *
+ * The endpoints are the extremes of the texels along their principal
+ * axis, then each texel takes the closest palette color. Texels past the
+ * right and top edges repeat the last column and row.
+ */
+static
+void
+BC_EncodeBlock(const TGA_Image *image, int bx, int by, struct bc_block *block)
+{
+    int px[16][3];
+    float mean[3] = {0};
+    for (int i = 0; i < 16; i++) {
+        int x = MIN(bx * 4 + (i & 3), image->width - 1);
+        int y = MIN(by * 4 + (i >> 2), image->height - 1);
+        const unsigned char *p = image->data + ((long)y * image->width + x) * image->bytespp;
+        for (int c = 0; c < 3; c++) {
+            px[i][c] = p[c];
+            mean[c] += p[c] / 16.0f;
+        }
+    }
+
+    // covariance xx xy xz yy yz zz, then its dominant eigenvector
+    float cov[6] = {0};
+    for (int i = 0; i < 16; i++) {
+        float d0 = px[i][0] - mean[0], d1 = px[i][1] - mean[1], d2 = px[i][2] - mean[2];
+        cov[0] += d0 * d0; cov[1] += d0 * d1; cov[2] += d0 * d2;
+        cov[3] += d1 * d1; cov[4] += d1 * d2; cov[5] += d2 * d2;
+    }
+    float axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (int k = 0; k < 8; k++) {
+        float v[3] = {
+            cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+            cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+            cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2],
+        };
+        float length = sqrtf(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+        if (length < 1e-6f)
+            break;
+        for (int c = 0; c < 3; c++)
+            axis[c] = v[c] / length;
+    }
+
+    float lo = FLT_MAX, hi = -FLT_MAX;
+    for (int i = 0; i < 16; i++) {
+        float t = (px[i][0] - mean[0]) * axis[0] + (px[i][1] - mean[1]) * axis[1] + (px[i][2] - mean[2]) * axis[2];
+        lo = MIN(lo, t);
+        hi = MAX(hi, t);
+    }
+    int e0[3], e1[3];
+    for (int c = 0; c < 3; c++) {
+        e0[c] = MIN(255, MAX(0, (int)lroundf(mean[c] + hi * axis[c])));
+        e1[c] = MIN(255, MAX(0, (int)lroundf(mean[c] + lo * axis[c])));
+    }
+    block->c0 = BC_Pack565(e0);
+    block->c1 = BC_Pack565(e1);
+
+    const unsigned int a = BC_Expand565(block->c0), b = BC_Expand565(block->c1);
+    unsigned int palette[4];
+    for (int k = 0; k < 4; k++)
+        palette[k] = BC_Color(a, b, k);
+    block->indices = 0;
+    for (int i = 0; i < 16; i++) {
+        int best = 0, best_error = INT_MAX;
+        for (int k = 0; k < 4; k++) {
+            int error = 0;
+            for (int c = 0; c < 3; c++) {
+                int d = px[i][c] - (int)((palette[k] >> (8 * c)) & 255);
+                error += d * d;
+            }
+            if (error < best_error) {
+                best = k;
+                best_error = error;
+            }
+        }
+        block->indices |= (uint32_t)best << (2 * i);
+    }
+}
+
+struct bc_encode {
+    const TGA_Image *image;
+    struct bc_texture *texture;
+};
+
+static
+void
+BC_EncodeRows(void *ctx, int y0, int y1)
+{
+    struct bc_encode *job = (struct bc_encode *)ctx;
+    for (int by = y0; by < y1; by++) {
+        for (int bx = 0; bx < job->texture->bw; bx++)
+            BC_EncodeBlock(job->image, bx, by, &job->texture->blocks[(long)by * job->texture->bw + bx]);
+    }
+}
+
+static
+void
+BC_Delete(struct bc_texture *texture)
+{
+    free(texture->blocks);
+    memset(texture, 0, sizeof(struct bc_texture));
+}
+
+static
+unsigned long
+BC_Bytes(const struct bc_texture *texture)
+{
+    return (unsigned long)texture->bw * texture->bh * sizeof(struct bc_block);
+}
+
+static
+bool
+BC_Alloc(struct bc_texture *texture, int width, int height, int bytespp)
+{
+    memset(texture, 0, sizeof(struct bc_texture));
+    texture->width = width;
+    texture->height = height;
+    texture->bw = (width + 3) / 4;
+    texture->bh = (height + 3) / 4;
+    texture->bytespp = bytespp;
+    texture->alpha = (bytespp == RGBA) ? 255 : 0;
+    texture->blocks = (struct bc_block *)malloc(BC_Bytes(texture));
+    return texture->blocks != NULL;
+}
+
+/**
+ * BC_Encode - compress @image into @texture
+ *
+ * Only RGB and fully opaque RGBA images can be compressed, returns false
+ * for anything else. Block rows are encoded in parallel.
+ */
+static
+bool
+BC_Encode(struct bc_texture *texture, const TGA_Image *image)
+{
+    if (!image->data || image->width < 1 || image->height < 1)
+        return false;
+    if (image->bytespp != RGB && image->bytespp != RGBA)
+        return false;
+    if (image->bytespp == RGBA) {
+        for (long i = (long)image->width * image->height; i--; ) {
+            if (image->data[i * RGBA + 3] != 255)
+                return false;
+        }
+    }
+    if (!BC_Alloc(texture, image->width, image->height, image->bytespp))
+        return false;
+
+    struct bc_encode job = { .image = image, .texture = texture };
+    // fitting a block costs about as much as flipping 16x its bytes
+    IOP_Parallel(BC_EncodeRows, &job, texture->bh, (long)image->width * image->height * image->bytespp * 16);
+    return true;
+}
+
+/**
+ * BC_Decode - expand @texture into an image of its source format
+ */
+static
+bool
+BC_Decode(const struct bc_texture *texture, TGA_Image *image)
+{
+    *image = TGA_ImageInit(texture->width, texture->height, texture->bytespp);
+    if (!image->data)
+        return false;
+    for (int y = 0; y < texture->height; y++) {
+        unsigned char *p = image->data + (long)y * texture->width * texture->bytespp;
+        for (int x = 0; x < texture->width; x++, p += texture->bytespp)
+            memcpy(p, BC_Fetch(texture, x, y).raw, texture->bytespp);
+    }
+    return true;
+}
+
+/**
+ * BC_WriteFile - save @texture, encoded from the file described by @source
+ *
+ * Written to a temporary name then renamed, so readers never see a
+ * partial file.
+ */
+static
+bool
+BC_WriteFile(const struct bc_texture *texture, const char *filename, const struct stat *source)
+{
+    char temp[1024];
+    snprintf(temp, sizeof(temp), "%s.%d", filename, (int)getpid());
+    FILE *file = fopen(temp, "wb");
+    if (file == NULL)
+        return false;
+
+    struct bc_file_header header = {
+        .magic = BC_MAGIC,
+        .width = texture->width,
+        .height = texture->height,
+        .bytespp = texture->bytespp,
+        .source_size = source->st_size,
+        .source_sec = source->st_mtim.tv_sec,
+        .source_nsec = source->st_mtim.tv_nsec,
+    };
+    const unsigned long count = (unsigned long)texture->bw * texture->bh;
+    bool result = fwrite(&header, sizeof(header), 1, file) == 1
+               && fwrite(texture->blocks, sizeof(struct bc_block), count, file) == count;
+    result = !fclose(file) && result;
+    if (result)
+        result = !rename(temp, filename);
+    if (!result)
+        unlink(temp);
+    return result;
+}
+
+/**
+ * BC_ReadFile - load a texture saved by BC_WriteFile
+ *
+ * Fails when the file wasn't encoded from the current version of the
+ * @source file.
+ */
+static
+bool
+BC_ReadFile(struct bc_texture *texture, const char *filename, const struct stat *source)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL)
+        return false;
+
+    struct bc_file_header header;
+    bool result = fread(&header, sizeof(header), 1, file) == 1
+               && !memcmp(header.magic, BC_MAGIC, sizeof(header.magic))
+               && header.source_size == source->st_size
+               && header.source_sec == source->st_mtim.tv_sec
+               && header.source_nsec == source->st_mtim.tv_nsec
+               && header.width > 0 && header.height > 0
+               && (header.bytespp == RGB || header.bytespp == RGBA)
+               && BC_Alloc(texture, header.width, header.height, header.bytespp);
+    if (result) {
+        const unsigned long count = (unsigned long)texture->bw * texture->bh;
+        result = fread(texture->blocks, sizeof(struct bc_block), count, file) == count;
+        if (!result)
+            BC_Delete(texture);
+    }
+    fclose(file);
+    return result;
+}
@@ -0,0 +1,46 @@
+/**
+ * Block compressed textures.
+ *
+ * A BC1-like fixed rate format: each 4x4 block of texels is stored in 8
+ * bytes, two RGB565 endpoints and a 2-bit index per texel choosing one of
+ * the endpoints or the colors at 1/3 and 2/3 between them. That is 6x less
+ * memory than RGB and 8x less than RGBA, so far more of a large texture
+ * stays in cache while sampling. Only the four color mode is used, there
+ * is no punch-through alpha: RGBA textures are compressed only when they
+ * are fully opaque.
+ *
+ * Encoded textures can be saved next to their source and loaded back, the
+ * file records the size and modification time of the source it came from.
+ */
+#ifndef _TEXCOMP_h_
+#include <stdint.h>
+
+#define BC_MAGIC "BC1T"
+#define BC_SUFFIX ".bc1"
+
+struct bc_block {
+    uint16_t c0, c1;            // RGB565 endpoints, red in the top bits
+    uint32_t indices;           // 2 bits per texel, row major from bit 0
+};
+
+struct bc_texture {
+    struct bc_block *blocks;    // rows of bw blocks, same row order as the image
+    int width;
+    int height;
+    int bw, bh;                 // blocks per row and per column
+    int bytespp;                // of the source image
+    unsigned char alpha;        // of every texel: 0 for RGB, as sampled raw
+};
+
+struct bc_file_header {
+    char magic[4];
+    int32_t width;
+    int32_t height;
+    int32_t bytespp;
+    int64_t source_size;
+    int64_t source_sec;         // source modification time
+    int64_t source_nsec;
+};
+
+#define _TEXCOMP_h_
+#endif
@@ -3,6 +3,10 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <immintrin.h>
 #include "tga_img.h"
 
 static
@@ -14,8 +18,8 @@ TGA_ImageInit(int w, int h, int bpp)
                             .height = h,
                             .bytespp = bpp };
 
-    unsigned long nbytes = w * h * bpp;
-    result.data = (unsigned char *)calloc(nbytes, sizeof(unsigned char));
+    unsigned long nbytes = (unsigned long)w * h * bpp;
+    result.data = (unsigned char *)calloc(nbytes + TGA_PADDING, sizeof(unsigned char));
 
     return result;
 }
@@ -31,93 +35,139 @@ TGA_ImageDelete(TGA_Image *image)
     image->data = NULL;
 }
 
+/**
+ * TGA_MatchBytes - number of leading bytes equal in @a and @b, at most @n
+ *
+ * The scan for pixel runs of the RLE encoder, one variant per cpu_isa.
+ */
+__attribute__((target("sse2")))
+static
+long
+TGA_MatchBytes_SSE2(const unsigned char *a, const unsigned char *b, long n)
+{
+    long i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i eq = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(a + i)), _mm_loadu_si128((const __m128i *)(b + i)));
+        unsigned int differ = ~_mm_movemask_epi8(eq) & 0xffffu;
+        if (differ)
+            return i + __builtin_ctz(differ);
+    }
+    while (i < n && a[i] == b[i])
+        i++;
+    return i;
+}
+
+__attribute__((target("avx2")))
+static
+long
+TGA_MatchBytes_AVX2(const unsigned char *a, const unsigned char *b, long n)
+{
+    long i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(a + i)),
+                                       _mm256_loadu_si256((const __m256i *)(b + i)));
+        unsigned int differ = ~(unsigned int)_mm256_movemask_epi8(eq);
+        if (differ)
+            return i + __builtin_ctz(differ);
+    }
+    while (i < n && a[i] == b[i])
+        i++;
+    return i;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static
+long
+TGA_MatchBytes_AVX512(const unsigned char *a, const unsigned char *b, long n)
+{
+    long i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __mmask64 differ = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+        if (differ)
+            return i + __builtin_ctzll(differ);
+    }
+    while (i < n && a[i] == b[i])
+        i++;
+    return i;
+}
+
+static long (*const TGA_MatchBytes[CPU_NISAS])(const unsigned char *, const unsigned char *, long) = {
+    [CPU_SSE2] = TGA_MatchBytes_SSE2, [CPU_AVX2] = TGA_MatchBytes_AVX2, [CPU_AVX512] = TGA_MatchBytes_AVX512
+};
+
+/**
+ * TGA_ImageLoadRLEData - decode the RLE packets of the pixel data
+ *
+ * Raw packets are read with one fread, runs are filled by doubling the
+ * copied span.
+ */
 static
 bool
 TGA_ImageLoadRLEData(TGA_Image *image, FILE *file)
 {
+    const int bpp = image->bytespp;
     unsigned long pixelCount   = image->width * image->height;
     unsigned long currentPixel = 0;
-    unsigned long currentByte  = 0;
-    TGA_Color colorBuffer;
 
     do {
-        unsigned char chunkHeader = 0;
-        if (fscanf(file, "%c", &chunkHeader) == 0) {
+        int chunkHeader = getc(file);
+        if (chunkHeader == EOF) {
             fprintf(stderr, "An error occured while reading data\n");
             return false;
         }
 
-        if (chunkHeader < 128) {
-            chunkHeader++;
-            for (int i = 0; i < chunkHeader; i++) {
-                if (fread((void *)colorBuffer.raw, sizeof(char), image->bytespp, file) == 0) {
-                    fprintf(stderr, "An error occured while reading the header\n");
-                    return false;
-                }
-
-                for (int t = 0; t < image->bytespp; t++)
-                    image->data[currentByte++] = colorBuffer.raw[t];
-
-                currentPixel++;
-                if (currentPixel > pixelCount) {
-                    fprintf(stderr, "Too many pixels read\n");
-                    return false;
-                }
-            }
-        } else {
-            chunkHeader -= 127;
-            if (fread((void *)colorBuffer.raw, sizeof(char), image->bytespp, file) == 0) {
-                fprintf(stderr, "An error occured while reading the header\n");
-                return false;
-            }
-
-            for (int i = 0; i < chunkHeader; i++) {
-                for (int t = 0; t < image->bytespp; t++)
-                    image->data[currentByte++] = colorBuffer.raw[t];
-
-                currentPixel++;
-                if (currentPixel > pixelCount) {
-                    fprintf(stderr, "Too many pixels read\n");
-                    return false;
-                }
-            }
+        unsigned long count = (chunkHeader & 127) + 1;
+        if (currentPixel + count > pixelCount) {
+            fprintf(stderr, "Too many pixels read\n");
+            return false;
+        }
+
+        unsigned char *dst = image->data + currentPixel * bpp;
+        const unsigned long stored = (chunkHeader < 128) ? count : 1;
+        if (fread((void *)dst, bpp, stored, file) != stored) {
+            fprintf(stderr, "An error occured while reading the header\n");
+            return false;
         }
+        if (chunkHeader >= 128) {
+            for (unsigned long done = 1; done < count; done *= 2)
+                memcpy(dst + done * bpp, dst, MIN(done, count - done) * bpp);
+        }
+        currentPixel += count;
     } while (currentPixel < pixelCount);
 
     return true;
 }
 
+/**
+ * TGA_ImageUnloadRLEData - encode the pixel data as RLE packets
+ *
+ * A packet repeats one pixel when it equals the next, otherwise it holds
+ * raw pixels up to the start of the next run. At most 128 pixels each.
+ */
 static
 bool
 TGA_ImageUnloadRLEData(TGA_Image *image, FILE *file)
 {
-    const unsigned char maxChunkLength = 128;
+    const unsigned long maxChunkLength = 128;
+    const int           bpp            = image->bytespp;
     unsigned long       npixels        = image->width * image->height;
     unsigned long       curpix         = 0;
 
     while (curpix < npixels) {
-        unsigned long chunkstart = curpix * image->bytespp;
-        unsigned long curbyte    = curpix * image->bytespp;
-        unsigned char runLength  = 1;
-        bool raw = true;
-
-        while (curpix + runLength < npixels && runLength < maxChunkLength) {
-            bool succEq = true;
-            for (int t = 0; succEq && t < image->bytespp; t++)
-                succEq = (image->data[curbyte + t] == image->data[curbyte + t + image->bytespp]);
-
-            curbyte += image->bytespp;
-            if (1 == runLength) {
-                raw = !succEq;
-            }
-            if (raw && succEq) {
-                runLength--;
-                break;
-            }
-            if (!raw && !succEq) {
-                break;
-            }
-            runLength++;
+        const unsigned char *chunk = image->data + curpix * bpp;
+        unsigned long maxLength = MIN(maxChunkLength, npixels - curpix);
+        unsigned long runLength = 1;
+        bool raw = maxLength == 1 || memcmp(chunk, chunk + bpp, bpp);
+
+        if (raw) {
+            while (runLength + 1 < maxLength
+                    && memcmp(chunk + runLength * bpp, chunk + (runLength + 1) * bpp, bpp))
+                runLength++;
+            if (runLength + 1 == maxLength)
+                runLength = maxLength;
+        } else {
+            // pixel i repeats pixel i + 1 as long as the bytes bpp apart match
+            runLength += TGA_MatchBytes[CPU_Isa](chunk, chunk + bpp, (maxLength - 1) * bpp) / bpp;
         }
         curpix += runLength;
 
@@ -126,8 +176,8 @@ TGA_ImageUnloadRLEData(TGA_Image *image, FILE *file)
             return false;
         }
 
-        if (fwrite( image->data + chunkstart,
-                    (raw ? runLength * image->bytespp : image->bytespp),
+        if (fwrite( chunk,
+                    (raw ? runLength * bpp : bpp),
                     1,
                     file) == 0) {
             fprintf(stderr, "%d: Can't dump the data to file\n", ferror(file));
@@ -138,73 +188,161 @@ TGA_ImageUnloadRLEData(TGA_Image *image, FILE *file)
     return true;
 }
 
+/* Empty developer and extension area offsets, then the TGA 2.0 signature. */
+static const unsigned char TGA_Footer[26] = { 0, 0, 0, 0, 0, 0, 0, 0,
+                                              'T', 'R', 'U', 'E', 'V', 'I', 'S',
+                                              'I', 'O', 'N', '-', 'X', 'F',
+                                              'I', 'L', 'E', '.', '\0'};
+
+/**
+ * TGA_HeaderInit - header of a @w x @h image stored top row first
+ */
 static
-bool
-TGA_ImageWriteFile(TGA_Image *image, const char *filename, bool rle)
+TGA_Header
+TGA_HeaderInit(int w, int h, int bpp, bool rle)
 {
-    unsigned char developer_area_ref[4] = {0};
-    unsigned char extension_area_ref[4] = {0};
-    unsigned char footer[18]            = { 'T', 'R', 'U', 'V', 'I', 'S',
-                                            'I', 'O', 'N', '-', 'X', 'F',
-                                            'I', 'L', 'E', '.', '\0'};
-
-    FILE *file = fopen(filename, "w");
-    if (file == NULL) {
-        fprintf(stderr, "Can't open file %s\n", filename);
-        fclose(file);
-        return false;
-    }
-
     TGA_Header header = {
-        .bitsperpixel = image->bytespp << 3,
-        .width = image->width,
-        .height = image->height,
-        .datatypecode = (image->bytespp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2)),
+        .bitsperpixel = bpp << 3,
+        .width = w,
+        .height = h,
+        .datatypecode = (bpp == GRAYSCALE ? (rle ? 11 : 3) : (rle ? 10 : 2)),
         .imagedescriptor = 0x20 // top-left is the origin
     };
+    return header;
+}
+
+static
+bool
+TGA_WriteHeader(FILE *file, int w, int h, int bpp, bool rle)
+{
+    TGA_Header header = TGA_HeaderInit(w, h, bpp, rle);
 
     if (fwrite(&header, sizeof(header), 1, file) == 0) {
         fprintf(stderr, "Can't open Dump the TGA file\n");
-        fclose(file);
         return false;
     }
+    return true;
+}
 
+static
+bool
+TGA_WriteFooter(FILE *file)
+{
+    if (fwrite(TGA_Footer, sizeof(TGA_Footer), 1, file) == 0) {
+        fprintf(stderr, "Can't dump the footer\n");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * TGA_WritePixels - the pixel data of @image, raw or as RLE packets
+ *
+ * A band of a larger image can be written on its own, the RLE packets
+ * then stop at its last pixel.
+ */
+static
+bool
+TGA_WritePixels(TGA_Image *image, FILE *file, bool rle)
+{
     if (!rle) {
-        if (fwrite(image->data, sizeof(char), image->width * image->height * image->bytespp, file) == 0) {
+        if (fwrite(image->data, sizeof(char), (unsigned long)image->width * image->height * image->bytespp, file) == 0) {
             fprintf(stderr, "Can't unload the raw data\n");
-            fclose(file);
             return false;
         }
     } else {
         if (!TGA_ImageUnloadRLEData(image, file)) {
             fprintf(stderr, "Can't unload RLE Data\n");
-            fclose(file);
             return false;
         }
     }
+    return true;
+}
 
-    if (fwrite(developer_area_ref, sizeof(developer_area_ref), 1, file) == 0) {
-        fprintf(stderr, "Can't dump the TGA file\n");
-        fclose(file);
+static
+bool
+TGA_ImageWriteFile(TGA_Image *image, const char *filename, bool rle)
+{
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Can't open file %s\n", filename);
         return false;
     }
 
-    if (fwrite(extension_area_ref, sizeof(extension_area_ref), 1, file) == 0) {
-        fprintf(stderr, "Can't dump the TGA file\n");
-        fclose(file);
+    bool result = TGA_WriteHeader(file, image->width, image->height, image->bytespp, rle)
+               && TGA_WritePixels(image, file, rle)
+               && TGA_WriteFooter(file);
+    fclose(file);
+    return result;
+}
+
+/**
+ * TGA_ImageMapFile - create an uncompressed TGA file and map its pixels
+ * @map: filled in on success, map->image is a zeroed top-down framebuffer
+ * @filename: created or truncated
+ *
+ * The header and footer are written up front, so the file is complete as
+ * soon as the pixels are. Release with TGA_ImageUnmapFile, never with
+ * TGA_ImageDelete.
+ */
+static
+bool
+TGA_ImageMapFile(TGA_Mapping *map, const char *filename, int w, int h, int bpp)
+{
+    memset(map, 0, sizeof(*map));
+    if (w <= 0 || h <= 0 || (bpp != GRAYSCALE && bpp != RGB && bpp != RGBA))
+        return false;
+
+    int fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "Can't open file %s\n", filename);
         return false;
     }
 
-    if (fwrite(footer, sizeof(footer), 1, file) == 0) {
-        fprintf(stderr, "Can't dump the footer\n");
-        fclose(file);
+    TGA_Header header = TGA_HeaderInit(w, h, bpp, false);
+    unsigned long nbytes = (unsigned long)w * h * bpp;
+    unsigned long length = sizeof(header) + nbytes + sizeof(TGA_Footer);
+
+    if (ftruncate(fd, length) == -1) {
+        fprintf(stderr, "Can't size %s to %lu bytes\n", filename, length);
+        close(fd);
         return false;
     }
 
-    fclose(file);
+    void *base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "Can't map %s\n", filename);
+        return false;
+    }
+
+    map->base = (unsigned char *)base;
+    map->length = length;
+    memcpy(map->base, &header, sizeof(header));
+    memcpy(map->base + sizeof(header) + nbytes, TGA_Footer, sizeof(TGA_Footer));
+    map->image = (TGA_Image){
+        .data = map->base + sizeof(header),
+        .width = w,
+        .height = h,
+        .bytespp = bpp
+    };
     return true;
 }
 
+/**
+ * TGA_ImageUnmapFile - unmap a file from TGA_ImageMapFile
+ *
+ * The pixels are written back by the kernel, the file is left as is.
+ */
+static
+void
+TGA_ImageUnmapFile(TGA_Mapping *map)
+{
+    if (map->base)
+        munmap(map->base, map->length);
+    memset(map, 0, sizeof(*map));
+}
+
 static
 TGA_Color
 TGA_ImageGet(TGA_Image *image, int x, int y)
@@ -238,43 +376,14 @@ static
 bool
 TGA_ImageFlipHorizontally(TGA_Image *image)
 {
-    if (!image->data)
-        return false;
-
-    int half = image->width >> 1;
-    for (int i = 0; i < half; i++) {
-        for (int j = 0; j < image->height; j++) {
-            TGA_Color c1 = TGA_ImageGet(image, i, j);
-            TGA_Color c2 = TGA_ImageGet(image, image->width - 1 - i, j);
-            TGA_ImageSet(image, i, j, c2);
-            TGA_ImageSet(image, image->width - 1 - i, j, c1);
-        }
-    }
-
-    return true;
+    return IOP_FlipHorizontally(image);
 }
 
 static
 bool
 TGA_ImageFlipVertically(TGA_Image *image)
 {
-    if (!image->data)
-        return false;
-
-    unsigned long bytesPerLine = image->width * image->bytespp;
-    unsigned char *line = calloc(sizeof(char), bytesPerLine);
-    int half = image->height >> 1;
-    for (int j = 0; j < half; j++) {
-        unsigned long l1 = j * bytesPerLine;
-        unsigned long l2 = (image->height - 1 - j) * bytesPerLine;
-
-        memmove((void *)line, (void *)(image->data + l1), bytesPerLine);
-        memmove((void *)(image->data + l1), (void *)(image->data + l2), bytesPerLine);
-        memmove((void *)(image->data + l2), (void *)line, bytesPerLine);
-    }
-
-    free(line);
-    return true;
+    return IOP_FlipVertically(image);
 }
 
 static
@@ -287,7 +396,6 @@ TGA_ImageReadFile(TGA_Image *image, const char *filename)
     FILE *file = fopen(filename, "r");
     if (file == NULL) {
         fprintf(stderr, "Can't open file: %s\n", filename);
-        fclose(file);
         return false;
     }
 
@@ -309,7 +417,7 @@ TGA_ImageReadFile(TGA_Image *image, const char *filename)
     }
 
     unsigned long nbytes = image->width * image->height * image->bytespp;
-    image->data = (unsigned char *)calloc(nbytes, sizeof(unsigned char));
+    image->data = (unsigned char *)calloc(nbytes + TGA_PADDING, sizeof(unsigned char));
     if (3 == header.datatypecode || 2 == header.datatypecode) {
         if (fread(image->data, sizeof(char), nbytes, file) != nbytes) {
             fprintf(stderr, "And error occured while reading the data\n");
@@ -335,7 +443,6 @@ TGA_ImageReadFile(TGA_Image *image, const char *filename)
         TGA_ImageFlipHorizontally(image);
     }
 
-    fprintf(stderr, "%dx%d/%d\n", image->width, image->height, image->bytespp*8);
     fclose(file);
     return true;
 }
@@ -344,51 +451,29 @@ static
 void
 TGA_ImageClear(TGA_Image *image)
 {
-    memset((void *)image->data, 0, image->width * image->height * image->bytespp);
+    memset((void *)image->data, 0, (unsigned long)image->width * image->height * image->bytespp);
 }
 
+/**
+ * TGA_ImageScale - resize @image to @w x @h
+ *
+ * Shrinking averages the covered pixels, anything else is bilinear.
+ */
 static
 bool
 TGA_ImageScale(TGA_Image *image, int w, int h)
 {
     if (w <= 0 || h <= 0 || !image->data)
         return false;
-    unsigned char *tdata = calloc(sizeof(char), w * h * image->bytespp);
-    int nscanline = 0;
-    int oscanline = 0;
-    int erry = 0;
-
-    unsigned long nlinebytes = w * image->bytespp;
-    unsigned long olinebytes = image->width * image->bytespp;
-
-    for (int j = 0; j < image->height; j++) {
-        int errx = image->width = 2;
-        int nx = -image->bytespp;
-        int ox = -image->bytespp;
-
-        for (int i = 0; i < image->width; i++) {
-            ox += image->bytespp;
-            errx += w;
-            while (errx >= (int)image->width) {
-                errx -= image->width;
-                nx += image->bytespp;
-                memcpy(tdata + nscanline + nx, image->data+oscanline+ox, image->bytespp);
-            }
-        }
-        erry += h;
-        oscanline += olinebytes;
-        while (erry >= (int)image->height) {
-            if (erry >= (int)image->height << 1)
-                memcpy(tdata + nscanline + nlinebytes, tdata + nscanline, nlinebytes);
-            erry -= image->height;
-            nscanline += nlinebytes;
-        }
+
+    TGA_Image scaled = TGA_ImageInit(w, h, image->bytespp);
+    enum iop_filter filter = (w <= image->width && h <= image->height) ? IOP_BOX : IOP_BILINEAR;
+    if (!scaled.data || !IOP_Resize(image, &scaled, filter)) {
+        TGA_ImageDelete(&scaled);
+        return false;
     }
 
     free(image->data);
-    image->data = tdata;
-    image->width = w;
-    image->height = h;
-
+    *image = scaled;
     return true;
 }
@@ -38,6 +38,18 @@ typedef struct TGA_Image {
     int bytespp;
 } TGA_Image;
 
+/* An uncompressed TGA file mapped into memory, image.data points at its
+ * pixels so whatever is drawn there is already the file contents. */
+typedef struct TGA_Mapping {
+    TGA_Image image;
+    unsigned char *base;
+    unsigned long length;
+} TGA_Mapping;
+
+/* Pixel buffers are over-allocated by this much so that the last pixel can
+ * be fetched as a whole 32-bit word. */
+#define TGA_PADDING 4
+
 enum TGA_Format {
     GRAYSCALE = 1,
     RGB = 3,
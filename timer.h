@@ -0,0 +1,17 @@
+#ifndef _TIMER_h_
+#include <time.h>
+
+/**
+ * T_Now - monotonic wall clock in seconds
+ */
+static inline
+double
+T_Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define _TIMER_h_
+#endif
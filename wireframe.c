@@ -0,0 +1,118 @@
+#include "render.h"
+
+/**
+ * WF_ClipLine - Liang-Barsky clip of a segment to [0, w-1] x [0, h-1]
+ *
+ * Returns false when nothing of the segment is left.
+ */
+static
+bool
+WF_ClipLine(float *x0, float *y0, float *x1, float *y1, int w, int h)
+{
+    const float dx = *x1 - *x0;
+    const float dy = *y1 - *y0;
+    const float p[4] = { -dx, dx, -dy, dy };
+    const float q[4] = { *x0, (w - 1) - *x0, *y0, (h - 1) - *y0 };
+    float t0 = 0.0f, t1 = 1.0f;
+
+    for (int i = 0; i < 4; i++) {
+        if (p[i] == 0.0f) {
+            if (q[i] < 0.0f)
+                return false;
+            continue;
+        }
+        float t = q[i] / p[i];
+        if (p[i] < 0.0f) {
+            if (t > t1) return false;
+            t0 = MAX(t0, t);
+        } else {
+            if (t < t0) return false;
+            t1 = MIN(t1, t);
+        }
+    }
+
+    float sx = *x0, sy = *y0;
+    *x0 = MIN(MAX(sx + t0 * dx, 0.0f), w - 1);
+    *y0 = MIN(MAX(sy + t0 * dy, 0.0f), h - 1);
+    *x1 = MIN(MAX(sx + t1 * dx, 0.0f), w - 1);
+    *y1 = MIN(MAX(sy + t1 * dy, 0.0f), h - 1);
+    return true;
+}
+
+/**
+ * WF_Line - integer Bresenham between two points inside the frame
+ * @top: frame row of the first row of @image
+ *
+ * The endpoints must already be clipped to the frame. Only the pixels on
+ * the rows @image holds are written, so a frame drawn band by band gets
+ * the same lines as in one piece.
+ */
+static
+void
+WF_Line(TGA_Image *image, int top, int x0, int y0, int x1, int y1, TGA_Color color)
+{
+    const int bpp = image->bytespp;
+    const long stride = (long)image->width * bpp;
+    const unsigned long size = (unsigned long)stride * image->height;
+    const int dx = abs(x1 - x0);
+    const int dy = abs(y1 - y0);
+    const long sx = (x1 >= x0) ? bpp : -bpp;
+    const long sy = (y1 >= y0) ? stride : -stride;
+
+    // step along the major axis, and along the minor one on overflow
+    const long major = (dx >= dy) ? sx : sy;
+    const long minor = (dx >= dy) ? sy : sx;
+    const int dmajor = MAX(dx, dy);
+    const int dminor = MIN(dx, dy);
+
+    // x stays inside the rows, so the offset is in range on the held rows only
+    long offset = (long)(y0 - top) * stride + (long)x0 * bpp;
+    int error = 2 * dminor - dmajor;
+    for (int i = 0; i <= dmajor; i++, offset += major) {
+        if ((unsigned long)offset < size)
+            memcpy(image->data + offset, color.raw, bpp);
+        if (error > 0) {
+            offset += minor;
+            error -= 2 * dmajor;
+        }
+        error += 2 * dminor;
+    }
+}
+
+/**
+ * WF_Draw - draw every unique edge of @model into the final image
+ * @vs: vertex stage used for the shaded render, so edges line up with it
+ * @top: frame row of the first row of @image, 0 unless it holds a band
+ *       of a vs->width x vs->height frame
+ *
+ * The image is expected in its final orientation, after the vertical
+ * flip at the end of the shaded render.
+ */
+static
+bool
+WF_Draw(struct model *model, TGA_Image *image, const struct vertex_stage *vs, int top, TGA_Color color)
+{
+    int nedges;
+    const v2i *edges = ModelEdges(model, &nedges);
+    if (!edges || !image->data)
+        return false;
+
+    v2f *pts = (v2f *)malloc(sizeof(v2f) * MAX(model->nverts, 1));
+    if (!pts)
+        return false;
+    for (int i = 0; i < model->nverts; i++) {
+        v3f p = projectVertex(vs, ModelVertex(model, i));
+        pts[i] = V2_float(p.x, vs->height - 1 - p.y);
+    }
+
+    for (int i = 0; i < nedges; i++) {
+        v2f a = pts[edges[i].x], b = pts[edges[i].y];
+        if (MAX(a.y, b.y) < top - 0.5f || MIN(a.y, b.y) > top + image->height - 0.5f)
+            continue;
+        if (WF_ClipLine(&a.x, &a.y, &b.x, &b.y, vs->width, vs->height))
+            WF_Line(image, top, lrintf(a.x), lrintf(a.y), lrintf(b.x), lrintf(b.y), color);
+    }
+
+    free(pts);
+    return true;
+}
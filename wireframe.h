@@ -0,0 +1,19 @@
+/**
+ * Clipped line drawing and wireframe rendering.
+ *
+ * Lines are clipped against the frame with Liang-Barsky before being
+ * walked with an integer Bresenham, whose only per pixel check is that
+ * the row is held by the image when it is a band of the frame.
+ * Wireframes transform every vertex once and draw each unique edge of the
+ * model (see ModelEdges) once, however many faces share it.
+ */
+#ifndef _WIREFRAME_h_
+
+enum render_wireframe {
+    WIREFRAME_OFF = 0,
+    WIREFRAME_ONLY,             // edges on an empty background
+    WIREFRAME_OVERLAY,          // edges drawn over the shaded render
+};
+
+#define _WIREFRAME_h_
+#endif